@@ -16,11 +16,112 @@
 #include "economy_base.h"
 #include "cargoaction.h"
 #include "order_type.h"
+#include "vehicle_base.h"
+#include "date_func.h"
+#include "settings_type.h"
+#include <algorithm>
+#include <vector>
 
 /* Initialize the cargopacket-pool */
 CargoPacketPool _cargopacket_pool("CargoPacket");
 INSTANTIATE_POOL_METHODS(CargoPacket)
 
+CargoCompactionStats _cargo_compaction_stats; ///< Result of the last compaction of all cargo lists.
+
+/** Journal recording the packets allocated and freed in this thread, if any. */
+static THREAD_LOCAL CargoPacketJournal *_current_journal = NULL;
+
+/**
+ * Key for finding packets which may be merged when compacting a cargo list.
+ * Packets have to match exactly in everything but their days in transit,
+ * which only have to fall into the same window.
+ */
+struct CompactionKey {
+	uint32 place;           ///< Next hop for stations, tile the cargo has been loaded at for vehicles.
+	StationID source;       ///< Station the packet was first loaded at.
+	TileIndex source_xy;    ///< Origin of the packet.
+	SourceID source_id;     ///< Source of the packet.
+	SourceType source_type; ///< Type of the source.
+	byte days_window;       ///< Days in transit divided by the size of the window.
+
+	/**
+	 * Create the key for a packet.
+	 * @param place Next hop or loading tile of the packet.
+	 * @param cp Packet to create the key for.
+	 * @param window Size of the window for the days in transit.
+	 */
+	CompactionKey(uint32 place, const CargoPacket *cp, uint window) : place(place), source(cp->SourceStation()), source_xy(cp->SourceStationXY()),
+			source_id(cp->SourceSubsidyID()), source_type(cp->SourceSubsidyType()), days_window(cp->DaysInTransit() / window) {}
+
+	/**
+	 * Compare two keys.
+	 * @param other Key to compare with.
+	 * @return If this key is smaller than the other one.
+	 */
+	inline bool operator<(const CompactionKey &other) const
+	{
+		if (this->place != other.place) return this->place < other.place;
+		if (this->source != other.source) return this->source < other.source;
+		if (this->source_xy != other.source_xy) return this->source_xy < other.source_xy;
+		if (this->source_id != other.source_id) return this->source_id < other.source_id;
+		if (this->source_type != other.source_type) return this->source_type < other.source_type;
+		return this->days_window < other.days_window;
+	}
+};
+
+/** Packets further packets of the same kind are merged into when compacting a cargo list. */
+typedef std::map<CompactionKey, CargoPacket *> CompactionMap;
+
+/**
+ * Merge a packet into the earlier packet of the same kind, if that one still
+ * has room for it. Otherwise the packet becomes the one to merge into.
+ * @param targets Packets to merge into.
+ * @param key Compaction key of the packet.
+ * @param cp Packet to be merged.
+ * @return If the packet has been merged and deleted.
+ */
+static bool CompactPacket(CompactionMap &targets, const CompactionKey &key, CargoPacket *cp)
+{
+	std::pair<CompactionMap::iterator, bool> ins = targets.insert(std::make_pair(key, cp));
+	if (ins.second) return false;
+
+	CargoPacket *icp = ins.first->second;
+	if (icp->Count() + cp->Count() <= CargoPacket::MAX_COUNT) {
+		icp->Merge(cp);
+		return true;
+	}
+	ins.first->second = cp;
+	return false;
+}
+
+/**
+ * Compact the cargo lists of all stations and vehicles, merging packets which
+ * only differ a little in their days in transit. The allowed difference is
+ * given by the setting economy.cargo_merge_tolerance.
+ */
+void CargoPacketMonthlyLoop()
+{
+	uint window = _settings_game.economy.cargo_merge_tolerance + 1;
+	_cargo_compaction_stats.date = _date;
+	_cargo_compaction_stats.before = (uint)CargoPacket::GetNumItems();
+
+	Station *st;
+	FOR_ALL_STATIONS(st) {
+		for (CargoID c = 0; c < NUM_CARGO; c++) st->goods[c].cargo.Compact(window);
+	}
+
+	Vehicle *v;
+	FOR_ALL_VEHICLES(v) v->cargo.Compact(window);
+
+	_cargo_compaction_stats.after = (uint)CargoPacket::GetNumItems();
+}
+
+/** Forget about the last compaction when starting or loading a game. */
+void InitializeCargoPackets()
+{
+	memset(&_cargo_compaction_stats, 0, sizeof(_cargo_compaction_stats));
+}
+
 /**
  * Create a new packet for savegame loading.
  */
@@ -81,14 +182,45 @@ CargoPacket::CargoPacket(uint16 count, byte days_in_transit, StationID source, T
 	this->source_type = source_type;
 }
 
+/**
+ * Allocate a packet. If a journal is recording in this thread the packet
+ * only gets a slot in the pool when the journal is replayed.
+ * @param size Size of the packet.
+ * @return Memory for the packet.
+ */
+void *CargoPacket::operator new(size_t size)
+{
+	if (_current_journal == NULL) return CargoPacketPool::PoolItem<&_cargopacket_pool>::operator new(size);
+
+	CargoPacket *cp = (CargoPacket *)MallocT<byte>(size);
+	_current_journal->Record(cp, true);
+	return cp;
+}
+
+/**
+ * Free a packet. If a journal is recording in this thread the packet's slot
+ * in the pool and its memory are only freed when the journal is replayed.
+ * @param p Packet to be freed.
+ */
+void CargoPacket::operator delete(void *p)
+{
+	if (_current_journal == NULL) {
+		CargoPacketPool::PoolItem<&_cargopacket_pool>::operator delete(p);
+	} else {
+		_current_journal->Record((CargoPacket *)p, false);
+	}
+}
+
 /**
  * Split this packet in two and return the split off part.
  * @param new_size Size of the split part.
  * @return Split off part, or NULL if no packet could be allocated!
+ * @note While a journal is recording the caller has to make sure there is
+ *       space in the pool, as the threads can't check it.
  */
 CargoPacket *CargoPacket::Split(uint new_size)
 {
-	if (!CargoPacket::CanAllocateItem()) return NULL;
+	if (_current_journal == NULL && !CargoPacket::CanAllocateItem()) return NULL;
 
 	Money fs = this->FeederShare(new_size);
 	CargoPacket *cp_new = new CargoPacket(new_size, this->days_in_transit, this->source, this->source_xy, this->loaded_at_xy, fs, this->source_type, this->source_id);
@@ -98,12 +230,16 @@ CargoPacket *CargoPacket::Split(uint new_size)
 }
 
 /**
- * Merge another packet into this one.
+ * Merge another packet into this one. The days in transit are averaged,
+ * weighted by the amounts of cargo, as packets merged when compacting a
+ * cargo list may differ in them.
  * @param cp Packet to be merged in.
  */
 void CargoPacket::Merge(CargoPacket *cp)
 {
-	this->count += cp->count;
+	uint count = this->count + cp->count;
+	this->days_in_transit = (this->days_in_transit * this->count + cp->days_in_transit * cp->count + count / 2) / count;
+	this->count = count;
 	this->feeder_share += cp->feeder_share;
 	delete cp;
 }
@@ -130,6 +266,7 @@ void CargoPacket::Reduce(uint count)
 	FOR_ALL_CARGOPACKETS(cp) {
 		if (cp->source_type == src_type && cp->source_id == src) cp->source_id = INVALID_SOURCE;
 	}
+	StationCargoList::InvalidateAllFrom(src_type, src);
 }
 
 /**
@@ -142,6 +279,43 @@ void CargoPacket::Reduce(uint count)
 	FOR_ALL_CARGOPACKETS(cp) {
 		if (cp->source == sid) cp->source = INVALID_STATION;
 	}
+	StationCargoList::InvalidateAllFrom(sid);
+}
+
+/**
+ * Start recording the packets allocated and freed in this thread.
+ */
+void CargoPacketJournal::Start()
+{
+	assert(_current_journal == NULL);
+	_current_journal = this;
+}
+
+/**
+ * Stop recording the packets allocated and freed in this thread.
+ */
+void CargoPacketJournal::Stop()
+{
+	assert(_current_journal == this);
+	_current_journal = NULL;
+}
+
+/**
+ * Allocate and free the recorded packets in the pool in the order it
+ * happened and forget them. Packets which have been freed already while
+ * recording still take a slot in the pool until their turn.
+ */
+void CargoPacketJournal::Replay()
+{
+	assert(_current_journal == NULL);
+	for (std::vector<Entry>::iterator it = this->entries.begin(); it != this->entries.end(); ++it) {
+		if (it->allocated) {
+			CargoPacket::InsertItem(it->cp);
+		} else {
+			CargoPacketPool::PoolItem<&_cargopacket_pool>::operator delete(it->cp);
+		}
+	}
+	this->entries.clear();
 }
 
 /*
@@ -234,6 +408,23 @@ template <class Tinst, class Tcont>
  *
  */
 
+/**
+ * Grow the packet list, moving the packets to the heap if necessary.
+ * @param min_capacity Number of packets the list has to hold at least.
+ */
+void CargoPacketList::Grow(uint min_capacity)
+{
+	uint new_capacity = max(min_capacity, this->capacity * 2);
+	if (this->capacity > INLINE_CAPACITY) {
+		this->heap = ReallocT(this->heap, new_capacity);
+	} else {
+		CargoPacket **heap = MallocT<CargoPacket *>(new_capacity);
+		MemCpyT(heap, this->buffer, this->length);
+		this->heap = heap;
+	}
+	this->capacity = new_capacity;
+}
+
 /**
  * Appends the given cargo packet. Tries to merge it with another one in the
  * packets list. If no fitting packet is found, appends it. You can only append
@@ -254,6 +445,7 @@ void VehicleCargoList::Append(CargoPacket *cp, MoveToAction action)
 	assert(cp != NULL);
 	assert(action == MTA_LOAD ||
 			(action == MTA_KEEP && this->action_counts[MTA_LOAD] == 0));
+	this->ApplyAge();
 	this->AddToMeta(cp, action);
 
 	if (this->count == cp->count) {
@@ -286,15 +478,17 @@ void VehicleCargoList::Append(CargoPacket *cp, MoveToAction action)
 template<class Taction>
 void VehicleCargoList::ShiftCargo(Taction action)
 {
-	Iterator it(this->packets.begin());
+	Iterator begin(this->packets.begin());
+	Iterator it(begin);
 	while (it != this->packets.end() && action.MaxMove() > 0) {
 		CargoPacket *cp = *it;
 		if (action(cp)) {
-			it = this->packets.erase(it);
+			++it;
 		} else {
 			break;
 		}
 	}
+	this->packets.erase(begin, it);
 }
 
 /**
@@ -308,22 +502,17 @@ void VehicleCargoList::ShiftCargo(Taction action)
 template<class Taction>
 void VehicleCargoList::PopCargo(Taction action)
 {
-	if (this->packets.empty()) return;
-	Iterator it(--(this->packets.end()));
 	Iterator begin(this->packets.begin());
-	while (action.MaxMove() > 0) {
-		CargoPacket *cp = *it;
+	Iterator it(this->packets.end());
+	while (it != begin && action.MaxMove() > 0) {
+		CargoPacket *cp = *(it - 1);
 		if (action(cp)) {
-			if (it != begin) {
-				this->packets.erase(it--);
-			} else {
-				this->packets.erase(it);
-				break;
-			}
+			--it;
 		} else {
 			break;
 		}
 	}
+	this->packets.erase(it, this->packets.end());
 }
 
 /**
@@ -377,18 +566,44 @@ void VehicleCargoList::AddToMeta(const CargoPacket *cp, MoveToAction action)
 }
 
 /**
- * Ages the all cargo in this list.
+ * Ages the all cargo in this list. The packets are only updated when they're
+ * touched the next time, usually when the vehicle arrives at a station.
  */
 void VehicleCargoList::AgeCargo()
+{
+	/* If we're at the maximum, then none of the packets can age any more. */
+	if (this->pending_age != 0xFF) this->pending_age++;
+}
+
+/**
+ * Adds the pending age to all packets in this list. The packets' ages are
+ * capped at 255, just as if they had been aged one by one.
+ */
+void VehicleCargoList::AgePackets()
 {
 	for (ConstIterator it(this->packets.begin()); it != this->packets.end(); it++) {
 		CargoPacket *cp = *it;
-		/* If we're at the maximum, then we can't increase no more. */
-		if (cp->days_in_transit == 0xFF) continue;
+		uint days_in_transit = min<uint>(cp->days_in_transit + this->pending_age, 0xFF);
+		this->cargo_days_in_transit += (days_in_transit - cp->days_in_transit) * cp->count;
+		cp->days_in_transit = days_in_transit;
+	}
+	this->pending_age = 0;
+}
 
-		cp->days_in_transit++;
-		this->cargo_days_in_transit += cp->count;
+/**
+ * Calculates the average number of days in transit for a cargo entity
+ * including the pending age, without updating the packets.
+ * @return Average number of days in transit.
+ */
+uint VehicleCargoList::PendingDaysInTransit() const
+{
+	if (this->count == 0) return 0;
+	uint days_in_transit = 0;
+	for (ConstIterator it(this->packets.begin()); it != this->packets.end(); it++) {
+		const CargoPacket *cp = *it;
+		days_in_transit += min<uint>(cp->days_in_transit + this->pending_age, 0xFF) * cp->count;
 	}
+	return days_in_transit / this->count;
 }
 
 /**
@@ -425,19 +640,22 @@ bool VehicleCargoList::Stage(bool accepted, StationID current_station, StationID
 {
 	this->AssertCountConsistency();
 	assert(this->action_counts[MTA_LOAD] == 0);
+	this->ApplyAge();
 	this->action_counts[MTA_TRANSFER] = this->action_counts[MTA_DELIVER] = this->action_counts[MTA_KEEP] = 0;
-	Iterator deliver = this->packets.end();
-	Iterator it = this->packets.begin();
-	uint sum = 0;
+
+	/* Kept packets are moved to the front of the list in place, the others are collected separately. */
+	CargoPacketList transfer;
+	CargoPacketList deliver;
+	Iterator packets = this->packets.begin();
+	uint num_packets = this->packets.size();
+	uint keep = 0;
 
 	bool force_keep = (order_flags & OUFB_NO_UNLOAD) != 0;
 	bool force_unload = (order_flags & OUFB_UNLOAD) != 0;
 	bool force_transfer = (order_flags & (OUFB_TRANSFER | OUFB_UNLOAD)) != 0;
-	assert(this->count > 0 || it == this->packets.end());
-	while (sum < this->count) {
-		CargoPacket *cp = *it;
+	for (uint i = 0; i < num_packets; ++i) {
+		CargoPacket *cp = packets[i];
 
-		this->packets.erase(it++);
 		StationID cargo_next = INVALID_STATION;
 		MoveToAction action = MTA_LOAD;
 		if (force_keep) {
@@ -463,14 +681,13 @@ bool VehicleCargoList::Stage(bool accepted, StationID current_station, StationID
 		}
 		switch (action) {
 			case MTA_KEEP:
-				this->packets.push_back(cp);
-				if (deliver == this->packets.end()) --deliver;
+				packets[keep++] = cp;
 				break;
 			case MTA_DELIVER:
-				this->packets.insert(deliver, cp);
+				deliver.push_back(cp);
 				break;
 			case MTA_TRANSFER:
-				this->packets.push_front(cp);
+				transfer.push_back(cp);
 				cp->feeder_share += payment->PayTransfer(cp, cp->count);
 				cp->next_station = cargo_next;
 				break;
@@ -478,8 +695,14 @@ bool VehicleCargoList::Stage(bool accepted, StationID current_station, StationID
 				NOT_REACHED();
 		}
 		this->action_counts[action] += cp->count;
-		sum += cp->count;
 	}
+
+	/* Packets to be transferred come first, the last staged one in front,
+	 * then the ones to be delivered and finally the ones to be kept. */
+	MemMoveT(packets + num_packets - keep, packets, keep);
+	std::reverse_copy(transfer.begin(), transfer.end(), packets);
+	std::copy(deliver.begin(), deliver.end(), packets + transfer.size());
+
 	this->AssertCountConsistency();
 	return this->action_counts[MTA_DELIVER] > 0 || this->action_counts[MTA_TRANSFER] > 0;
 }
@@ -517,6 +740,7 @@ uint VehicleCargoList::Reassign(uint max_move, MoveToAction from, MoveToAction t
 uint VehicleCargoList::Return(uint max_move, StationCargoList *dest, StationID next)
 {
 	max_move = min(this->action_counts[MTA_LOAD], max_move);
+	this->ApplyAge();
 	this->PopCargo(CargoReturn(this, dest, max_move, next));
 	return max_move;
 }
@@ -530,6 +754,7 @@ uint VehicleCargoList::Return(uint max_move, StationCargoList *dest, StationID n
 uint VehicleCargoList::Shift(uint max_move, VehicleCargoList *dest)
 {
 	max_move = min(this->count, max_move);
+	this->ApplyAge();
 	this->PopCargo(CargoShift(this, dest, max_move));
 	return max_move;
 }
@@ -544,6 +769,7 @@ uint VehicleCargoList::Shift(uint max_move, VehicleCargoList *dest)
  */
 uint VehicleCargoList::Unload(uint max_move, StationCargoList *dest, CargoPayment *payment)
 {
+	this->ApplyAge();
 	uint moved = 0;
 	if (this->action_counts[MTA_TRANSFER] > 0) {
 		uint move = min(this->action_counts[MTA_TRANSFER], max_move);
@@ -567,16 +793,113 @@ uint VehicleCargoList::Unload(uint max_move, StationCargoList *dest, CargoPaymen
 uint VehicleCargoList::Truncate(uint max_move)
 {
 	max_move = min(this->count, max_move);
+	this->ApplyAge();
 	this->PopCargo(CargoRemoval<VehicleCargoList>(this, max_move));
 	return max_move;
 }
 
+/**
+ * Merge packets of the same kind whose days in transit fall into the same
+ * window. Later packets are merged into earlier ones. This is only done while
+ * all cargo is kept in the vehicle, as the other actions rely on the order
+ * of the packets.
+ * @param window Size of the window for the days in transit.
+ */
+void VehicleCargoList::Compact(uint window)
+{
+	if (this->packets.size() < 2 || this->action_counts[MTA_KEEP] != this->count) return;
+	this->ApplyAge();
+
+	CompactionMap targets;
+	Iterator out = this->packets.begin();
+	for (Iterator it(this->packets.begin()); it != this->packets.end(); ++it) {
+		CargoPacket *cp = *it;
+		if (CompactPacket(targets, CompactionKey(cp->loaded_at_xy, cp, window), cp)) continue;
+		*out++ = cp;
+	}
+	if (out == this->packets.end()) return;
+
+	this->packets.erase(out, this->packets.end());
+	this->InvalidateCache();
+}
+
 /*
  *
  * Station cargo list implementation.
  *
  */
 
+/**
+ * Update the cached values to reflect the removal of this packet or part of it.
+ * Decreases count, days_in_transit and the amount of cargo from the packet's
+ * source station.
+ * @param cp Packet to be removed from cache.
+ * @param count Amount of cargo from the given packet to be removed.
+ */
+void StationCargoList::RemoveFromCache(const CargoPacket *cp, uint count)
+{
+	this->Parent::RemoveFromCache(cp, count);
+	StationCargoList::Decrease(this->source_counts, cp->source, count);
+}
+
+/**
+ * Update the cache to reflect adding of this packet.
+ * Increases count, days_in_transit and the amount of cargo from the packet's
+ * source station.
+ * @param cp New packet to be inserted.
+ */
+void StationCargoList::AddToCache(const CargoPacket *cp)
+{
+	this->Parent::AddToCache(cp);
+	this->source_counts[cp->source] += cp->count;
+}
+
+/**
+ * Decrease a cached amount of cargo, dropping the entry if no cargo is left.
+ * Like this the keys of the caches only depend on the packets in the list.
+ * @param counts Cache to be updated.
+ * @param key Entry to be decreased.
+ * @param amount Amount of cargo to be subtracted.
+ */
+/* static */ void StationCargoList::Decrease(StationCargoAmountMap &counts, StationID key, uint amount)
+{
+	if (amount == 0) return;
+	StationCargoAmountMap::iterator it = counts.find(key);
+	assert(it != counts.end() && it->second >= amount);
+	if (it->second == amount) {
+		counts.erase(it);
+	} else {
+		it->second -= amount;
+	}
+}
+
+/**
+ * Adds a packet to the end of the packets with the given next hop without
+ * merging it. The amount of cargo per next hop and the merge index are
+ * updated, the other caches aren't.
+ * @param cp Packet to be added.
+ * @param next Next hop of the packet.
+ */
+void StationCargoList::PushBack(CargoPacket *cp, StationID next)
+{
+	this->packets.Insert(next, cp);
+	this->next_counts[next] += cp->count;
+	this->merge_index[MergeKey(next, cp)] = cp;
+}
+
+/**
+ * Update the merge index to reflect the removal of a packet from the front of
+ * the packets with some next hop.
+ * @param key Merge key of the packet.
+ * @param cp Removed packet. It may have been deleted already.
+ */
+void StationCargoList::RemoveFromIndex(const MergeKey &key, const CargoPacket *cp)
+{
+	MergeIndex::iterator it = this->merge_index.find(key);
+	assert(it != this->merge_index.end());
+	if (it->second == cp) this->merge_index.erase(it);
+}
+
 /**
  * Appends the given cargo packet to the range of packets with the same next station
  * @warning After appending this packet may not exist anymore!
@@ -588,16 +911,25 @@ uint VehicleCargoList::Truncate(uint max_move)
 void StationCargoList::Append(CargoPacket *cp, StationID next)
 {
 	assert(cp != NULL);
-	this->AddToCache(cp);
+	this->Parent::AddToCache(cp);
 
-	StationCargoPacketMap::List &list = this->packets[next];
-	for (StationCargoPacketMap::List::reverse_iterator it(list.rbegin());
-			it != list.rend(); it++) {
-		if (StationCargoList::TryMerge(*it, cp)) return;
+	/* Only the last packet of the same kind can be merged with; the ones
+	 * before it are full. Merging ignores the source station, so the cargo
+	 * is counted for the one of the packet it's merged into. */
+	uint count = cp->count;
+	MergeIndex::iterator it = this->merge_index.find(MergeKey(next, cp));
+	if (it != this->merge_index.end()) {
+		CargoPacket *icp = it->second;
+		if (StationCargoList::TryMerge(icp, cp)) {
+			this->source_counts[icp->source] += count;
+			this->next_counts[next] += count;
+			return;
+		}
 	}
 
 	/* The packet could not be merged with another one */
-	list.push_back(cp);
+	this->source_counts[cp->source] += count;
+	this->PushBack(cp, next);
 }
 
 /**
@@ -619,9 +951,15 @@ bool StationCargoList::ShiftCargo(Taction &action, StationID next)
 	for (Iterator it(range.first); it != range.second && it.GetKey() == next;) {
 		if (action.MaxMove() == 0) return false;
 		CargoPacket *cp = *it;
+		/* The action may delete the packet, so remember what it looked like. */
+		uint count = cp->count;
+		MergeKey key(next, cp);
 		if (action(cp)) {
+			this->RemoveFromIndex(key, cp);
+			StationCargoList::Decrease(this->next_counts, next, count);
 			it = this->packets.erase(it);
 		} else {
+			StationCargoList::Decrease(this->next_counts, next, count - cp->count);
 			return false;
 		}
 	}
@@ -653,9 +991,12 @@ uint StationCargoList::ShiftCargo(Taction action, StationID next, bool include_i
 }
 
 /**
- * Truncates where each destination loses roughly the same percentage of its
- * cargo. This is done by randomizing the selection of packets to be removed.
- * Optionally count the cargo by origin station.
+ * Truncates where each destination loses the same percentage of its cargo.
+ * The share of each destination is rounded down and the rest is removed from
+ * destinations selected round robin, starting at a random one. The oldest
+ * cargo of each destination is removed first, so that the time spent is
+ * proportional to the number of packets removed.
+ * Optionally count the remaining cargo by origin station.
  * @param max_move Maximum amount of cargo to remove.
  * @param cargo_per_source Container for counting the cargo by origin.
  * @return Amount of cargo actually moved.
@@ -663,47 +1004,37 @@ uint StationCargoList::ShiftCargo(Taction action, StationID next, bool include_i
 uint StationCargoList::Truncate(uint max_move, StationCargoAmountMap *cargo_per_source)
 {
 	max_move = min(max_move, this->count);
-	uint prev_count = this->count;
-	uint moved = 0;
-	uint loop = 0;
-	bool do_count = cargo_per_source != NULL;
-	while (max_move > moved) {
-		for (Iterator it(this->packets.begin()); it != this->packets.end();) {
-			CargoPacket *cp = *it;
-			if (prev_count > max_move && RandomRange(prev_count) < prev_count - max_move) {
-				if (do_count && loop == 0) {
-					(*cargo_per_source)[cp->source] += cp->count;
-				}
-				++it;
-				continue;
-			}
-			uint diff = max_move - moved;
-			if (cp->count > diff) {
-				if (diff > 0) {
-					this->RemoveFromCache(cp, diff);
-					cp->Reduce(diff);
-					moved += diff;
-				}
-				if (loop > 0) {
-					if (do_count) (*cargo_per_source)[cp->source] -= diff;
-					return moved;
-				} else {
-					if (do_count) (*cargo_per_source)[cp->source] += cp->count;
-					++it;
-				}
-			} else {
-				it = this->packets.erase(it);
-				if (do_count && loop > 0) {
-					(*cargo_per_source)[cp->source] -= cp->count;
-				}
-				moved += cp->count;
-				this->RemoveFromCache(cp, cp->count);
-				delete cp;
+	if (max_move > 0) {
+		uint prev_count = this->count;
+		uint rest = max_move;
+
+		/* Copy the amounts as the cache is changed while removing cargo. */
+		std::vector<std::pair<StationID, uint> > removals;
+		removals.reserve(this->next_counts.size());
+		for (StationCargoAmountMap::const_iterator it(this->next_counts.begin()); it != this->next_counts.end(); ++it) {
+			uint remove = (uint)((uint64)it->second * max_move / prev_count);
+			removals.push_back(std::make_pair(it->first, remove));
+			rest -= remove;
+		}
+
+		/* Less than one unit per destination is left over after rounding down,
+		 * and the destinations have enough cargo for it. */
+		for (uint i = rest > 0 ? RandomRange((uint)removals.size()) : 0; rest > 0; i = (i + 1) % removals.size()) {
+			if (removals[i].second < this->next_counts[removals[i].first]) {
+				removals[i].second++;
+				rest--;
 			}
 		}
-		loop++;
+
+		for (uint i = 0; i < removals.size(); ++i) {
+			if (removals[i].second == 0) continue;
+			this->ShiftCargo(CargoRemoval<StationCargoList>(this, removals[i].second), removals[i].first, false);
+		}
+		assert(this->count == prev_count - max_move);
 	}
-	return moved;
+
+	if (cargo_per_source != NULL) *cargo_per_source = this->source_counts;
+	return max_move;
 }
 
 /**
@@ -753,6 +1084,127 @@ uint StationCargoList::Reroute(uint max_move, StationCargoList *dest, StationID
 	return this->ShiftCargo(CargoReroute(this, dest, max_move, avoid, avoid2, ge), avoid, false);
 }
 
+/**
+ * Empty the cargo list and its caches, but don't free the cargo packets;
+ * the cargo packets are cleaned by CargoPacket's CleanPool.
+ */
+void StationCargoList::OnCleanPool()
+{
+	this->Parent::OnCleanPool();
+	this->next_counts.clear();
+	this->source_counts.clear();
+	this->merge_index.clear();
+}
+
+/**
+ * Invalidates the cached data and rebuilds it. The cached amounts are updated
+ * in place, so that nothing changes if they were correct.
+ */
+void StationCargoList::InvalidateCache()
+{
+	for (StationCargoAmountMap::iterator it(this->source_counts.begin()); it != this->source_counts.end(); ++it) {
+		it->second = 0;
+	}
+	for (StationCargoAmountMap::iterator it(this->next_counts.begin()); it != this->next_counts.end(); ++it) {
+		it->second = 0;
+	}
+
+	this->Parent::InvalidateCache();
+
+	for (StationCargoPacketMap::ConstMapIterator it(this->packets.begin()); it != this->packets.end(); ++it) {
+		uint &count = this->next_counts[it->first];
+		for (StationCargoPacketMap::ConstListIterator i(it->second.begin()); i != it->second.end(); ++i) {
+			count += (*i)->count;
+		}
+	}
+}
+
+/**
+ * Rebuild the caches and the merge index from scratch. This is necessary if
+ * the packets have been changed behind the list's back, e.g. when loading a
+ * game or when invalidating the sources of packets.
+ */
+void StationCargoList::RebuildIndex()
+{
+	this->next_counts.clear();
+	this->source_counts.clear();
+	this->merge_index.clear();
+	this->InvalidateCache();
+
+	/* Later packets overwrite earlier ones, leaving the last one of each kind. */
+	for (StationCargoPacketMap::ConstMapIterator it(this->packets.begin()); it != this->packets.end(); ++it) {
+		for (StationCargoPacketMap::ConstListIterator i(it->second.begin()); i != it->second.end(); ++i) {
+			this->merge_index[MergeKey(it->first, *i)] = *i;
+		}
+	}
+}
+
+/**
+ * Merge packets of the same kind for the same next hop whose days in transit
+ * fall into the same window. Later packets are merged into earlier ones.
+ * @param window Size of the window for the days in transit.
+ */
+void StationCargoList::Compact(uint window)
+{
+	if (this->packets.empty()) return;
+
+	CompactionMap targets;
+	bool merged = false;
+	for (StationCargoPacketMap::MapIterator it(this->packets.begin()); it != this->packets.end(); ++it) {
+		StationCargoPacketMap::List &list = it->second;
+		for (StationCargoPacketMap::ListIterator i(list.begin()); i != list.end();) {
+			if (CompactPacket(targets, CompactionKey(it->first, *i, window), *i)) {
+				i = list.erase(i);
+				merged = true;
+			} else {
+				++i;
+			}
+		}
+	}
+
+	/* The days in transit of the remaining packets may have changed. */
+	if (merged) this->RebuildIndex();
+}
+
+/**
+ * Rebuild the merge indices of all station cargo lists which contain packets
+ * from the given source. Their keys change when the source is invalidated.
+ * @param src_type Type of source.
+ * @param src Index of source.
+ */
+/* static */ void StationCargoList::InvalidateAllFrom(SourceType src_type, SourceID src)
+{
+	Station *st;
+	FOR_ALL_STATIONS(st) {
+		for (CargoID c = 0; c < NUM_CARGO; c++) {
+			StationCargoList &list = st->goods[c].cargo;
+			for (MergeIndex::const_iterator it(list.merge_index.begin()); it != list.merge_index.end(); ++it) {
+				if (it->first.source_type == src_type && it->first.source_id == src) {
+					list.RebuildIndex();
+					break;
+				}
+			}
+		}
+	}
+}
+
+/**
+ * Rebuild the caches of all station cargo lists which contain packets from the
+ * given station. The amount of cargo per source station changes when the
+ * station is invalidated.
+ * @param sid Station that gets removed.
+ */
+/* static */ void StationCargoList::InvalidateAllFrom(StationID sid)
+{
+	Station *st;
+	FOR_ALL_STATIONS(st) {
+		for (CargoID c = 0; c < NUM_CARGO; c++) {
+			StationCargoList &list = st->goods[c].cargo;
+			if (list.source_counts.find(sid) != list.source_counts.end()) list.RebuildIndex();
+		}
+	}
+}
+
 /*
  * We have to instantiate everything we want to be usable.
  */
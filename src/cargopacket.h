@@ -18,8 +18,12 @@
 #include "order_type.h"
 #include "cargo_type.h"
 #include "vehicle_type.h"
+#include "date_type.h"
 #include "core/multimap.hpp"
+#include "core/mem_func.hpp"
 #include <list>
+#include <iterator>
+#include <vector>
 
 /** Unique identifier for a single cargo packet. */
 typedef uint32 CargoPacketID;
@@ -63,6 +67,10 @@ public:
 	/** Maximum number of items in a single cargo packet. */
 	static const uint16 MAX_COUNT = UINT16_MAX;
 
+	using CargoPacketPool::PoolItem<&_cargopacket_pool>::operator new;
+	void *operator new(size_t size);
+	void operator delete(void *p);
+
 	CargoPacket();
 	CargoPacket(StationID source, TileIndex source_xy, uint16 count, SourceType source_type, SourceID source_id);
 	CargoPacket(uint16 count, byte days_in_transit, StationID source, TileIndex source_xy, TileIndex loaded_at_xy, Money feeder_share = 0, SourceType source_type = ST_INDUSTRY, SourceID source_id = INVALID_SOURCE);
@@ -119,7 +127,8 @@ public:
 	/**
 	 * Gets the number of days this cargo has been in transit.
 	 * This number isn't really in days, but in 2.5 days (CARGO_AGING_TICKS = 185 ticks) and
-	 * it is capped at 255.
+	 * it is capped at 255. Packets in vehicles may have aged further, see
+	 * VehicleCargoList::ApplyAge().
 	 * @return Length this cargo has been in transit.
 	 */
 	inline byte DaysInTransit() const
@@ -186,6 +195,44 @@ public:
 	static void AfterLoad();
 };
 
+/**
+ * Journal of the packets allocated and freed while a station is loaded and
+ * unloaded in parallel with others. The pool isn't touched then, as the IDs
+ * the packets get would depend on the timing of the threads. Instead new
+ * packets get memory of their own and freed packets keep theirs until the
+ * journal is replayed on the main thread. Replaying the journals in station
+ * order gives the packets the same IDs as handling the stations one after
+ * another.
+ */
+class CargoPacketJournal {
+private:
+	/** A packet which has been allocated or freed. */
+	struct Entry {
+		CargoPacket *cp; ///< The packet.
+		bool allocated;  ///< If the packet has been allocated, otherwise it has been freed.
+	};
+
+	std::vector<Entry> entries; ///< Allocated and freed packets, in the order it happened.
+
+	/**
+	 * Record an allocated or freed packet.
+	 * @param cp The packet.
+	 * @param allocated If the packet has been allocated, otherwise it has been freed.
+	 */
+	inline void Record(CargoPacket *cp, bool allocated)
+	{
+		Entry entry = {cp, allocated};
+		this->entries.push_back(entry);
+	}
+
+	friend struct CargoPacket;
+
+public:
+	void Start();
+	void Stop();
+	void Replay();
+};
+
 /**
  * Iterate over all _valid_ cargo packets from the given start.
  * @param var   Variable used as "iterator".
@@ -199,6 +246,15 @@ public:
  */
 #define FOR_ALL_CARGOPACKETS(var) FOR_ALL_CARGOPACKETS_FROM(var, 0)
 
+/** Numbers of cargo packets before and after the last compaction of all cargo lists. */
+struct CargoCompactionStats {
+	Date date;   ///< Date of the last compaction, 0 if there hasn't been any yet.
+	uint before; ///< Packets in the pool before the compaction.
+	uint after;  ///< Packets in the pool after the compaction.
+};
+
+extern CargoCompactionStats _cargo_compaction_stats;
+
 /**
  * Simple collection class for a list of cargo packets.
  * @tparam Tinst Actual instantiation of this cargo list.
@@ -285,7 +341,150 @@ public:
 	void InvalidateCache();
 };
 
-typedef std::list<CargoPacket *> CargoPacketList;
+/**
+ * Contiguous list of cargo packets, used for vehicles. Up to INLINE_CAPACITY
+ * packets are stored in the list itself, which is enough for most vehicles.
+ * Longer lists are kept in a single block on the heap. Packets are only added
+ * and removed at the ends or rearranged as a whole, which is cheap in an
+ * array and avoids chasing the pointers of a linked list.
+ */
+class CargoPacketList {
+public:
+	typedef CargoPacket **iterator;                                     ///< Iterator over the packets.
+	typedef CargoPacket * const *const_iterator;                        ///< Const iterator over the packets.
+	typedef std::reverse_iterator<iterator> reverse_iterator;             ///< Reverse iterator over the packets.
+	typedef std::reverse_iterator<const_iterator> const_reverse_iterator; ///< Const reverse iterator over the packets.
+
+	/** Number of packets stored without allocating memory. */
+	static const uint INLINE_CAPACITY = 4;
+
+private:
+	uint length;   ///< Number of packets in the list.
+	uint capacity; ///< Number of packets the list can hold without growing.
+	union {
+		CargoPacket *buffer[INLINE_CAPACITY]; ///< Packets if the capacity is INLINE_CAPACITY.
+		CargoPacket **heap;                   ///< Packets if the capacity is larger.
+	};
+
+	void Grow(uint min_capacity);
+
+	CargoPacketList(const CargoPacketList &other);
+	CargoPacketList &operator=(const CargoPacketList &other);
+
+public:
+	/** Create an empty list. */
+	CargoPacketList() : length(0), capacity(INLINE_CAPACITY) {}
+
+	/** Free the memory of the list, but not the packets. */
+	~CargoPacketList()
+	{
+		if (this->capacity > INLINE_CAPACITY) free(this->heap);
+	}
+
+	/**
+	 * Get the first packet in the list.
+	 * @return Iterator to the first packet.
+	 */
+	inline iterator begin() { return this->capacity > INLINE_CAPACITY ? this->heap : this->buffer; }
+
+	/**
+	 * Get the first packet in the list.
+	 * @return Iterator to the first packet.
+	 */
+	inline const_iterator begin() const { return this->capacity > INLINE_CAPACITY ? this->heap : this->buffer; }
+
+	/**
+	 * Get the end of the list.
+	 * @return Iterator behind the last packet.
+	 */
+	inline iterator end() { return this->begin() + this->length; }
+
+	/**
+	 * Get the end of the list.
+	 * @return Iterator behind the last packet.
+	 */
+	inline const_iterator end() const { return this->begin() + this->length; }
+
+	/**
+	 * Get the last packet in the list.
+	 * @return Reverse iterator to the last packet.
+	 */
+	inline reverse_iterator rbegin() { return reverse_iterator(this->end()); }
+
+	/**
+	 * Get the last packet in the list.
+	 * @return Reverse iterator to the last packet.
+	 */
+	inline const_reverse_iterator rbegin() const { return const_reverse_iterator(this->end()); }
+
+	/**
+	 * Get the reverse end of the list.
+	 * @return Reverse iterator before the first packet.
+	 */
+	inline reverse_iterator rend() { return reverse_iterator(this->begin()); }
+
+	/**
+	 * Get the reverse end of the list.
+	 * @return Reverse iterator before the first packet.
+	 */
+	inline const_reverse_iterator rend() const { return const_reverse_iterator(this->begin()); }
+
+	/**
+	 * Get the number of packets in the list.
+	 * @return Number of packets.
+	 */
+	inline uint size() const { return this->length; }
+
+	/**
+	 * Check if the list is empty.
+	 * @return If there are no packets in the list.
+	 */
+	inline bool empty() const { return this->length == 0; }
+
+	/**
+	 * Get the first packet in the list.
+	 * @return First packet.
+	 */
+	inline CargoPacket *front() const { assert(this->length > 0); return *this->begin(); }
+
+	/**
+	 * Remove all packets from the list. The memory is kept.
+	 */
+	inline void clear() { this->length = 0; }
+
+	/**
+	 * Make sure that a number of packets fits into the list without growing.
+	 * @param size Number of packets.
+	 */
+	inline void reserve(uint size)
+	{
+		if (size > this->capacity) this->Grow(size);
+	}
+
+	/**
+	 * Add a packet to the end of the list.
+	 * @param cp Packet to be added.
+	 */
+	inline void push_back(CargoPacket *cp)
+	{
+		if (this->length == this->capacity) this->Grow(this->length + 1);
+		this->begin()[this->length++] = cp;
+	}
+
+	/**
+	 * Remove a range of packets from the list. The packets behind it are moved
+	 * forward.
+	 * @param first First packet to be removed.
+	 * @param last Packet behind the last one to be removed.
+	 * @return Iterator to the packet which followed the removed ones.
+	 */
+	inline iterator erase(iterator first, iterator last)
+	{
+		MemMoveT(first, last, this->end() - last);
+		this->length -= (uint)(last - first);
+		return first;
+	}
+};
 
 /**
  * CargoList that is used for vehicles.
@@ -297,6 +496,7 @@ protected:
 
 	Money feeder_share;                     ///< Cache for the feeder share.
 	uint action_counts[NUM_MOVE_TO_ACTION]; ///< Counts of cargo to be transfered, delivered, kept and loaded.
+	byte pending_age;                       ///< Number of times the cargo has been aged without updating the packets, capped like their ages.
 
 	template<class Taction>
 	void ShiftCargo(Taction action);
@@ -321,6 +521,9 @@ protected:
 	void AddToMeta(const CargoPacket *cp, MoveToAction action);
 	void RemoveFromMeta(const CargoPacket *cp, MoveToAction action, uint count);
 
+	void AgePackets();
+	uint PendingDaysInTransit() const;
+
 public:
 	/** The station cargo list needs to control the unloading. */
 	friend class StationCargoList;
@@ -392,9 +595,30 @@ public:
 		return this->action_counts[MTA_KEEP] + this->action_counts[MTA_LOAD];
 	}
 
+	/**
+	 * Returns average number of days in transit for a cargo entity, including
+	 * the age which hasn't been applied to the packets yet.
+	 * @return The before mentioned number.
+	 */
+	inline uint DaysInTransit() const
+	{
+		return this->pending_age == 0 ? this->Parent::DaysInTransit() : this->PendingDaysInTransit();
+	}
+
+	/**
+	 * Applies the age the cargo has gained since the packets have last been
+	 * updated to the packets. This has to be done before packets are added
+	 * to or removed from the list or their ages are read.
+	 */
+	inline void ApplyAge()
+	{
+		if (this->pending_age != 0) this->AgePackets();
+	}
+
 	void Append(CargoPacket *cp, MoveToAction action = MTA_KEEP);
 
 	void AgeCargo();
+	void Compact(uint window);
 
 	void InvalidateCache();
 
@@ -451,7 +675,54 @@ protected:
 	/** The (direct) parent of this class. */
 	typedef CargoList<StationCargoList, StationCargoPacketMap> Parent;
 
-	uint reserved_count; ///< Amount of cargo being reserved for loading.
+	/**
+	 * Key of the merge index: The next hop and everything packets need to
+	 * share in order to be merged.
+	 */
+	struct MergeKey {
+		StationID next;         ///< Next hop of the packets.
+		TileIndex source_xy;    ///< Origin of the packets.
+		SourceID source_id;     ///< Source of the packets.
+		SourceType source_type; ///< Type of the source.
+		byte days_in_transit;   ///< Days in transit of the packets.
+
+		/**
+		 * Create the key for a packet.
+		 * @param next Next hop of the packet.
+		 * @param cp Packet to create the key for.
+		 */
+		MergeKey(StationID next, const CargoPacket *cp) : next(next), source_xy(cp->SourceStationXY()),
+				source_id(cp->SourceSubsidyID()), source_type(cp->SourceSubsidyType()), days_in_transit(cp->DaysInTransit()) {}
+
+		/**
+		 * Compare two keys.
+		 * @param other Key to compare with.
+		 * @return If this key is smaller than the other one.
+		 */
+		inline bool operator<(const MergeKey &other) const
+		{
+			if (this->next != other.next) return this->next < other.next;
+			if (this->source_xy != other.source_xy) return this->source_xy < other.source_xy;
+			if (this->source_id != other.source_id) return this->source_id < other.source_id;
+			if (this->source_type != other.source_type) return this->source_type < other.source_type;
+			return this->days_in_transit < other.days_in_transit;
+		}
+	};
+
+	/** Index of the last packet with each merge key. */
+	typedef std::map<MergeKey, CargoPacket *> MergeIndex;
+
+	uint reserved_count;                ///< Amount of cargo being reserved for loading.
+	StationCargoAmountMap next_counts;   ///< Cache for the amount of cargo per next hop.
+	StationCargoAmountMap source_counts; ///< Cache for the amount of cargo per source station.
+	MergeIndex merge_index;             ///< Last packet of each kind per next hop; the only candidate for merging.
+
+	void AddToCache(const CargoPacket *cp);
+	void RemoveFromCache(const CargoPacket *cp, uint count);
+	void PushBack(CargoPacket *cp, StationID next);
+	void RemoveFromIndex(const MergeKey &key, const CargoPacket *cp);
+
+	static void Decrease(StationCargoAmountMap &counts, StationID key, uint amount);
 
 public:
 	/** The super class ought to know what it's doing. */
@@ -468,6 +739,7 @@ public:
 	friend class CargoReroute;
 
 	static void InvalidateAllFrom(SourceType src_type, SourceID src);
+	static void InvalidateAllFrom(StationID sid);
 
 	template<class Taction>
 	bool ShiftCargo(Taction &action, StationID next);
@@ -487,6 +759,17 @@ public:
 		return this->packets.find(next) != this->packets.end();
 	}
 
+	/**
+	 * Returns the amount of cargo headed for a specific station.
+	 * @param next Station the cargo is headed for.
+	 * @return Amount of cargo for that station.
+	 */
+	inline uint CountFor(StationID next) const
+	{
+		StationCargoAmountMap::const_iterator it = this->next_counts.find(next);
+		return it == this->next_counts.end() ? 0 : it->second;
+	}
+
 	/**
 	 * Returns source of the first cargo packet in this list.
 	 * @return The before mentioned source.
@@ -524,6 +807,11 @@ public:
 	uint Truncate(uint max_move = UINT_MAX, StationCargoAmountMap *cargo_per_source = NULL);
 	uint Reroute(uint max_move, StationCargoList *dest, StationID avoid, StationID avoid2, const GoodsEntry *ge);
 
+	void OnCleanPool();
+	void InvalidateCache();
+	void RebuildIndex();
+	void Compact(uint window);
+
 	/**
 	 * Are two the two CargoPackets mergeable in the context of
 	 * a list of CargoPackets for a Vehicle?
@@ -304,6 +304,8 @@ enum Commands {
 
 	CMD_OPEN_CLOSE_AIRPORT,           ///< open/close an airport to incoming aircraft
 
+	CMD_POSTPONE_LINKGRAPH_JOB,       ///< postpone joining a link graph job which isn't finished in time
+
 	CMD_END,                          ///< Must ALWAYS be on the end of this list!! (period)
 };
 
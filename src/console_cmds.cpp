@@ -38,6 +38,11 @@
 #include "console_func.h"
 #include "engine_base.h"
 #include "game/game.hpp"
+#include "linkgraph/benchmark.h"
+#include "linkgraph/export.h"
+#include "linkgraph/linkgraphjob.h"
+#include "station_base.h"
+#include "vehicle_base.h"
 #include "table/strings.h"
 
 /* scriptfile handling */
@@ -1851,6 +1856,251 @@ DEF_CONSOLE_CMD(ConListSettings)
 	return true;
 }
 
+DEF_CONSOLE_CMD(ConLinkGraphBenchmark)
+{
+	if (argc == 0) {
+		IConsoleHelp("Time the calculation of link graphs. Usage: 'linkgraph_benchmark [<runs> [<nodes> <neighbours> [<seed>]]]'");
+		IConsoleHelp("Without a number of nodes all link graphs of the current game are calculated, seeded with the current flows if incremental calculation is enabled.");
+		IConsoleHelp("Otherwise a random graph with the given number of nodes, each connected to its nearest neighbours, is calculated for the first cargo.");
+		IConsoleHelp("The calculations run in the main thread with the current link graph settings. Their results are thrown away.");
+		return true;
+	}
+
+	if (argc > 5 || argc == 3) return false;
+
+	uint32 runs = 1;
+	if (argc > 1 && (!GetArgumentInteger(&runs, argv[1]) || runs == 0)) {
+		IConsoleError("Invalid number of runs.");
+		return true;
+	}
+
+	if (argc == 2 || argc == 1) {
+		LinkGraph *lg;
+		FOR_ALL_LINK_GRAPHS(lg) {
+			IConsolePrintF(CC_DEFAULT, "Link graph %u, cargo %u:", lg->index, lg->Cargo());
+			BenchmarkLinkGraph(*lg, runs, true);
+		}
+		return true;
+	}
+
+	uint32 size, degree, seed = 0;
+	if (!GetArgumentInteger(&size, argv[2]) || size < 2 || size > MAX_BENCHMARK_NODES) {
+		IConsolePrintF(CC_ERROR, "Invalid number of nodes. It has to be between 2 and %u.", MAX_BENCHMARK_NODES);
+		return true;
+	}
+	if (!GetArgumentInteger(&degree, argv[3]) || degree == 0) {
+		IConsoleError("Invalid number of neighbours.");
+		return true;
+	}
+	if (argc == 5 && !GetArgumentInteger(&seed, argv[4])) {
+		IConsoleError("Invalid seed.");
+		return true;
+	}
+
+	LinkGraph lg(0);
+	GenerateLinkGraph(lg, size, degree, seed);
+	IConsolePrintF(CC_DEFAULT, "Random link graph, seed %u:", seed);
+	BenchmarkLinkGraph(lg, runs, false);
+	return true;
+}
+
+/**
+ * Print the handler times and counters of a link graph calculation.
+ * @param stats Statistics of the calculation.
+ */
+static void PrintLinkGraphStatistics(const LinkGraphJob::Statistics &stats)
+{
+	for (uint i = 0; i < stats.handlers_run; i++) {
+		IConsolePrintF(CC_DEFAULT, "    %-15s %10.3f ms", LinkGraphSchedule::HandlerName(i), stats.handler_time[i] / 1000.0);
+	}
+	if (stats.handlers_run == 0) return;
+	IConsolePrintF(CC_DEFAULT, "    %u path searches, %u MCF loops, %u cycle elimination rounds, %u paths allocated",
+			stats.dijkstras, stats.mcf_loops, stats.cycle_rounds, stats.paths);
+	if (stats.memory > 0) IConsolePrintF(CC_DEFAULT, "    %u KiB of memory used", (uint)(stats.memory >> 10));
+}
+
+DEF_CONSOLE_CMD(ConLinkGraphStats)
+{
+	if (argc == 0) {
+		IConsoleHelp("Show profiling information about the running and the last joined link graph calculations. Usage: 'linkgraph_stats [<link graph>]'");
+		IConsoleHelp("Calculations which block the game when they are joined make it stutter. They should be made faster or given more time with the setting 'linkgraph.recalc_time'.");
+		IConsoleHelp("Calculations which aren't finished on the server a day before they're due are postponed instead of blocking the game.");
+		return true;
+	}
+
+	if (argc > 2) return false;
+
+	uint32 filter = UINT32_MAX;
+	if (argc == 2 && !GetArgumentInteger(&filter, argv[1])) {
+		IConsoleError("Invalid link graph ID.");
+		return true;
+	}
+
+	uint64 now = ottd_realtime_us();
+	const LinkGraphJob *job;
+	FOR_ALL_LINK_GRAPH_JOBS(job) {
+		if (filter != UINT32_MAX && filter != job->LinkGraphIndex()) continue;
+		YearMonthDay ymd;
+		ConvertDateToYMD(job->JoinDate() + job->JoinDelay(), &ymd);
+		IConsolePrintF(CC_INFO, "Running: link graph %u, cargo %u, %u nodes, %u edges, to be joined on %d-%d-%d",
+				job->LinkGraphIndex(), job->Cargo(), job->Size(), job->Graph().NumEdges(), ymd.year, ymd.month + 1, ymd.day);
+
+		/* The statistics are written by the worker threads while we read them. They might be slightly outdated. */
+		const LinkGraphJob::Statistics &stats = job->Stats();
+		if (stats.start_time == 0) {
+			IConsolePrintF(CC_DEFAULT, "  waiting for a thread since %.3f ms", (now - stats.spawn_time) / 1000.0);
+		} else if (stats.handlers_run < LinkGraphSchedule::NUM_HANDLERS) {
+			IConsolePrintF(CC_DEFAULT, "  running for %.3f ms, in handler '%s'", (now - stats.start_time) / 1000.0,
+					LinkGraphSchedule::HandlerName(stats.handlers_run));
+		} else {
+			IConsolePrintF(CC_DEFAULT, "  finished after %.3f ms", (stats.end_time - stats.start_time) / 1000.0);
+		}
+		PrintLinkGraphStatistics(stats);
+	}
+
+	const LinkGraphSchedule::RecordList &records = LinkGraphSchedule::Instance()->Records();
+	for (LinkGraphSchedule::RecordList::const_iterator i = records.begin(); i != records.end(); ++i) {
+		if (filter != UINT32_MAX && filter != i->link_graph) continue;
+		YearMonthDay ymd;
+		ConvertDateToYMD(i->join_date, &ymd);
+		const LinkGraphJob::Statistics &stats = i->stats;
+		IConsolePrintF(stats.join_time >= 1000 ? CC_WARNING : CC_INFO, "Joined: link graph %u, cargo %u, %u nodes, %u edges, joined on %d-%d-%d",
+				i->link_graph, i->cargo, i->nodes, i->edges, ymd.year, ymd.month + 1, ymd.day);
+		if (i->join_delay > 0) IConsolePrintF(CC_WARNING, "  postponed by %d days as it wasn't finished in time on the server", i->join_delay);
+		IConsolePrintF(CC_DEFAULT, "  waited %.3f ms for a thread, ran %.3f ms, blocked the game %.3f ms when joined, applied in %.3f ms",
+				(stats.start_time - stats.spawn_time) / 1000.0, (stats.end_time - stats.start_time) / 1000.0,
+				stats.join_time / 1000.0, stats.finalise_time / 1000.0);
+		PrintLinkGraphStatistics(stats);
+	}
+	return true;
+}
+
+DEF_CONSOLE_CMD(ConLinkGraphMemory)
+{
+	if (argc == 0) {
+		IConsoleHelp("Show the memory used by link graphs, their calculations and the flows at the stations. Usage: 'linkgraph_memory [<link graph>]'");
+		IConsoleHelp("Edges shared between a link graph and its calculation are split evenly among them. The memory of a calculation is only known when it's finished.");
+		IConsoleHelp("New calculations are deferred if the estimates for the running ones exceed 'linkgraph.memory_budget'.");
+		return true;
+	}
+
+	if (argc > 2) return false;
+
+	uint32 filter = UINT32_MAX;
+	if (argc == 2 && !GetArgumentInteger(&filter, argv[1])) {
+		IConsoleError("Invalid link graph ID.");
+		return true;
+	}
+
+	uint64 graphs_total = 0;
+	uint64 flows_total = 0;
+	const LinkGraph *lg;
+	FOR_ALL_LINK_GRAPHS(lg) {
+		if (filter != UINT32_MAX && filter != lg->index) continue;
+		size_t graph = lg->MemoryUsage();
+		size_t flows = 0;
+		for (NodeID node = 0; node < lg->Size(); ++node) {
+			flows += Station::Get((*lg)[node].Station())->goods[lg->Cargo()].flows.MemoryUsage();
+		}
+		graphs_total += graph;
+		flows_total += flows;
+		IConsolePrintF(CC_DEFAULT, "Link graph %u, cargo %u, %u nodes, %u edges: %u KiB, flows at stations %u KiB",
+				lg->index, lg->Cargo(), lg->Size(), lg->NumEdges(), (uint)(graph >> 10), (uint)(flows >> 10));
+	}
+
+	uint64 jobs_total = 0;
+	uint64 estimates_total = 0;
+	const LinkGraphJob *job;
+	FOR_ALL_LINK_GRAPH_JOBS(job) {
+		if (filter != UINT32_MAX && filter != job->LinkGraphIndex()) continue;
+		size_t graph = job->Graph().MemoryUsage();
+		uint64 estimate = LinkGraphJob::EstimateMemory(job->Graph());
+		estimates_total += estimate;
+		/* The statistics are written by the worker threads while we read them. They might be slightly outdated. */
+		uint64 memory = job->Stats().memory;
+		if (memory > 0) {
+			jobs_total += graph + memory;
+			IConsolePrintF(CC_DEFAULT, "Job for link graph %u: %u KiB, estimated %u KiB, graph copy %u KiB",
+					job->LinkGraphIndex(), (uint)(memory >> 10), (uint)(estimate >> 10), (uint)(graph >> 10));
+		} else {
+			jobs_total += graph;
+			IConsolePrintF(CC_DEFAULT, "Job for link graph %u: still calculating, estimated %u KiB, graph copy %u KiB",
+					job->LinkGraphIndex(), (uint)(estimate >> 10), (uint)(graph >> 10));
+		}
+	}
+
+	IConsolePrintF(CC_INFO, "Total: link graphs %u KiB, calculations %u KiB, flows at stations %u KiB",
+			(uint)(graphs_total >> 10), (uint)(jobs_total >> 10), (uint)(flows_total >> 10));
+	uint budget = _settings_game.linkgraph.memory_budget;
+	if (budget != 0) {
+		IConsolePrintF(CC_INFO, "Estimated for running calculations: %u KiB of " OTTD_PRINTF64 " KiB budget",
+				(uint)(estimates_total >> 10), (uint64)budget << 10);
+	} else {
+		IConsolePrintF(CC_INFO, "Estimated for running calculations: %u KiB, no budget set", (uint)(estimates_total >> 10));
+	}
+	return true;
+}
+
+DEF_CONSOLE_CMD(ConLinkGraphExport)
+{
+	if (argc == 0) {
+		IConsoleHelp("Export link graphs and the flows at their stations to a CSV file in the personal directory. Usage: 'linkgraph_export <file> [<link graph>]'");
+		IConsoleHelp("The data is copied right away and written in the background. A message is shown when the file is complete.");
+		IConsoleHelp("Supplies, capacities, usages and flows are monthly values. The first lines of the file describe the records.");
+		return true;
+	}
+
+	if (argc < 2 || argc > 3) return false;
+
+	uint32 filter = INVALID_LINK_GRAPH;
+	if (argc == 3 && (!GetArgumentInteger(&filter, argv[2]) || !LinkGraph::IsValidID(filter))) {
+		IConsoleError("Invalid link graph ID.");
+		return true;
+	}
+
+	if (IsLinkGraphExportRunning()) {
+		IConsoleError("Another link graph export is still running.");
+		return true;
+	}
+
+	if (!StartLinkGraphExport(argv[1], (LinkGraphID)filter)) {
+		IConsolePrintF(CC_ERROR, "Cannot open '%s' for writing.", argv[1]);
+	}
+	return true;
+}
+
+DEF_CONSOLE_CMD(ConCargoPackets)
+{
+	if (argc == 0) {
+		IConsoleHelp("Show the number of cargo packets at stations and in vehicles and the effect of the last monthly compaction. Usage: 'cargo_packets'");
+		IConsoleHelp("Packets whose days in transit differ by up to 'economy.cargo_merge_tolerance' are merged when compacting.");
+		return true;
+	}
+
+	uint station_packets = 0;
+	const Station *st;
+	FOR_ALL_STATIONS(st) {
+		for (CargoID c = 0; c < NUM_CARGO; c++) station_packets += (uint)st->goods[c].cargo.Packets()->size();
+	}
+
+	uint vehicle_packets = 0;
+	const Vehicle *v;
+	FOR_ALL_VEHICLES(v) vehicle_packets += (uint)v->cargo.Packets()->size();
+
+	IConsolePrintF(CC_DEFAULT, "Cargo packets: %u, %u at stations, %u in vehicles",
+			(uint)CargoPacket::GetNumItems(), station_packets, vehicle_packets);
+
+	if (_cargo_compaction_stats.date == 0) {
+		IConsolePrint(CC_DEFAULT, "The cargo packets haven't been compacted yet.");
+	} else {
+		YearMonthDay ymd;
+		ConvertDateToYMD(_cargo_compaction_stats.date, &ymd);
+		IConsolePrintF(CC_DEFAULT, "Last compaction on %d-%d-%d: %u packets before, %u after",
+				ymd.year, ymd.month + 1, ymd.day, _cargo_compaction_stats.before, _cargo_compaction_stats.after);
+	}
+	return true;
+}
+
 DEF_CONSOLE_CMD(ConGamelogPrint)
 {
 	GamelogPrintConsole();
@@ -1921,6 +2171,11 @@ void IConsoleStdLibRegister()
 	IConsoleCmdRegister("setting_newgame", ConSettingNewgame);
 	IConsoleCmdRegister("list_settings",ConListSettings);
 	IConsoleCmdRegister("gamelog",      ConGamelogPrint);
+	IConsoleCmdRegister("linkgraph_benchmark", ConLinkGraphBenchmark);
+	IConsoleCmdRegister("linkgraph_stats", ConLinkGraphStats);
+	IConsoleCmdRegister("linkgraph_memory", ConLinkGraphMemory);
+	IConsoleCmdRegister("linkgraph_export", ConLinkGraphExport);
+	IConsoleCmdRegister("cargo_packets",    ConCargoPackets);
 	IConsoleCmdRegister("rescan_newgrf", ConRescanNewGRF);
 
 	IConsoleAliasRegister("dir",          "ls");
@@ -166,6 +166,25 @@ DEFINE_POOL_METHOD(void *)::GetNew(size_t size, size_t index)
 	return this->AllocateItem(size, index);
 }
 
+/**
+ * Adds an item allocated outside of the pool at the first free index
+ * @param item item to add
+ * @note error() on failure! (no free item)
+ */
+DEFINE_POOL_METHOD(void)::InsertItem(Titem *item)
+{
+	size_t index = this->FindFirstFree();
+	if (index == NO_FREE_ITEM) {
+		error("%s: no more free items", this->name);
+	}
+
+	this->first_free = index + 1;
+	this->first_unused = max(this->first_unused, index + 1);
+	this->items++;
+	this->data[index] = item;
+	item->index = (uint)index;
+}
+
 /**
  * Deallocates memory used by this index and marks item as free
  * @param index item to deallocate
@@ -197,6 +197,18 @@ struct Pool : PoolBase {
 
 		/** Helper functions so we can use PoolItem::Function() instead of _poolitem_pool.Function() */
 
+		/**
+		 * Adds an item whose memory wasn't allocated by the pool at the first
+		 * free index, as if it had been allocated right now
+		 * @param item item to add
+		 * @note error() on failure! (no free item)
+		 * @pre the memory must have been allocated with MallocT and not be in the pool yet
+		 */
+		static inline void InsertItem(Titem *item)
+		{
+			Tpool->InsertItem(item);
+		}
+
 		/**
 		 * Tests whether we can allocate 'n' items
 		 * @param n number of items we want to allocate
@@ -298,6 +310,7 @@ private:
 
 	void *GetNew(size_t size);
 	void *GetNew(size_t size, size_t index);
+	void InsertItem(Titem *item);
 
 	void FreeItem(size_t index);
 };
@@ -262,6 +262,14 @@ public:
 		return this->items;
 	}
 
+	/**
+	 * Get the number of items the list can hold without reallocating.
+	 */
+	inline uint Capacity() const
+	{
+		return this->capacity;
+	}
+
 	/**
 	 * Get the pointer to the first item (const)
 	 *
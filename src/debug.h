@@ -71,6 +71,13 @@ const char *GetDebugString();
  */
 uint64 ottd_rdtsc();
 
+/**
+ * Get the real time in microseconds (timing of longer running code). Only the
+ * difference between two values is meaningful.
+ * @return The time.
+ */
+uint64 ottd_realtime_us();
+
 /* Used for profiling
  *
  * Usage:
@@ -47,6 +47,8 @@
 #include "game/game.hpp"
 #include "cargomonitor.h"
 #include "goal_base.h"
+#include "thread/helper_threads.h"
+#include <vector>
 
 #include "table/strings.h"
 #include "table/pricebase.h"
@@ -1125,13 +1127,280 @@ static void TriggerIndustryProduction(Industry *i)
 	StartStopIndustryTileAnimation(i, IAT_INDUSTRY_RECEIVED_CARGO);
 }
 
+/**
+ * Effects of loading and unloading at a station which reach beyond the
+ * station and the vehicles loading there. Usually they are applied right
+ * away. If the station is handled in parallel with others they are recorded
+ * instead and applied on the main thread afterwards, in the order they
+ * happened. Then the game state ends up the same as if the stations had been
+ * handled one after another.
+ */
+class LoadUnloadEffects {
+private:
+	/** Type of a recorded effect. */
+	enum Type {
+		LUE_DELIVERY,       ///< Final delivery of cargo.
+		LUE_FINISH_PAYMENT, ///< Payment to be finished, paying the company.
+		LUE_TRIGGER,        ///< NewGRF vehicle trigger.
+		LUE_REFRESH,        ///< Refresh of the link stats along the consist's orders.
+		LUE_FILL_PERCENT,   ///< Update of the loading indicator.
+		LUE_VEHICLE_DIRTY,  ///< Vehicle to be redrawn.
+		LUE_STATION_DIRTY,  ///< Station to be redrawn.
+	};
+
+	/** A recorded effect. Only the members needed for its type are set. */
+	struct Effect {
+		Type type;              ///< Type of the effect.
+		Vehicle *v;             ///< Vehicle the effect is about.
+		CargoPayment *payment;  ///< Payment for deliveries and finished payments.
+		VehicleTrigger trigger; ///< Trigger to be run.
+		CargoID cargo;          ///< Type of the delivered cargo.
+		uint count;             ///< Amount of delivered cargo.
+		TileIndex source_xy;    ///< Origin of the delivered cargo.
+		byte days_in_transit;   ///< Days in transit of the delivered cargo.
+		SourceType source_type; ///< Type of the source of the delivered cargo.
+		SourceID source_id;     ///< Source of the delivered cargo.
+		Money feeder_share;     ///< Feeder share of the delivered cargo.
+	};
+
+	Station *st;                 ///< Station being loaded and unloaded.
+	bool deferred;               ///< If effects are recorded rather than applied.
+	std::vector<Effect> effects; ///< Recorded effects, in the order they happened.
+
+	/**
+	 * Record an effect.
+	 * @param type Type of the effect.
+	 * @param v Vehicle the effect is about.
+	 * @return The new effect, for setting the remaining members.
+	 */
+	inline Effect &Record(Type type, Vehicle *v)
+	{
+		this->effects.resize(this->effects.size() + 1);
+		Effect &effect = this->effects.back();
+		effect.type = type;
+		effect.v = v;
+		return effect;
+	}
+
+	static void DoShowFillPercent(Vehicle *front);
+	static void DoMarkVehicleDirty(Vehicle *front);
+	static void DoMarkStationDirty(Station *st);
+
+public:
+	/**
+	 * Create an empty set of effects.
+	 * @param st Station being loaded and unloaded.
+	 * @param deferred If effects are to be recorded rather than applied.
+	 */
+	LoadUnloadEffects(Station *st, bool deferred) : st(st), deferred(deferred) {}
+
+	/**
+	 * Check if effects are recorded rather than applied.
+	 * @return If effects are deferred.
+	 */
+	inline bool IsDeferred() const { return this->deferred; }
+
+	void Deliver(CargoPayment *payment, const CargoPacket *cp, uint count);
+	void FinishPayment(CargoPayment *payment);
+	void TriggerVehicle(Vehicle *v, VehicleTrigger trigger);
+	void RefreshNextHops(Vehicle *front);
+	void ShowFillPercent(Vehicle *front);
+	void MarkVehicleDirty(Vehicle *front);
+	void MarkStationDirty();
+	void Apply();
+};
+
+/**
+ * Record the final delivery of cargo. Only called for deferred effects, as
+ * payments pay right away if they don't have a recorder.
+ * @param payment Payment to pay the delivery with.
+ * @param cp Packet being delivered.
+ * @param count Amount of cargo being delivered.
+ */
+void LoadUnloadEffects::Deliver(CargoPayment *payment, const CargoPacket *cp, uint count)
+{
+	assert(this->deferred);
+	Effect &effect = this->Record(LUE_DELIVERY, payment->front);
+	effect.payment = payment;
+	effect.cargo = payment->ct;
+	effect.count = count;
+	effect.source_xy = cp->SourceStationXY();
+	effect.days_in_transit = cp->DaysInTransit();
+	effect.source_type = cp->SourceSubsidyType();
+	effect.source_id = cp->SourceSubsidyID();
+	effect.feeder_share = cp->FeederShare(count);
+}
+
+/**
+ * Finish a payment, paying the vehicle's company.
+ * @param payment Payment to be finished. It's deleted.
+ */
+void LoadUnloadEffects::FinishPayment(CargoPayment *payment)
+{
+	if (payment == NULL) return;
+	if (this->deferred) {
+		this->Record(LUE_FINISH_PAYMENT, payment->front).payment = payment;
+	} else {
+		delete payment;
+	}
+}
+
+/**
+ * Run a NewGRF vehicle trigger.
+ * @param v Vehicle to be triggered.
+ * @param trigger Trigger to be run.
+ */
+void LoadUnloadEffects::TriggerVehicle(Vehicle *v, VehicleTrigger trigger)
+{
+	if (this->deferred) {
+		this->Record(LUE_TRIGGER, v).trigger = trigger;
+	} else {
+		::TriggerVehicle(v, trigger);
+	}
+}
+
+/**
+ * Refresh the link stats along the orders of a consist.
+ * @param front Front of the consist.
+ */
+void LoadUnloadEffects::RefreshNextHops(Vehicle *front)
+{
+	if (this->deferred) {
+		this->Record(LUE_REFRESH, front);
+	} else {
+		front->RefreshNextHopsStats();
+	}
+}
+
+/**
+ * Show or update the loading indicator of a consist.
+ * @param front Front of the consist.
+ */
+void LoadUnloadEffects::ShowFillPercent(Vehicle *front)
+{
+	if (this->deferred) {
+		this->Record(LUE_FILL_PERCENT, front);
+	} else {
+		LoadUnloadEffects::DoShowFillPercent(front);
+	}
+}
+
+/**
+ * Redraw a consist and the windows showing it.
+ * @param front Front of the consist.
+ */
+void LoadUnloadEffects::MarkVehicleDirty(Vehicle *front)
+{
+	if (this->deferred) {
+		this->Record(LUE_VEHICLE_DIRTY, front);
+	} else {
+		LoadUnloadEffects::DoMarkVehicleDirty(front);
+	}
+}
+
+/**
+ * Redraw the station and its window.
+ */
+void LoadUnloadEffects::MarkStationDirty()
+{
+	if (this->deferred) {
+		this->Record(LUE_STATION_DIRTY, NULL);
+	} else {
+		LoadUnloadEffects::DoMarkStationDirty(this->st);
+	}
+}
+
+/**
+ * Apply the recorded effects in the order they happened and forget them.
+ */
+void LoadUnloadEffects::Apply()
+{
+	for (std::vector<Effect>::iterator it = this->effects.begin(); it != this->effects.end(); ++it) {
+		switch (it->type) {
+			case LUE_DELIVERY:
+				it->payment->PayFinalDelivery(it->cargo, it->count, it->source_xy, it->days_in_transit, it->source_type, it->source_id, it->feeder_share);
+				break;
+
+			case LUE_FINISH_PAYMENT:
+				delete it->payment;
+				break;
+
+			case LUE_TRIGGER:
+				::TriggerVehicle(it->v, it->trigger);
+				break;
+
+			case LUE_REFRESH:
+				it->v->RefreshNextHopsStats();
+				break;
+
+			case LUE_FILL_PERCENT:
+				LoadUnloadEffects::DoShowFillPercent(it->v);
+				break;
+
+			case LUE_VEHICLE_DIRTY:
+				LoadUnloadEffects::DoMarkVehicleDirty(it->v);
+				break;
+
+			case LUE_STATION_DIRTY:
+				LoadUnloadEffects::DoMarkStationDirty(this->st);
+				break;
+
+			default: NOT_REACHED();
+		}
+	}
+	this->effects.clear();
+}
+
+/**
+ * Calculate the loading indicator fill percent and display
+ * In the Game Menu do not display indicators
+ * If _settings_client.gui.loading_indicators == 2, show indicators (bool can be promoted to int as 0 or 1 - results in 2 > 0,1 )
+ * if _settings_client.gui.loading_indicators == 1, _local_company must be the owner or must be a spectator to show ind., so 1 > 0
+ * if _settings_client.gui.loading_indicators == 0, do not display indicators ... 0 is never greater than anything
+ * @param front Front of the consist.
+ */
+/* static */ void LoadUnloadEffects::DoShowFillPercent(Vehicle *front)
+{
+	if (_game_mode != GM_MENU && (_settings_client.gui.loading_indicators > (uint)(front->owner != _local_company && _local_company != COMPANY_SPECTATOR))) {
+		StringID percent_up_down = STR_NULL;
+		int percent = CalcPercentVehicleFilled(front, &percent_up_down);
+		if (front->fill_percent_te_id == INVALID_TE_ID) {
+			front->fill_percent_te_id = ShowFillingPercent(front->x_pos, front->y_pos, front->z_pos + 20, percent, percent_up_down);
+		} else {
+			UpdateFillingPercent(front->fill_percent_te_id, percent, percent_up_down);
+		}
+	}
+}
+
+/**
+ * Redraw a consist and the windows showing it.
+ * @param front Front of the consist.
+ */
+/* static */ void LoadUnloadEffects::DoMarkVehicleDirty(Vehicle *front)
+{
+	SetWindowDirty(GetWindowClassForVehicleType(front->type), front->owner);
+	SetWindowDirty(WC_VEHICLE_DETAILS, front->index);
+	front->MarkDirty();
+}
+
+/**
+ * Redraw a station and its window.
+ * @param st Station to be redrawn.
+ */
+/* static */ void LoadUnloadEffects::DoMarkStationDirty(Station *st)
+{
+	st->MarkTilesDirty(true);
+	SetWindowDirty(WC_STATION_VIEW, st->index);
+}
+
 /**
  * Makes us a new cargo payment helper.
  * @param front The front of the train
  */
 CargoPayment::CargoPayment(Vehicle *front) :
 	front(front),
-	current_station(front->last_station_visited)
+	current_station(front->last_station_visited),
+	effects(NULL)
 {
 }
 
@@ -1164,22 +1433,43 @@ CargoPayment::~CargoPayment()
 }
 
 /**
- * Handle payment for final delivery of the given cargo packet.
+ * Handle payment for final delivery of the given cargo packet. If the
+ * payment has a recorder for effects the delivery is only recorded.
  * @param cp The cargo packet to pay for.
  * @param count The number of packets to pay for.
  */
 void CargoPayment::PayFinalDelivery(const CargoPacket *cp, uint count)
+{
+	if (this->effects != NULL) {
+		this->effects->Deliver(this, cp, count);
+		return;
+	}
+
+	this->PayFinalDelivery(this->ct, count, cp->SourceStationXY(), cp->DaysInTransit(), cp->SourceSubsidyType(), cp->SourceSubsidyID(), cp->FeederShare(count));
+}
+
+/**
+ * Handle payment for final delivery of cargo.
+ * @param ct Type of the cargo.
+ * @param count Amount of cargo.
+ * @param source_xy Origin of the cargo.
+ * @param days_in_transit Days the cargo has been in transit.
+ * @param src_type Type of the source of the cargo.
+ * @param src Source of the cargo.
+ * @param feeder_share Feeder share of the cargo.
+ */
+void CargoPayment::PayFinalDelivery(CargoID ct, uint count, TileIndex source_xy, byte days_in_transit, SourceType src_type, SourceID src, Money feeder_share)
 {
 	if (this->owner == NULL) {
 		this->owner = Company::Get(this->front->owner);
 	}
 
 	/* Handle end of route payment */
-	Money profit = DeliverGoods(count, this->ct, this->current_station, cp->SourceStationXY(), cp->DaysInTransit(), this->owner, cp->SourceSubsidyType(), cp->SourceSubsidyID());
+	Money profit = DeliverGoods(count, ct, this->current_station, source_xy, days_in_transit, this->owner, src_type, src);
 	this->route_profit += profit;
 
 	/* The vehicle's profit is whatever route profit there is minus feeder shares. */
-	this->visual_profit += profit - cp->FeederShare(count);
+	this->visual_profit += profit - feeder_share;
 }
 
 /**
@@ -1343,13 +1633,13 @@ static bool IsArticulatedVehicleEmpty(Vehicle *v)
 /**
  * Loads/unload the vehicle if possible.
  * @param front the vehicle to be (un)loaded
+ * @param effects Effects beyond the station, to be applied or recorded.
  */
-static void LoadUnloadVehicle(Vehicle *front)
+static void LoadUnloadVehicle(Vehicle *front, LoadUnloadEffects &effects)
 {
 	assert(front->current_order.IsType(OT_LOADING));
 
-	StationID last_visited = front->last_station_visited;
-	Station *st = Station::Get(last_visited);
+	Station *st = Station::Get(front->last_station_visited);
 
 	StationID next_station = front->GetNextStoppingStation();
 	bool use_autorefit = front->current_order.IsRefit() && front->current_order.GetRefitCargo() == CT_AUTO_REFIT;
@@ -1387,6 +1677,7 @@ static void LoadUnloadVehicle(Vehicle *front)
 	front->cur_speed = 0;
 
 	CargoPayment *payment = front->cargo_payment;
+	if (payment != NULL && effects.IsDeferred()) payment->effects = &effects;
 
 	uint artic_part = 0; // Articulated part we are currently trying to load. (not counting parts without capacity)
 	for (Vehicle *v = front; v != NULL; v = v->Next()) {
@@ -1542,7 +1833,7 @@ static void LoadUnloadVehicle(Vehicle *front)
 		uint cap_left = v->cargo_cap - v->cargo.OnboardCount();
 		if (cap_left > 0 && (v->cargo.ActionCount(VehicleCargoList::MTA_LOAD) > 0 || !ge->cargo.Empty())) {
 			if (_settings_game.order.gradual_loading) cap_left = min(cap_left, load_amount);
-			if (v->cargo.OnboardCount() == 0) TriggerVehicle(v, VEHICLE_TRIGGER_NEW_CARGO);
+			if (v->cargo.OnboardCount() == 0) effects.TriggerVehicle(v, VEHICLE_TRIGGER_NEW_CARGO);
 
 			uint loaded = ge->cargo.Load(cap_left, &v->cargo, st->xy, next_station);
 			if (v->cargo.ActionCount(VehicleCargoList::MTA_LOAD) > 0) {
@@ -1601,7 +1892,8 @@ static void LoadUnloadVehicle(Vehicle *front)
 	/* Only set completely_emptied, if we just unloaded all remaining cargo */
 	completely_emptied &= anything_unloaded;
 
-	if (!anything_unloaded) delete payment;
+	if (payment != NULL) payment->effects = NULL;
+	if (!anything_unloaded) effects.FinishPayment(payment);
 
 	ClrBit(front->vehicle_flags, VF_STOP_LOADING);
 	if (anything_loaded || anything_unloaded) {
@@ -1637,7 +1929,7 @@ static void LoadUnloadVehicle(Vehicle *front)
 			 * along them. Otherwise the vehicle could wait for cargo
 			 * indefinitely if it hasn't visited the other links yet, or if the
 			 * links die while it's loading. */
-			if (!finished_loading) front->RefreshNextHopsStats();
+			if (!finished_loading) effects.RefreshNextHops(front);
 		}
 		unloading_time = 20;
 
@@ -1653,21 +1945,8 @@ static void LoadUnloadVehicle(Vehicle *front)
 		}
 	}
 
-	/* Calculate the loading indicator fill percent and display
-	 * In the Game Menu do not display indicators
-	 * If _settings_client.gui.loading_indicators == 2, show indicators (bool can be promoted to int as 0 or 1 - results in 2 > 0,1 )
-	 * if _settings_client.gui.loading_indicators == 1, _local_company must be the owner or must be a spectator to show ind., so 1 > 0
-	 * if _settings_client.gui.loading_indicators == 0, do not display indicators ... 0 is never greater than anything
-	 */
-	if (_game_mode != GM_MENU && (_settings_client.gui.loading_indicators > (uint)(front->owner != _local_company && _local_company != COMPANY_SPECTATOR))) {
-		StringID percent_up_down = STR_NULL;
-		int percent = CalcPercentVehicleFilled(front, &percent_up_down);
-		if (front->fill_percent_te_id == INVALID_TE_ID) {
-			front->fill_percent_te_id = ShowFillingPercent(front->x_pos, front->y_pos, front->z_pos + 20, percent, percent_up_down);
-		} else {
-			UpdateFillingPercent(front->fill_percent_te_id, percent, percent_up_down);
-		}
-	}
+	/* Calculate the loading indicator fill percent and display */
+	effects.ShowFillPercent(front);
 
 	/* Always wait at least 1, otherwise we'll wait 'infinitively' long. */
 	front->load_unload_ticks = max(1, unloading_time);
@@ -1676,35 +1955,25 @@ static void LoadUnloadVehicle(Vehicle *front)
 		/* Make sure the vehicle is marked dirty, since we need to update the NewGRF
 		 * properties such as weight, power and TE whenever the trigger runs. */
 		dirty_vehicle = true;
-		TriggerVehicle(front, VEHICLE_TRIGGER_EMPTY);
+		effects.TriggerVehicle(front, VEHICLE_TRIGGER_EMPTY);
 	}
 
-	if (dirty_vehicle) {
-		SetWindowDirty(GetWindowClassForVehicleType(front->type), front->owner);
-		SetWindowDirty(WC_VEHICLE_DETAILS, front->index);
-		front->MarkDirty();
-	}
-	if (dirty_station) {
-		st->MarkTilesDirty(true);
-		SetWindowDirty(WC_STATION_VIEW, last_visited);
-	}
+	if (dirty_vehicle) effects.MarkVehicleDirty(front);
+	if (dirty_station) effects.MarkStationDirty();
 }
 
 /**
- * Load/unload the vehicles in this station according to the order
- * they entered.
- * @param st the station to do the loading/unloading for
+ * Count down the loading ticks of the vehicles in a station and find the last
+ * vehicle to be loaded or unloaded in this tick.
+ * @param st Station to be checked.
+ * @return Last vehicle to be handled, or NULL if nothing will be loaded at all.
  */
-void LoadUnloadStation(Station *st)
+static Vehicle *CountDownLoadUnloadTicks(Station *st)
 {
-	/* No vehicle is here... */
-	if (st->loading_vehicles.empty()) return;
-
 	Vehicle *last_loading = NULL;
-	std::list<Vehicle *>::iterator iter;
 
 	/* Check if anything will be loaded at all. Otherwise we don't need to reserve either. */
-	for (iter = st->loading_vehicles.begin(); iter != st->loading_vehicles.end(); ++iter) {
+	for (std::list<Vehicle *>::iterator iter = st->loading_vehicles.begin(); iter != st->loading_vehicles.end(); ++iter) {
 		Vehicle *v = *iter;
 
 		if ((v->vehstatus & (VS_STOPPED | VS_CRASHED))) continue;
@@ -1713,6 +1982,48 @@ void LoadUnloadStation(Station *st)
 		if (--v->load_unload_ticks == 0) last_loading = v;
 	}
 
+	return last_loading;
+}
+
+/**
+ * Load/unload the vehicles in a station according to the order they entered,
+ * up to the last one to be handled in this tick.
+ * @param st Station to do the loading/unloading for.
+ * @param last_loading Last vehicle to be handled.
+ * @param effects Effects beyond the station, to be applied or recorded.
+ */
+static void LoadUnloadVehicles(Station *st, Vehicle *last_loading, LoadUnloadEffects &effects)
+{
+	for (std::list<Vehicle *>::iterator iter = st->loading_vehicles.begin(); iter != st->loading_vehicles.end(); ++iter) {
+		Vehicle *v = *iter;
+		if (!(v->vehstatus & (VS_STOPPED | VS_CRASHED))) LoadUnloadVehicle(v, effects);
+		if (v == last_loading) break;
+	}
+}
+
+/**
+ * Call the production machinery of the industries cargo has been delivered
+ * to since the last call.
+ */
+static void TriggerCargoDeliveryDestinations()
+{
+	const Industry * const *isend = _cargo_delivery_destinations.End();
+	for (Industry **iid = _cargo_delivery_destinations.Begin(); iid != isend; iid++) {
+		TriggerIndustryProduction(*iid);
+	}
+	_cargo_delivery_destinations.Clear();
+}
+
+/**
+ * Load/unload the vehicles in this station according to the order
+ * they entered.
+ * @param st the station to do the loading/unloading for
+ */
+void LoadUnloadStation(Station *st)
+{
+	/* No vehicle is here... */
+	if (st->loading_vehicles.empty()) return;
+
 	/* We only need to reserve and load/unload up to the last loading vehicle.
 	 * Anything else will be forgotten anyway after returning from this function.
 	 *
@@ -1720,20 +2031,206 @@ void LoadUnloadStation(Station *st)
 	 * consist in a station which is not allowed to load yet because its
 	 * load_unload_ticks is still not 0.
 	 */
+	Vehicle *last_loading = CountDownLoadUnloadTicks(st);
 	if (last_loading == NULL) return;
 
-	for (iter = st->loading_vehicles.begin(); iter != st->loading_vehicles.end(); ++iter) {
-		Vehicle *v = *iter;
-		if (!(v->vehstatus & (VS_STOPPED | VS_CRASHED))) LoadUnloadVehicle(v);
-		if (v == last_loading) break;
+	LoadUnloadEffects effects(st, false);
+	LoadUnloadVehicles(st, last_loading, effects);
+
+	TriggerCargoDeliveryDestinations();
+}
+
+/**
+ * Count the vehicle parts to be loaded and unloaded at a station in this tick.
+ * @param st Station to be checked.
+ * @param last_loading Last vehicle to be handled in this tick.
+ * @return Number of vehicle parts.
+ */
+static uint CountLoadUnloadParts(const Station *st, const Vehicle *last_loading)
+{
+	uint parts = 0;
+	for (std::list<Vehicle *>::const_iterator iter = st->loading_vehicles.begin(); iter != st->loading_vehicles.end(); ++iter) {
+		const Vehicle *front = *iter;
+		if (!(front->vehstatus & (VS_STOPPED | VS_CRASHED))) {
+			for (const Vehicle *v = front; v != NULL; v = v->Next()) ++parts;
+		}
+		if (front == last_loading) break;
 	}
+	return parts;
+}
 
-	/* Call the production machinery of industries */
-	const Industry * const *isend = _cargo_delivery_destinations.End();
-	for (Industry **iid = _cargo_delivery_destinations.Begin(); iid != isend; iid++) {
-		TriggerIndustryProduction(*iid);
+/**
+ * Check if a station can be loaded and unloaded in parallel with others. That
+ * is only possible if all effects beyond the station and its vehicles can be
+ * recorded. NewGRF triggers and callbacks, commands for refitting, random
+ * numbers and looking at the company's money can't.
+ * @param st Station to be checked.
+ * @param last_loading Last vehicle to be handled in this tick.
+ * @return If the station can be handled in parallel.
+ */
+static bool CanLoadUnloadInParallel(const Station *st, const Vehicle *last_loading)
+{
+	if (st->cached_cargo_triggers != 0 || st->cached_anim_triggers != 0 || st->airport.tile != INVALID_TILE) return false;
+
+	for (std::list<Vehicle *>::const_iterator iter = st->loading_vehicles.begin(); iter != st->loading_vehicles.end(); ++iter) {
+		const Vehicle *front = *iter;
+		if (!(front->vehstatus & (VS_STOPPED | VS_CRASHED))) {
+			if (front->current_order.IsRefit()) return false;
+
+			/* Looking for the next stop may choose randomly or check if the vehicle needs servicing. */
+			const Order *o;
+			FOR_VEHICLE_ORDERS(front, o) {
+				if (!o->IsType(OT_CONDITIONAL)) continue;
+				OrderConditionVariable ocv = o->GetConditionVariable();
+				if (ocv == OCV_LOAD_PERCENTAGE || ocv == OCV_REQUIRES_SERVICE) return false;
+			}
+
+			/* Transfers are paid right away, which may run the cargo's profit callback. */
+			for (const Vehicle *v = front; v != NULL; v = v->Next()) {
+				if (v->GetGRF() != NULL) return false;
+				if (HasBit(CargoSpec::Get(v->cargo_type)->callback_mask, CBM_CARGO_PROFIT_CALC)) return false;
+			}
+		}
+		if (front == last_loading) break;
 	}
-	_cargo_delivery_destinations.Clear();
+	return true;
+}
+
+/** Threads helping the main thread with loading and unloading stations in parallel. */
+static HelperThreads _load_unload_helpers;
+
+/**
+ * Stations loaded and unloaded in one tick. Those which allow it are handled
+ * in parallel, recording their effects beyond the station and the packets
+ * they allocate and free. Then all of them are finished in station order on
+ * the main thread. The result doesn't depend on the number of threads.
+ */
+class LoadUnloadBatch {
+private:
+	/** A station to be loaded and unloaded. */
+	struct Item {
+		Station *st;                ///< Station to be handled.
+		Vehicle *last_loading;      ///< Last vehicle to be handled in the station.
+		LoadUnloadEffects effects;  ///< Effects beyond the station, deferred if the station is handled in parallel.
+		CargoPacketJournal journal; ///< Packets allocated and freed if the station is handled in parallel.
+
+		/**
+		 * Create an item.
+		 * @param st Station to be handled.
+		 * @param last_loading Last vehicle to be handled in the station.
+		 * @param parallel If the station is handled in parallel.
+		 */
+		Item(Station *st, Vehicle *last_loading, bool parallel) :
+			st(st), last_loading(last_loading), effects(st, parallel) {}
+	};
+
+	std::vector<Item> items;    ///< Stations to be handled, in station order.
+	std::vector<uint> parallel; ///< Indices of the items to be handled in parallel.
+
+	/**
+	 * Handle a station in parallel with others.
+	 * This method is tailored to HelperThreads::Run.
+	 * @param b Pointer to the batch.
+	 * @param i Index of the station in the list of stations to be handled in parallel.
+	 */
+	static void Handle(void *b, uint i)
+	{
+		LoadUnloadBatch *batch = (LoadUnloadBatch *)b;
+		Item &item = batch->items[batch->parallel[i]];
+		item.journal.Start();
+		LoadUnloadVehicles(item.st, item.last_loading, item.effects);
+		item.journal.Stop();
+	}
+
+public:
+	void Prepare();
+	void Execute();
+
+	static uint NumThreads();
+};
+
+/**
+ * Get the number of threads to be used for loading and unloading. This is a
+ * local setting and must not influence the results.
+ * @return Configured number of threads or the number of CPU cores if not set.
+ */
+/* static */ uint LoadUnloadBatch::NumThreads()
+{
+	uint num_threads = _settings_client.gui.loading_threads;
+	return num_threads == 0 ? max(1U, GetCPUCoreCount()) : num_threads;
+}
+
+/**
+ * Count down the loading ticks in all stations and decide which stations can
+ * be handled in parallel.
+ */
+void LoadUnloadBatch::Prepare()
+{
+	uint parts = 0;
+	Station *st;
+	FOR_ALL_STATIONS(st) {
+		if (st->loading_vehicles.empty()) continue;
+		Vehicle *last_loading = CountDownLoadUnloadTicks(st);
+		if (last_loading == NULL) continue;
+
+		bool parallel = CanLoadUnloadInParallel(st, last_loading);
+		if (parallel) this->parallel.push_back((uint)this->items.size());
+		parts += CountLoadUnloadParts(st, last_loading);
+		this->items.push_back(Item(st, last_loading, parallel));
+	}
+
+	/* Each vehicle part may split at most one packet for reserving, one for
+	 * loading and two for unloading. Packets split in parallel only get their
+	 * slots in the pool afterwards, so there has to be space for all of them.
+	 * Otherwise the stations are handled serially, where splitting just fails. */
+	if (!this->parallel.empty() && !CargoPacket::CanAllocateItem(parts * 4)) {
+		for (std::vector<Item>::iterator it = this->items.begin(); it != this->items.end(); ++it) {
+			it->effects = LoadUnloadEffects(it->st, false);
+		}
+		this->parallel.clear();
+	}
+}
+
+/**
+ * Handle the stations which allow it in parallel and then finish all of them
+ * in station order. Stations which can't be handled in parallel are handled
+ * completely at that point.
+ */
+void LoadUnloadBatch::Execute()
+{
+	if (!this->parallel.empty()) {
+		/* Stop the helpers if there are too many after changing the setting. */
+		uint num_helpers = LoadUnloadBatch::NumThreads() - 1;
+		if (_load_unload_helpers.Count() > num_helpers) _load_unload_helpers.Start(num_helpers);
+
+		num_helpers = min(num_helpers, (uint)this->parallel.size() - 1);
+		if (_load_unload_helpers.Count() < num_helpers) _load_unload_helpers.Start(num_helpers);
+		_load_unload_helpers.Run(&LoadUnloadBatch::Handle, this, (uint)this->parallel.size(), num_helpers);
+	}
+
+	for (std::vector<Item>::iterator it = this->items.begin(); it != this->items.end(); ++it) {
+		if (!it->effects.IsDeferred()) LoadUnloadVehicles(it->st, it->last_loading, it->effects);
+		it->journal.Replay();
+		it->effects.Apply();
+		TriggerCargoDeliveryDestinations();
+	}
+}
+
+/**
+ * Load/unload the vehicles in all stations. If enabled, stations are handled
+ * in parallel where possible.
+ */
+void LoadUnloadStations()
+{
+	if (!_settings_game.order.parallel_loading) {
+		Station *st;
+		FOR_ALL_STATIONS(st) LoadUnloadStation(st);
+		return;
+	}
+
+	LoadUnloadBatch batch;
+	batch.Prepare();
+	batch.Execute();
 }
 
 /**
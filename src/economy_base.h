@@ -20,6 +20,8 @@ typedef Pool<CargoPayment, CargoPaymentID, 512, 0xFF000> CargoPaymentPool;
 /** The actual pool to store cargo payments in. */
 extern CargoPaymentPool _cargo_payment_pool;
 
+class LoadUnloadEffects;
+
 /**
  * Helper class to perform the cargo payment.
  */
@@ -30,9 +32,10 @@ struct CargoPayment : CargoPaymentPool::PoolItem<&_cargo_payment_pool> {
 	Money visual_transfer; ///< The transfer credits to be shown
 
 	/* Unsaved variables */
-	Company *owner;            ///< The owner of the vehicle
-	StationID current_station; ///< The current station
-	CargoID ct;                ///< The currently handled cargo type
+	Company *owner;             ///< The owner of the vehicle
+	StationID current_station;  ///< The current station
+	CargoID ct;                 ///< The currently handled cargo type
+	LoadUnloadEffects *effects; ///< Recorder for final deliveries while loading in parallel, NULL otherwise
 
 	/** Constructor for pool saveload */
 	CargoPayment() {}
@@ -41,6 +44,7 @@ struct CargoPayment : CargoPaymentPool::PoolItem<&_cargo_payment_pool> {
 
 	Money PayTransfer(const CargoPacket *cp, uint count);
 	void PayFinalDelivery(const CargoPacket *cp, uint count);
+	void PayFinalDelivery(CargoID ct, uint count, TileIndex source_xy, byte days_in_transit, SourceType src_type, SourceID src, Money feeder_share);
 
 	/**
 	 * Sets the currently handled cargo type.
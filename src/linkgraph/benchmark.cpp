@@ -0,0 +1,91 @@
+/* $Id$ */
+
+/*
+ * This file is part of OpenTTD.
+ * OpenTTD is free software; you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 2.
+ * OpenTTD is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details. You should have received a copy of the GNU General Public License along with OpenTTD. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file benchmark.cpp Definition of the benchmark for link graph calculations. */
+
+#include "../stdafx.h"
+#include "../console_func.h"
+#include "../core/random_func.hpp"
+#include "../map_func.h"
+#include "linkgraphjob_base.h"
+#include "benchmark.h"
+#include <algorithm>
+
+/**
+ * Generate a random link graph resembling a network of stations. The nodes
+ * are scattered over the map and each of them is connected with its nearest
+ * neighbours in both directions. The nodes get station IDs from 0 upwards,
+ * which don't have anything to do with the actual stations.
+ * @param lg Empty link graph to be filled.
+ * @param size Number of nodes.
+ * @param degree Number of nearest neighbours each node is connected to.
+ * @param seed Seed for the random numbers. The game's random generators are
+ *             left alone.
+ */
+void GenerateLinkGraph(LinkGraph &lg, uint size, uint degree, uint32 seed)
+{
+	assert(lg.Size() == 0 && size <= MAX_BENCHMARK_NODES);
+	Randomizer random;
+	random.SetSeed(seed);
+
+	for (uint i = 0; i < size; ++i) {
+		TileIndex xy = TileXY(random.Next(MapSizeX()), random.Next(MapSizeY()));
+		/* Most stations accept the cargo, some don't. */
+		NodeID node = lg.AddNode(xy, (StationID)i, random.Next(4) != 0 ? 1 : 0);
+		lg[node].UpdateSupply(random.Next(1000));
+	}
+
+	std::vector<std::pair<uint, NodeID> > neighbours;
+	uint num_neighbours = min(degree, size - 1);
+	for (NodeID from = 0; from < size; ++from) {
+		neighbours.clear();
+		for (NodeID to = 0; to < size; ++to) {
+			if (to == from) continue;
+			neighbours.push_back(std::make_pair(DistanceManhattan(lg[from].XY(), lg[to].XY()), to));
+		}
+		std::partial_sort(neighbours.begin(), neighbours.begin() + num_neighbours, neighbours.end());
+		for (uint i = 0; i < num_neighbours; ++i) {
+			NodeID to = neighbours[i].second;
+			uint capacity = 100 + random.Next(1000);
+			if (!lg[from].HasEdgeTo(to)) lg[from].AddEdge(to, capacity);
+			if (!lg[to].HasEdgeTo(from)) lg[to].AddEdge(from, capacity);
+		}
+	}
+}
+
+/**
+ * Calculate copies of a link graph in the calling thread and print the average
+ * time spent in each handler and the amount of work done to the console. The
+ * results of the calculations are thrown away.
+ * @param lg Link graph to be calculated.
+ * @param runs Number of calculations.
+ * @param seeded If incremental calculations may be seeded with the current
+ *               flows of the stations.
+ */
+void BenchmarkLinkGraph(const LinkGraph &lg, uint runs, bool seeded)
+{
+	assert(runs > 0);
+	LinkGraphJob::Statistics total;
+	uint64 total_time = 0;
+	for (uint run = 0; run < runs; ++run) {
+		LinkGraphJob job(lg);
+		if (!seeded) job.PreviousFlows().clear();
+		LinkGraphSchedule::Run(&job);
+		total.Add(job.Stats());
+	}
+
+	IConsolePrintF(CC_DEFAULT, "  %u nodes, %u edges, average of %u runs:", lg.Size(), lg.NumEdges(), runs);
+	for (uint i = 0; i < LinkGraphSchedule::NUM_HANDLERS; ++i) {
+		IConsolePrintF(CC_DEFAULT, "    %-15s %10.3f ms", LinkGraphSchedule::HandlerName(i), total.handler_time[i] / 1000.0 / runs);
+		total_time += total.handler_time[i];
+	}
+	IConsolePrintF(CC_DEFAULT, "    %-15s %10.3f ms", "total", total_time / 1000.0 / runs);
+	IConsolePrintF(CC_DEFAULT, "    %u path searches, %u MCF loops, %u cycle elimination rounds, %u paths allocated",
+			total.dijkstras / runs, total.mcf_loops / runs, total.cycle_rounds / runs, total.paths / runs);
+}
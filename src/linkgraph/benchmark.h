@@ -0,0 +1,23 @@
+/* $Id$ */
+
+/*
+ * This file is part of OpenTTD.
+ * OpenTTD is free software; you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 2.
+ * OpenTTD is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details. You should have received a copy of the GNU General Public License along with OpenTTD. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file benchmark.h Declaration of the benchmark for link graph calculations. */
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "linkgraph.h"
+
+/** Maximum number of nodes of generated link graphs. */
+static const uint MAX_BENCHMARK_NODES = 4096;
+
+void GenerateLinkGraph(LinkGraph &lg, uint size, uint degree, uint32 seed);
+void BenchmarkLinkGraph(const LinkGraph &lg, uint runs, bool seeded);
+
+#endif /* BENCHMARK_H */
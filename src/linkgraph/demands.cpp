@@ -171,6 +171,29 @@ inline void Scaler::SetDemands(LinkGraphJob &job, NodeID from_id, NodeID to_id,
 	job[from_id].DeliverSupply(to_id, demand_forw);
 }
 
+/**
+ * Get the divisor applied to the effective supply from one node to another
+ * one. It grows with the distance between the nodes, depending on mod_dist.
+ * @param job The link graph job.
+ * @param from The supplying node.
+ * @param to The receiving node.
+ * @return Divisor for the effective supply; always > 0.
+ */
+int32 DemandCalculator::Divisor(LinkGraphJob &job, NodeID from, NodeID to) const
+{
+	/* Scale the distance by mod_dist around max_distance */
+	int32 distance = this->max_distance - (this->max_distance -
+			(int32)DistanceManhattan(job[from].XY(), job[to].XY())) *
+			this->mod_dist / 100;
+
+	/* Scale the accuracy by distance around accuracy / 2 */
+	int32 divisor = this->accuracy * (this->mod_dist - 50) / 100 +
+			this->accuracy * distance / this->max_distance + 1;
+
+	assert(divisor > 0);
+	return divisor;
+}
+
 /**
  * Do the actual demand calculation, called from constructor.
  * @param job Job to calculate the demands for.
@@ -223,15 +246,7 @@ void DemandCalculator::CalcDemand(LinkGraphJob &job, Tscaler scaler)
 			int32 supply = scaler.EffectiveSupply(job[from_id], job[to_id]);
 			assert(supply > 0);
 
-			/* Scale the distance by mod_dist around max_distance */
-			int32 distance = this->max_distance - (this->max_distance -
-					(int32)job[from_id][to_id].Distance()) * this->mod_dist / 100;
-
-			/* Scale the accuracy by distance around accuracy / 2 */
-			int32 divisor = this->accuracy * (this->mod_dist - 50) / 100 +
-					this->accuracy * distance / this->max_distance + 1;
-
-			assert(divisor > 0);
+			int32 divisor = this->Divisor(job, from_id, to_id);
 
 			uint demand_forw = 0;
 			if (divisor <= supply) {
@@ -266,6 +281,104 @@ void DemandCalculator::CalcDemand(LinkGraphJob &job, Tscaler scaler)
 	}
 }
 
+/**
+ * Do the demand calculation in a bounded number of passes, called from
+ * constructor. In each pass the undelivered supply of every supplying node is
+ * split among all nodes with demand left, in proportion to the effective supply
+ * towards them divided by the same distance dependent divisor CalcDemand uses.
+ * Each pair of nodes is visited at most once per pass. Further passes are only
+ * needed if symmetric demands couldn't be satisfied because the remote node had
+ * run out of supply.
+ * @param job Job to calculate the demands for.
+ * @tparam Tscaler Scaler to be used for scaling demands.
+ */
+template<class Tscaler>
+void DemandCalculator::CalcProportionalDemand(LinkGraphJob &job, Tscaler scaler)
+{
+	SmallVector<NodeID, 16> supplies;
+	SmallVector<NodeID, 16> demands;
+
+	for (NodeID node = 0; node < job.Size(); node++) {
+		scaler.AddNode(job[node]);
+		if (job[node].Supply() > 0) *supplies.Append() = node;
+		if (job[node].Demand() > 0) *demands.Append() = node;
+	}
+
+	if (supplies.Length() == 0 || demands.Length() == 0) return;
+
+	scaler.SetDemandPerNode(demands.Length());
+
+	SmallVector<uint64, 16> weights;
+	weights.Resize(demands.Length());
+	uint first = 0;
+
+	for (uint pass = 0; pass < PROPORTIONAL_PASSES; ++pass) {
+		bool delivered = false;
+		for (const NodeID *from_id = supplies.Begin(); from_id != supplies.End(); ++from_id) {
+			uint supply = job[*from_id].UndeliveredSupply();
+			if (supply == 0) continue;
+
+			uint64 total = 0;
+			for (uint i = 0; i < demands.Length(); ++i) {
+				NodeID to_id = demands[i];
+				if (to_id == *from_id || !scaler.HasDemandLeft(job[to_id])) {
+					weights[i] = 0;
+					continue;
+				}
+				/* Like in CalcDemand only consider nodes where effective supply /
+				 * accuracy divisor >= 1 at first. Others are too small or too far
+				 * away. Keep some fractional precision for the weights. */
+				weights[i] = ((uint64)scaler.EffectiveSupply(job[*from_id], job[to_id]) << 8) /
+						this->Divisor(job, *from_id, to_id);
+				if (weights[i] < (1 << 8)) {
+					if (pass + 1 < PROPORTIONAL_PASSES) {
+						weights[i] = 0;
+						continue;
+					}
+					weights[i] = max<uint64>(weights[i], 1);
+				}
+				total += weights[i];
+			}
+			if (total == 0) continue;
+
+			/* Make sure supply * total fits into 64 bits. */
+			if ((total >> 32) != 0) {
+				uint8 shift = FindLastBit(total >> 32) + 2;
+				total = 0;
+				for (uint i = 0; i < demands.Length(); ++i) {
+					if (weights[i] == 0) continue;
+					weights[i] = max<uint64>(weights[i] >> shift, 1);
+					total += weights[i];
+				}
+			}
+
+			/* Hand out the supply by cumulative weight in portions of about
+			 * supply / accuracy, like CalcDemand does. Like that rounding errors
+			 * don't add up and the number of node pairs with demand, which
+			 * dominates the later MCF passes, stays bounded. What's left over is
+			 * handed out in smaller portions in the next pass. Each node starts at
+			 * a different remote node so that they don't all favour the same ones. */
+			uint portion = max(supply / this->accuracy, 1U);
+			uint64 cumulative = 0;
+			uint assigned = 0;
+			first = (first + 1) % demands.Length();
+			for (uint j = 0; j < demands.Length(); ++j) {
+				uint i = (first + j) % demands.Length();
+				if (weights[i] == 0) continue;
+				cumulative += weights[i];
+				uint target = (uint)(supply * cumulative / total) / portion * portion;
+				uint demand_forw = min(target - assigned, job[*from_id].UndeliveredSupply());
+				assigned = target;
+				if (demand_forw == 0) continue;
+
+				scaler.SetDemands(job, *from_id, demands[i], demand_forw);
+				delivered = true;
+			}
+		}
+		if (!delivered && pass + 2 < PROPORTIONAL_PASSES) pass = PROPORTIONAL_PASSES - 2;
+	}
+}
+
 /**
  * Create the DemandCalculator and immediately do the calculation.
  * @param job Job to calculate the demands for.
@@ -284,12 +397,21 @@ DemandCalculator::DemandCalculator(LinkGraphJob &job) :
 		this->mod_dist = 100 + over100 * over100;
 	}
 
+	bool proportional = settings.GetDemandMode(cargo) == DM_PROPORTIONAL;
 	switch (settings.GetDistributionType(cargo)) {
 		case DT_SYMMETRIC:
-			this->CalcDemand<SymmetricScaler>(job, SymmetricScaler(settings.demand_size));
+			if (proportional) {
+				this->CalcProportionalDemand<SymmetricScaler>(job, SymmetricScaler(settings.demand_size));
+			} else {
+				this->CalcDemand<SymmetricScaler>(job, SymmetricScaler(settings.demand_size));
+			}
 			break;
 		case DT_ASYMMETRIC:
-			this->CalcDemand<AsymmetricScaler>(job, AsymmetricScaler());
+			if (proportional) {
+				this->CalcProportionalDemand<AsymmetricScaler>(job, AsymmetricScaler());
+			} else {
+				this->CalcDemand<AsymmetricScaler>(job, AsymmetricScaler());
+			}
 			break;
 		default:
 			/* Nothing to do. */
@@ -18,8 +18,16 @@ private:
 	int32 mod_dist;     ///< Distance modifier, determines how much demands decrease with distance.
 	int32 accuracy;     ///< Accuracy of the calculation.
 
+	/** Maximum number of passes over all nodes in proportional mode. */
+	static const uint PROPORTIONAL_PASSES = 4;
+
+	int32 Divisor(LinkGraphJob &job, NodeID from, NodeID to) const;
+
 	template<class Tscaler>
 	void CalcDemand(LinkGraphJob &job, Tscaler scaler);
+
+	template<class Tscaler>
+	void CalcProportionalDemand(LinkGraphJob &job, Tscaler scaler);
 };
 
 /**
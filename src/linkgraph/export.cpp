@@ -0,0 +1,279 @@
+/* $Id$ */
+
+/*
+ * This file is part of OpenTTD.
+ * OpenTTD is free software; you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 2.
+ * OpenTTD is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details. You should have received a copy of the GNU General Public License along with OpenTTD. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file export.cpp Definition of the export of link graphs and flows for offline analysis. */
+
+#include "../stdafx.h"
+#include "../console_func.h"
+#include "../date_func.h"
+#include "../fileio_func.h"
+#include "../map_func.h"
+#include "../station_base.h"
+#include "../thread/thread.h"
+#include "linkgraph.h"
+#include "export.h"
+
+/**
+ * Export of link graphs and the flows at their stations to a CSV file. The
+ * data is copied on the main thread when the export is started and written
+ * by a separate thread, so that the game isn't blocked by the file access.
+ * The copies of the link graphs share their edges with the originals and the
+ * copies of the flows share their entries, like the copies in link graph
+ * jobs. So taking them is cheap, but they may only be created and deleted on
+ * the main thread.
+ *
+ * Each line of the file is a record whose type is given by its first field:
+ * - graph,link graph,cargo,nodes,edges,last compression
+ * - node,link graph,station,x,y,monthly supply,acceptance
+ * - edge,link graph,from station,to station,distance,monthly capacity,monthly usage
+ * - flow,link graph,station,origin station,next station,monthly flow
+ * A next station equal to the station itself means the flow ends there.
+ */
+class LinkGraphExport {
+private:
+	/** Copy of a link graph and the flows at its stations. */
+	struct Snapshot {
+		LinkGraph graph;                ///< Copy of the link graph.
+		std::vector<FlowStatMap> flows; ///< Flows at the stations of the nodes, in node order.
+
+		/**
+		 * Copy a link graph and the flows at its stations. The edges and flows
+		 * are shared with the originals until either side modifies them.
+		 * @param lg Link graph to be copied.
+		 */
+		Snapshot(const LinkGraph &lg) : graph(lg), flows(lg.Size())
+		{
+			for (NodeID node = 0; node < lg.Size(); ++node) {
+				this->flows[node] = Station::Get(lg[node].Station())->goods[lg.Cargo()].flows;
+			}
+		}
+	};
+
+	typedef std::vector<Snapshot *> SnapshotVector;
+
+	FILE *file;              ///< File being written.
+	Date date;               ///< Date the snapshots have been taken on.
+	SnapshotVector graphs;   ///< Snapshots of the exported link graphs.
+	ThreadObject *thread;    ///< Thread writing the file, if any.
+	ThreadMutex *mutex;      ///< Mutex for finished.
+	bool finished;           ///< If the file has been written. Set by the writing thread.
+	bool failed;             ///< If writing to the file failed. Only valid once finished is set.
+
+	void WriteGraph(const Snapshot &snapshot);
+
+	/**
+	 * Scale a value accumulated since the last compression of a link graph
+	 * to a monthly value, using the date of the export.
+	 * @param lg Link graph the value belongs to.
+	 * @param base Accumulated value.
+	 * @return Monthly value.
+	 */
+	inline uint Monthly(const LinkGraph &lg, uint base) const
+	{
+		return base * 30 / (this->date - lg.LastCompression() + 1);
+	}
+
+public:
+	LinkGraphExport(FILE *file, LinkGraphID filter);
+	~LinkGraphExport();
+
+	void Write();
+	static void Run(void *e);
+
+	/**
+	 * Start writing the file in a separate thread. If no thread can be
+	 * created the file is written right away.
+	 */
+	void Start()
+	{
+		if (!ThreadObject::New(&LinkGraphExport::Run, this, &this->thread)) {
+			this->thread = NULL;
+			this->Write();
+		}
+	}
+
+	/**
+	 * Check if the file has been written.
+	 * @return If the export is finished.
+	 */
+	bool IsFinished() const
+	{
+		this->mutex->BeginCritical();
+		bool finished = this->finished;
+		this->mutex->EndCritical();
+		return finished;
+	}
+
+	/**
+	 * Check if writing the file failed.
+	 * @return If the export failed.
+	 */
+	bool HasFailed() const { return this->failed; }
+
+	/**
+	 * Get the number of exported link graphs.
+	 * @return Number of link graphs.
+	 */
+	uint NumGraphs() const { return (uint)this->graphs.size(); }
+};
+
+/** Export currently running or waiting to be finished, if any. */
+static LinkGraphExport *_link_graph_export = NULL;
+
+/**
+ * Take snapshots of the link graphs to be exported.
+ * @param file File to be written. It's closed when the export is deleted.
+ * @param filter Link graph to be exported or INVALID_LINK_GRAPH for all of them.
+ */
+LinkGraphExport::LinkGraphExport(FILE *file, LinkGraphID filter) :
+		file(file), date(_date), thread(NULL), mutex(ThreadMutex::New()), finished(false), failed(false)
+{
+	const LinkGraph *lg;
+	FOR_ALL_LINK_GRAPHS(lg) {
+		if (filter != INVALID_LINK_GRAPH && filter != lg->index) continue;
+		this->graphs.push_back(new Snapshot(*lg));
+	}
+}
+
+/**
+ * Join the writing thread, close the file and delete the snapshots.
+ */
+LinkGraphExport::~LinkGraphExport()
+{
+	if (this->thread != NULL) {
+		this->thread->Join();
+		delete this->thread;
+	}
+	delete this->mutex;
+	fclose(this->file);
+	for (SnapshotVector::iterator i = this->graphs.begin(); i != this->graphs.end(); ++i) {
+		delete *i;
+	}
+}
+
+/**
+ * Write the records of a link graph and its flows.
+ * @param snapshot Snapshot of the link graph.
+ */
+void LinkGraphExport::WriteGraph(const Snapshot &snapshot)
+{
+	const LinkGraph &lg = snapshot.graph;
+	fprintf(this->file, "graph,%u,%u,%u,%u,%d\n", lg.index, lg.Cargo(), lg.Size(), lg.NumEdges(), lg.LastCompression());
+	for (NodeID from = 0; from < lg.Size(); ++from) {
+		LinkGraph::ConstNode node = lg[from];
+		fprintf(this->file, "node,%u,%u,%u,%u,%u,%u\n", lg.index, node.Station(), TileX(node.XY()), TileY(node.XY()),
+				this->Monthly(lg, node.Supply()), node.Demand());
+	}
+	for (NodeID from = 0; from < lg.Size(); ++from) {
+		LinkGraph::ConstNode node = lg[from];
+		for (LinkGraph::ConstEdgeIterator it = node.Begin(); it != node.End(); ++it) {
+			LinkGraph::ConstEdge edge = it->second;
+			fprintf(this->file, "edge,%u,%u,%u,%u,%u,%u\n", lg.index, node.Station(), lg[it->first].Station(),
+					edge.Distance(), this->Monthly(lg, edge.Capacity()), this->Monthly(lg, edge.Usage()));
+		}
+	}
+	for (NodeID from = 0; from < lg.Size(); ++from) {
+		StationID station = lg[from].Station();
+		const FlowStatMap &flows = snapshot.flows[from];
+		for (FlowStatMap::const_iterator it = flows.begin(); it != flows.end(); ++it) {
+			const FlowStat::SharesMap *shares = it->second.GetShares();
+			uint prev = 0;
+			for (FlowStat::SharesMap::const_iterator share = shares->begin(); share != shares->end(); ++share) {
+				fprintf(this->file, "flow,%u,%u,%u,%u,%u\n", lg.index, station, it->first, share->second, share->first - prev);
+				prev = share->first;
+			}
+		}
+	}
+}
+
+/**
+ * Write all records to the file and mark the export as finished.
+ */
+void LinkGraphExport::Write()
+{
+	YearMonthDay ymd;
+	ConvertDateToYMD(this->date, &ymd);
+	fprintf(this->file, "# Link graphs and flows on %d-%d-%d (date %d)\n", ymd.year, ymd.month + 1, ymd.day, this->date);
+	fprintf(this->file, "# graph,link graph,cargo,nodes,edges,last compression\n");
+	fprintf(this->file, "# node,link graph,station,x,y,monthly supply,acceptance\n");
+	fprintf(this->file, "# edge,link graph,from station,to station,distance,monthly capacity,monthly usage\n");
+	fprintf(this->file, "# flow,link graph,station,origin station,next station,monthly flow\n");
+	for (SnapshotVector::const_iterator i = this->graphs.begin(); i != this->graphs.end(); ++i) {
+		this->WriteGraph(**i);
+	}
+	this->failed = fflush(this->file) != 0 || ferror(this->file) != 0;
+	this->mutex->BeginCritical();
+	this->finished = true;
+	this->mutex->EndCritical();
+}
+
+/**
+ * Entry point of the thread writing the file.
+ * @param e Export to be written.
+ */
+/* static */ void LinkGraphExport::Run(void *e)
+{
+	static_cast<LinkGraphExport *>(e)->Write();
+}
+
+/**
+ * Start exporting link graphs and the flows at their stations to a file in
+ * the personal directory. The data is copied right away, so that later
+ * changes don't show up in the file.
+ * @param filename Name of the file.
+ * @param filter Link graph to be exported or INVALID_LINK_GRAPH for all of them.
+ * @return If the export has been started. It isn't if another export is still
+ *         running or if the file can't be opened.
+ */
+bool StartLinkGraphExport(const char *filename, LinkGraphID filter)
+{
+	if (_link_graph_export != NULL) return false;
+	FILE *file = FioFOpenFile(filename, "w", BASE_DIR);
+	if (file == NULL) return false;
+	_link_graph_export = new LinkGraphExport(file, filter);
+	_link_graph_export->Start();
+	return true;
+}
+
+/**
+ * Check if an export is running or waiting to be finished.
+ * @return If another export can't be started yet.
+ */
+bool IsLinkGraphExportRunning()
+{
+	return _link_graph_export != NULL;
+}
+
+/**
+ * Finish the export if the file has been written and report the result on
+ * the console. Called from the game loop.
+ */
+void ProcessLinkGraphExportFinish()
+{
+	if (_link_graph_export == NULL || !_link_graph_export->IsFinished()) return;
+
+	if (_link_graph_export->HasFailed()) {
+		IConsoleError("Writing the link graph export failed.");
+	} else {
+		IConsolePrintF(CC_INFO, "Exported %u link graphs.", _link_graph_export->NumGraphs());
+	}
+	delete _link_graph_export;
+	_link_graph_export = NULL;
+}
+
+/**
+ * Wait for a running export to be written and drop it without reporting the
+ * result. Called when the game is left, as the snapshots share their data
+ * with the link graphs and stations which are about to be deleted.
+ */
+void StopLinkGraphExport()
+{
+	delete _link_graph_export;
+	_link_graph_export = NULL;
+}
@@ -0,0 +1,22 @@
+/* $Id$ */
+
+/*
+ * This file is part of OpenTTD.
+ * OpenTTD is free software; you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 2.
+ * OpenTTD is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details. You should have received a copy of the GNU General Public License along with OpenTTD. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file export.h Declaration of the export of link graphs and flows for offline analysis. */
+
+#ifndef LINKGRAPH_EXPORT_H
+#define LINKGRAPH_EXPORT_H
+
+#include "linkgraph_type.h"
+
+bool StartLinkGraphExport(const char *filename, LinkGraphID filter);
+bool IsLinkGraphExportRunning();
+void ProcessLinkGraphExportFinish();
+void StopLinkGraphExport();
+
+#endif /* LINKGRAPH_EXPORT_H */
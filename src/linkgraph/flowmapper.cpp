@@ -19,13 +19,13 @@
 void FlowMapper::Run(LinkGraphJob &job) const
 {
 	/* Time the graph has been running without being compressed. */
-	uint runtime = job.JoinDate() - job.Settings().recalc_time - job.LastCompression();
+	uint runtime = max(1, job.JoinDate() - job.Settings().recalc_time - job.LastCompression());
 
 	for (NodeID node_id = 0; node_id < job.Size(); ++node_id) {
 		Node prev_node = job[node_id];
 		StationID prev = prev_node.Station();
-		PathSet &paths = prev_node.Paths();
-		for (PathSet::iterator i = paths.begin(); i != paths.end(); ++i) {
+		PathVector &paths = prev_node.Paths();
+		for (PathVector::iterator i = paths.begin(); i != paths.end(); ++i) {
 			Path *path = *i;
 			uint flow = path->GetFlow();
 			if (flow == 0) continue;
@@ -52,10 +52,10 @@ void FlowMapper::Run(LinkGraphJob &job) const
 		/* Remove local consumption shares marked as invalid. */
 		Node node = job[node_id];
 		node.Flows().FinalizeLocalConsumption(node.Station());
-		/* Clear paths. */
-		PathSet &paths = node.Paths();
-		for (PathSet::iterator i = paths.begin(); i != paths.end(); ++i) {
-			delete *i;
+		/* Clear paths and give them back to the job for reuse. */
+		PathVector &paths = node.Paths();
+		for (PathVector::iterator i = paths.begin(); i != paths.end(); ++i) {
+			job.FreePath(*i);
 		}
 		paths.clear();
 	}
@@ -24,4 +24,23 @@ public:
 	virtual ~InitHandler() {}
 };
 
+/**
+ * Stateless, thread safe handler seeding incremental calculations with the
+ * flows of the previous calculation.
+ */
+class SeedHandler : public ComponentHandler {
+public:
+
+	/**
+	 * Seed the link graph job with the previous flows.
+	 * @param job Job to be seeded.
+	 */
+	virtual void Run(LinkGraphJob &job) const { job.SeedFlows(); }
+
+	/**
+	 * Virtual destructor has to be defined because of virtual Run().
+	 */
+	virtual ~SeedHandler() {}
+};
+
 #endif /* INIT_H */
@@ -12,6 +12,7 @@
 #include "../stdafx.h"
 #include "../core/pool_func.hpp"
 #include "linkgraph.h"
+#include <algorithm>
 
 /* Initialize the link-graph-pool */
 LinkGraphPool _link_graph_pool("LinkGraph");
@@ -19,47 +20,96 @@ INSTANTIATE_POOL_METHODS(LinkGraph)
 
 /**
  * Create a node or clear it.
+ * @param xy Location of the associated station.
  * @param st ID of the associated station.
  * @param demand Demand for cargo at the station.
  */
-inline void LinkGraph::BaseNode::Init(StationID st, uint demand)
+inline void LinkGraph::BaseNode::Init(TileIndex xy, StationID st, uint demand)
 {
 	this->supply = 0;
 	this->demand = demand;
 	this->station = st;
+	this->xy = xy;
 	this->last_update = INVALID_DATE;
 }
 
 /**
  * Create an edge.
+ * @param dest Destination node of the edge.
  * @param distance Length of the link as manhattan distance.
  */
-inline void LinkGraph::BaseEdge::Init(uint distance)
+inline void LinkGraph::BaseEdge::Init(NodeID dest, uint distance)
 {
 	this->distance = distance;
 	this->capacity = 0;
 	this->usage = 0;
 	this->last_update = INVALID_DATE;
-	this->next_edge = INVALID_NODE;
+	this->created = INVALID_DATE;
+	this->dest = dest;
 }
 
+/**
+ * Compare an edge's destination with a node ID. Used for binary searching
+ * edge vectors.
+ * @param edge Edge to be compared.
+ * @param to Node ID to compare with.
+ * @return If the edge's destination is lower than the given node.
+ */
+static inline bool EdgeDestinationLess(const LinkGraph::BaseEdge &edge, NodeID to)
+{
+	return edge.dest < to;
+}
+
+/**
+ * Find an outgoing edge in a node's edge vector.
+ * @param edges Edges of the node, sorted by destination.
+ * @param to Destination of the edge.
+ * @return Pointer to the edge or NULL if there is no such edge.
+ */
+/* static */ const LinkGraph::BaseEdge *LinkGraph::FindEdge(const EdgeVector &edges, NodeID to)
+{
+	EdgeVector::const_iterator it = std::lower_bound(edges.begin(), edges.end(), to, &EdgeDestinationLess);
+	return (it != edges.end() && it->dest == to) ? &*it : NULL;
+}
+
+/**
+ * Insert an edge into a node's edge vector, keeping the vector sorted.
+ * @param edges Edges of the node, sorted by destination.
+ * @param edge Edge to be inserted. There must not be an edge with the same
+ *             destination in the vector yet.
+ * @return Reference to the inserted edge.
+ */
+static LinkGraph::BaseEdge &InsertEdge(LinkGraph::EdgeVector &edges, const LinkGraph::BaseEdge &edge)
+{
+	LinkGraph::EdgeVector::iterator it = std::lower_bound(edges.begin(), edges.end(), edge.dest, &EdgeDestinationLess);
+	assert(it == edges.end() || it->dest != edge.dest);
+	return *edges.insert(it, edge);
+}
+
+/* Empty edge returned when looking up edges that don't exist. */
+const LinkGraph::BaseEdge LinkGraph::EMPTY_EDGE = {0, 0, 0, INVALID_DATE, INVALID_DATE, INVALID_NODE};
+
 void LinkGraph::Compress()
 {
 	this->last_compression = (_date + this->last_compression) / 2;
 	for (NodeID node1 = 0; node1 < this->Size(); ++node1) {
 		this->nodes[node1].supply /= 2;
-		for (NodeID node2 = 0; node2 < this->Size(); ++node2) {
-			BaseEdge &edge = this->edges[node1][node2];
-			if (edge.capacity > 0) {
-				edge.capacity = max(1U, edge.capacity / 2);
-				edge.usage /= 2;
+		/* Don't unshare edge lists there is nothing to compress in. */
+		if (this->edges[node1].size() == 0) continue;
+		EdgeVector &node_edges = this->edges[node1].Mutable();
+		for (EdgeVector::iterator it = node_edges.begin(); it != node_edges.end(); ++it) {
+			if (it->capacity > 0) {
+				it->capacity = max(1U, it->capacity / 2);
+				it->usage /= 2;
 			}
 		}
 	}
 }
 
 /**
- * Merge a link graph with another one.
+ * Merge a link graph with another one. The nodes are appended all at once and
+ * the other graph's edge lists are taken over as they are, so the cost only
+ * depends on the size of the other graph.
  * @param other LinkGraph to be merged into this one.
  */
 void LinkGraph::Merge(LinkGraph *other)
@@ -67,28 +117,30 @@ void LinkGraph::Merge(LinkGraph *other)
 	Date age = _date - this->last_compression + 1;
 	Date other_age = _date - other->last_compression + 1;
 	NodeID first = this->Size();
-	for (NodeID node1 = 0; node1 < other->Size(); ++node1) {
+	uint other_size = other->Size();
+	this->nodes.Append(other_size);
+	this->edges.resize(first + other_size);
+	for (NodeID node1 = 0; node1 < other_size; ++node1) {
+		NodeID new_node = first + node1;
 		Station *st = Station::Get(other->nodes[node1].station);
-		NodeID new_node = this->AddNode(st);
+		GoodsEntry &good = st->goods[this->cargo];
+		this->nodes[new_node].Init(st->xy, st->index, HasBit(good.acceptance_pickup, GoodsEntry::GES_ACCEPTANCE));
 		this->nodes[new_node].supply = LinkGraph::Scale(other->nodes[node1].supply, age, other_age);
-		st->goods[this->cargo].link_graph = this->index;
-		st->goods[this->cargo].node = new_node;
-		for (NodeID node2 = 0; node2 < node1; ++node2) {
-			BaseEdge &forward = this->edges[new_node][first + node2];
-			BaseEdge &backward = this->edges[first + node2][new_node];
-			forward = other->edges[node1][node2];
-			backward = other->edges[node2][node1];
-			forward.capacity = LinkGraph::Scale(forward.capacity, age, other_age);
-			forward.usage = LinkGraph::Scale(forward.usage, age, other_age);
-			if (forward.next_edge != INVALID_NODE) forward.next_edge += first;
-			backward.capacity = LinkGraph::Scale(backward.capacity, age, other_age);
-			backward.usage = LinkGraph::Scale(backward.usage, age, other_age);
-			if (backward.next_edge != INVALID_NODE) backward.next_edge += first;
+		good.link_graph = this->index;
+		good.node = new_node;
+
+		/* Shifting all destinations by the same offset keeps the edges sorted. */
+		this->edges[new_node].swap(other->edges[node1]);
+		if (this->edges[new_node].size() == 0) continue;
+		EdgeVector &new_edges = this->edges[new_node].Mutable();
+		for (EdgeVector::iterator it = new_edges.begin(); it != new_edges.end(); ++it) {
+			it->dest += first;
+			it->capacity = LinkGraph::Scale(it->capacity, age, other_age);
+			it->usage = LinkGraph::Scale(it->usage, age, other_age);
 		}
-		BaseEdge &new_start = this->edges[new_node][new_node];
-		new_start = other->edges[node1][node1];
-		if (new_start.next_edge != INVALID_NODE) new_start.next_edge += first;
 	}
+	this->modified = true;
+	this->restructured = true;
 	delete other;
 }
 
@@ -103,59 +155,54 @@ void LinkGraph::RemoveNode(NodeID id)
 	NodeID last_node = this->Size() - 1;
 	for (NodeID i = 0; i <= last_node; ++i) {
 		(*this)[i].RemoveEdge(id);
-		BaseEdge *node_edges = this->edges[i];
-		NodeID prev = i;
-		NodeID next = node_edges[i].next_edge;
-		while (next != INVALID_NODE) {
-			if (next == last_node) {
-				node_edges[prev].next_edge = id;
-				break;
-			}
-			prev = next;
-			next = node_edges[prev].next_edge;
+		const EdgeVector &const_edges = this->edges[i];
+		/* The last node has the highest ID, so edges to it are always at the end. */
+		if (id != last_node && !const_edges.empty() && const_edges.back().dest == last_node) {
+			EdgeVector &node_edges = this->edges[i].Mutable();
+			BaseEdge moved = node_edges.back();
+			node_edges.pop_back();
+			moved.dest = id;
+			InsertEdge(node_edges, moved);
 		}
-		node_edges[id] = node_edges[last_node];
 	}
 	Station::Get(this->nodes[last_node].station)->goods[this->cargo].node = id;
 	this->nodes.Erase(this->nodes.Get(id));
-	this->edges.EraseColumn(id);
-	/* Not doing EraseRow here, as having the extra invalid row doesn't hurt
-	 * and removing it would trigger a lot of memmove. The data has already
-	 * been copied around in the loop above. */
+	this->edges[id].swap(this->edges[last_node]);
+	this->edges.pop_back();
+	this->modified = true;
+	this->restructured = true;
 }
 
 /**
- * Add a node to the component and create empty edges associated with it. Set
- * the station's last_component to this component. Calculate the distances to all
- * other nodes. The distances to _all_ nodes are important as the demand
- * calculator relies on their availability.
+ * Add a node to the component. Set the station's last_component to this
+ * component. No edges are created; distances to other nodes can be calculated
+ * from the node locations.
  * @param st New node's station.
  * @return New node's ID.
  */
 NodeID LinkGraph::AddNode(const Station *st)
 {
 	const GoodsEntry &good = st->goods[this->cargo];
+	return this->AddNode(st->xy, st->index,
+			HasBit(good.acceptance_pickup, GoodsEntry::GES_ACCEPTANCE));
+}
 
+/**
+ * Add a node with the given properties to the component. No edges are created.
+ * @param xy Location of the node.
+ * @param st Station of the node.
+ * @param demand Demand of the node, i.e. if it accepts the cargo.
+ * @return New node's ID.
+ */
+NodeID LinkGraph::AddNode(TileIndex xy, StationID st, uint demand)
+{
 	NodeID new_node = this->Size();
 	this->nodes.Append();
-	/* Avoid reducing the height of the matrix as that is expensive and we
-	 * most likely will increase it again later which is again expensive. */
-	this->edges.Resize(new_node + 1U,
-			max(new_node + 1U, this->edges.Height()));
-
-	this->nodes[new_node].Init(st->index,
-			HasBit(good.acceptance_pickup, GoodsEntry::GES_ACCEPTANCE));
-
-	BaseEdge *new_edges = this->edges[new_node];
+	this->edges.resize(new_node + 1U);
 
-	/* Reset the first edge starting at the new node */
-	new_edges[new_node].next_edge = INVALID_NODE;
-
-	for (NodeID i = 0; i <= new_node; ++i) {
-		uint distance = DistanceManhattan(st->xy, Station::Get(this->nodes[i].station)->xy);
-		new_edges[i].Init(distance);
-		this->edges[i][new_node].Init(distance);
-	}
+	this->nodes[new_node].Init(xy, st, demand);
+	this->modified = true;
+	this->restructured = true;
 	return new_node;
 }
 
@@ -167,23 +214,27 @@ NodeID LinkGraph::AddNode(const Station *st)
 void LinkGraph::Node::AddEdge(NodeID to, uint capacity, uint usage)
 {
 	assert(this->index != to);
-	BaseEdge &edge = this->edges[to];
-	BaseEdge &first = this->edges[this->index];
+	BaseEdge new_edge;
+	new_edge.Init(to, DistanceManhattan(this->node.xy, this->graph.nodes[to].xy));
+	BaseEdge &edge = InsertEdge(this->edges.Mutable(), new_edge);
 	edge.capacity = capacity;
 	edge.usage = usage == UINT_MAX ? 0 : usage;
-	edge.next_edge = first.next_edge;
-	first.next_edge = to;
 	edge.last_update = _date;
+	edge.created = _date;
+	this->graph.modified = true;
+	this->graph.restructured = true;
 }
 
 void LinkGraph::Node::UpdateEdge(NodeID to, uint capacity, uint usage)
 {
 	assert(capacity > 0);
 	assert(usage <= capacity || usage == UINT_MAX);
-	if (this->edges[to].last_update == INVALID_DATE) {
+	BaseEdge *edge = LinkGraph::FindEdge(this->edges.Mutable(), to);
+	if (edge == NULL) {
 		this->AddEdge(to, capacity, usage);
 	} else {
-		(*this)[to].Update(capacity, usage);
+		Edge(*edge).Update(capacity, usage);
+		this->graph.modified = true;
 	}
 }
 
@@ -193,24 +244,11 @@ void LinkGraph::Node::UpdateEdge(NodeID to, uint capacity, uint usage)
  */
 void LinkGraph::Node::RemoveEdge(NodeID to)
 {
-	if (this->index == to) return;
-	BaseEdge &edge = this->edges[to];
-	edge.capacity = 0;
-	edge.last_update = INVALID_DATE;
-	edge.usage = 0;
-
-	NodeID prev = this->index;
-	NodeID next = this->edges[this->index].next_edge;
-	while (next != INVALID_NODE) {
-		if (next == to) {
-			/* Will be removed, skip it. */
-			next = this->edges[prev].next_edge = edge.next_edge;
-			break;
-		} else {
-			prev = next;
-			next = this->edges[next].next_edge;
-		}
-	}
+	if (this->index == to || !this->HasEdgeTo(to)) return;
+	EdgeVector &edges = this->edges.Mutable();
+	edges.erase(std::lower_bound(edges.begin(), edges.end(), to, &EdgeDestinationLess));
+	this->graph.modified = true;
+	this->graph.restructured = true;
 }
 
 /**
@@ -235,19 +273,87 @@ void LinkGraph::Edge::Update(uint capacity, uint usage)
 }
 
 /**
- * Resize the component and fill it with empty nodes and edges. Used when
- * loading from save games. The component is expected to be empty before.
+ * Resize the component and fill it with empty nodes. Used when loading from
+ * save games. The component is expected to be empty before.
  * @param size New size of the component.
  */
 void LinkGraph::Init(uint size)
 {
 	assert(this->Size() == 0);
-	this->edges.Resize(size, size);
+	this->edges.resize(size);
 	this->nodes.Resize(size);
 
-	for (uint i = 0; i < size; ++i) {
-		this->nodes[i].Init();
-		BaseEdge *column = this->edges[i];
-		for (uint j = 0; j < size; ++j) column[j].Init();
+	for (uint i = 0; i < size; ++i) this->nodes[i].Init();
+}
+
+/**
+ * Get the memory used by the link graph. Edges shared with the copies in link
+ * graph jobs are split evenly among the graphs sharing them, so that the usages
+ * of all graphs and jobs can be added up. As the sharing changes in the main
+ * thread only call this from there.
+ * @return Memory used, in bytes.
+ */
+size_t LinkGraph::MemoryUsage() const
+{
+	size_t usage = sizeof(*this) + this->nodes.Capacity() * sizeof(BaseNode) + this->edges.capacity() * sizeof(SharedEdges);
+	for (EdgeVectorList::const_iterator i = this->edges.begin(); i != this->edges.end(); ++i) {
+		usage += i->MemoryUsage();
 	}
+	return usage;
+}
+
+/**
+ * Get the monthly capacity and usage of all edges and supply of all nodes.
+ * @param[out] capacity Sum of the capacities.
+ * @param[out] usage Sum of the usages.
+ * @param[out] supply Sum of the supplies.
+ */
+void LinkGraph::GetMonthlyTotals(uint32 &capacity, uint32 &usage, uint32 &supply) const
+{
+	uint64 sum_capacity = 0;
+	uint64 sum_usage = 0;
+	uint64 sum_supply = 0;
+	for (NodeID node = 0; node < this->Size(); ++node) {
+		sum_supply += this->nodes[node].supply;
+		const EdgeVector &node_edges = this->edges[node];
+		for (EdgeVector::const_iterator it = node_edges.begin(); it != node_edges.end(); ++it) {
+			sum_capacity += it->capacity;
+			sum_usage += it->usage;
+		}
+	}
+	uint64 age = _date - this->last_compression + 1;
+	capacity = (uint32)min<uint64>(UINT32_MAX, sum_capacity * 30 / age);
+	usage = (uint32)min<uint64>(UINT32_MAX, sum_usage * 30 / age);
+	supply = (uint32)min<uint64>(UINT32_MAX, sum_supply * 30 / age);
+}
+
+/**
+ * Get how much the graph has changed since the last calculation. Changes of
+ * nodes, edges or acceptance affect the whole graph. Otherwise the relative
+ * change of the monthly capacity, usage and supply is measured.
+ * @return Magnitude of the change in permille, up to MAX_CHANGE.
+ */
+uint LinkGraph::ChangeMagnitude() const
+{
+	if (!this->modified) return 0;
+	if (this->restructured) return MAX_CHANGE;
+
+	uint32 capacity, usage, supply;
+	this->GetMonthlyTotals(capacity, usage, supply);
+	uint64 before = (uint64)this->calculated_capacity + this->calculated_usage + this->calculated_supply;
+	uint64 change = (uint64)Delta(capacity, this->calculated_capacity) +
+			Delta(usage, this->calculated_usage) + Delta(supply, this->calculated_supply);
+	return (uint)min<uint64>(MAX_CHANGE, change * MAX_CHANGE / (before + 1));
+}
+
+/**
+ * Remember the state of the graph when a job is spawned for it, so that later
+ * changes can be measured against it.
+ */
+void LinkGraph::RecordCalculation()
+{
+	this->GetMonthlyTotals(this->calculated_capacity, this->calculated_usage, this->calculated_supply);
+	this->last_calculation = _date;
+	this->modified = false;
+	this->restructured = false;
 }
@@ -14,11 +14,11 @@
 
 #include "../core/pool_type.hpp"
 #include "../core/smallmap_type.hpp"
-#include "../core/smallmatrix_type.hpp"
 #include "../station_base.h"
 #include "../cargo_type.h"
 #include "../date_func.h"
 #include "linkgraph_type.h"
+#include <vector>
 
 struct SaveLoad;
 class LinkGraph;
@@ -49,25 +49,136 @@ public:
 		uint supply;             ///< Supply at the station.
 		uint demand;             ///< Acceptance at the station.
 		StationID station;       ///< Station ID.
+		TileIndex xy;            ///< Location of the station referred to by the node.
 		Date last_update;        ///< When the supply was last updated.
-		void Init(StationID st = INVALID_STATION, uint demand = 0);
+		void Init(TileIndex xy = INVALID_TILE, StationID st = INVALID_STATION, uint demand = 0);
 	};
 
 	/**
-	 * An edge in the link graph. Corresponds to a link between two stations or at
-	 * least the distance between them. Edges from one node to itself contain the
-	 * ID of the opposite Node of the first active edge (i.e. not just distance) in
-	 * the column as next_edge.
+	 * An edge in the link graph. Corresponds to a link between two stations.
+	 * Only real links are stored; the outgoing edges of each node are kept in
+	 * a vector sorted by destination. The distance between nodes not connected
+	 * by an edge can be calculated from their locations.
 	 */
 	struct BaseEdge {
 		uint distance;    ///< Length of the link.
 		uint capacity;    ///< Capacity of the link.
 		uint usage;       ///< Usage of the link.
 		Date last_update; ///< When the link was last updated.
-		NodeID next_edge; ///< Destination of next valid edge starting at the same source node.
-		void Init(uint distance = 0);
+		Date created;     ///< When the link was created.
+		NodeID dest;      ///< Destination of the edge.
+		void Init(NodeID dest = INVALID_NODE, uint distance = 0);
 	};
 
+	typedef SmallVector<BaseNode, 16> NodeVector;
+	typedef std::vector<BaseEdge> EdgeVector;
+
+	/**
+	 * Outgoing edges of a node, shared between a link graph and its copies in
+	 * link graph jobs. Copying a link graph only copies references to the
+	 * edges. The edges themselves are copied when they're about to be modified
+	 * while being shared ("copy on write"). Link graphs are only copied and
+	 * deleted in the main thread, so the reference counts don't have to be
+	 * synchronized. The edges of a job's copy are never modified.
+	 */
+	class SharedEdges {
+	private:
+		/** Reference counted edge vector. */
+		struct Block {
+			uint refs;        ///< Number of SharedEdges referring to this block.
+			EdgeVector edges; ///< The actual edges.
+
+			Block() : refs(1) {}
+		};
+
+		Block *block; ///< Edges, possibly shared with other SharedEdges.
+
+	public:
+		/** Create an empty edge vector. */
+		SharedEdges() : block(new Block) {}
+
+		/**
+		 * Share the edges of another edge vector.
+		 * @param other Edges to be shared.
+		 */
+		SharedEdges(const SharedEdges &other) : block(other.block) { ++this->block->refs; }
+
+		/** Release the edges and delete them if they aren't shared anymore. */
+		~SharedEdges() { if (--this->block->refs == 0) delete this->block; }
+
+		/**
+		 * Release the current edges and share the ones of another edge vector.
+		 * @param other Edges to be shared.
+		 * @return This edge vector.
+		 */
+		SharedEdges &operator=(const SharedEdges &other)
+		{
+			++other.block->refs;
+			if (--this->block->refs == 0) delete this->block;
+			this->block = other.block;
+			return *this;
+		}
+
+		/**
+		 * Get the edges for reading. Mind that the reference becomes invalid
+		 * when the edges are copied by Mutable().
+		 * @return Edges.
+		 */
+		operator const EdgeVector &() const { return this->block->edges; }
+
+		/**
+		 * Get the number of edges.
+		 * @return Number of edges.
+		 */
+		size_t size() const { return this->block->edges.size(); }
+
+		/**
+		 * Get the edges for modification, copying them if they're shared.
+		 * @return Edges which aren't shared with anyone else.
+		 */
+		EdgeVector &Mutable()
+		{
+			if (this->block->refs > 1) {
+				Block *copy = new Block;
+				copy->edges = this->block->edges;
+				--this->block->refs;
+				this->block = copy;
+			}
+			return this->block->edges;
+		}
+
+		/**
+		 * Get the memory used by the edges, split evenly among everyone
+		 * sharing them.
+		 * @return Share of the memory used, in bytes.
+		 */
+		size_t MemoryUsage() const
+		{
+			return (sizeof(Block) + this->block->edges.capacity() * sizeof(BaseEdge)) / this->block->refs;
+		}
+
+		/**
+		 * Exchange the edges with another edge vector.
+		 * @param other Edge vector to exchange the edges with.
+		 */
+		void swap(SharedEdges &other) { Swap(this->block, other.block); }
+	};
+
+	typedef std::vector<SharedEdges> EdgeVectorList;
+
+	static const BaseEdge *FindEdge(const EdgeVector &edges, NodeID to);
+
+	/**
+	 * Find an outgoing edge in a node's edge vector.
+	 * @param edges Edges of the node, sorted by destination.
+	 * @param to Destination of the edge.
+	 * @return Pointer to the edge or NULL if there is no such edge.
+	 */
+	static inline BaseEdge *FindEdge(EdgeVector &edges, NodeID to)
+	{
+		return const_cast<BaseEdge *>(LinkGraph::FindEdge(const_cast<const EdgeVector &>(edges), to));
+	}
+
 	/**
 	 * Wrapper for an edge (const or not) allowing retrieval, but no modification.
 	 * @tparam Tedge Actual edge class, may be "const BaseEdge" or just "BaseEdge".
@@ -108,19 +219,25 @@ public:
 		 * @return Last update.
 		 */
 		Date LastUpdate() const { return this->edge.last_update; }
+
+		/**
+		 * Get the date when the edge was created.
+		 * @return Creation date.
+		 */
+		Date Created() const { return this->edge.created; }
 	};
 
 	/**
 	 * Wrapper for a node (const or not) allowing retrieval, but no modification.
-	 * @tparam Tedge Actual node class, may be "const BaseNode" or just "BaseNode".
-	 * @tparam Tedge Actual edge class, may be "const BaseEdge" or just "BaseEdge".
+	 * @tparam Tnode Actual node class, may be "const BaseNode" or just "BaseNode".
+	 * @tparam Tedges Actual edge vector class, may be "const EdgeVector" or just "EdgeVector".
 	 */
-	template<typename Tnode, typename Tedge>
+	template<typename Tnode, typename Tedges>
 	class NodeWrapper {
 	protected:
-		Tnode &node;  ///< Node being wrapped.
-		Tedge *edges; ///< Outgoing edges for wrapped node.
-		NodeID index; ///< ID of wrapped node.
+		Tnode &node;   ///< Node being wrapped.
+		Tedges &edges; ///< Outgoing edges for wrapped node.
+		NodeID index;  ///< ID of wrapped node.
 
 	public:
 
@@ -130,7 +247,7 @@ public:
 		 * @param edges Outgoing edges for node to be wrapped.
 		 * @param index ID of node to be wrapped.
 		 */
-		NodeWrapper(Tnode &node, Tedge *edges, NodeID index) : node(node),
+		NodeWrapper(Tnode &node, Tedges &edges, NodeID index) : node(node),
 			edges(edges), index(index) {}
 
 		/**
@@ -151,25 +268,42 @@ public:
 		 */
 		StationID Station() const { return this->node.station; }
 
+		/**
+		 * Get location of the station belonging to wrapped node.
+		 * @return Location of node's station.
+		 */
+		TileIndex XY() const { return this->node.xy; }
+
 		/**
 		 * Get node's last update.
 		 * @return Last update.
 		 */
 		Date LastUpdate() const { return this->node.last_update; }
+
+		/**
+		 * Get the number of outgoing edges of the wrapped node.
+		 * @return Number of edges.
+		 */
+		uint NumEdges() const { return (uint)this->edges.size(); }
+
+		/**
+		 * Check if there is an edge from the wrapped node to the given one.
+		 * @param to Remote end of the edge.
+		 * @return If the edge exists.
+		 */
+		bool HasEdgeTo(NodeID to) const { return LinkGraph::FindEdge(this->edges, to) != NULL; }
 	};
 
 	/**
 	 * Base class for iterating across outgoing edges of a node. Only the real
-	 * edges (those with capacity) are iterated. The ones with only distance
-	 * information are skipped.
+	 * edges (those with capacity) are stored and iterated.
 	 * @tparam Tedge Actual edge class. May be "BaseEdge" or "const BaseEdge".
 	 * @tparam Titer Actual iterator class.
 	 */
 	template <class Tedge, class Tedge_wrapper, class Titer>
 	class BaseEdgeIterator {
 	protected:
-		Tedge *base;    ///< Array of edges being iterated.
-		NodeID current; ///< Current offset in edges array.
+		Tedge *current; ///< Current edge.
 
 		/**
 		 * A "fake" pointer to enable operator-> on temporaries. As the objects
@@ -196,13 +330,9 @@ public:
 	public:
 		/**
 		 * Constructor.
-		 * @param base Array of edges to be iterated.
-		 * @param current ID of current node (to locate the first edge).
+		 * @param current Edge to start iterating at.
 		 */
-		BaseEdgeIterator (Tedge *base, NodeID current) :
-			base(base),
-			current(current == INVALID_NODE ? current : base[current].next_edge)
-		{}
+		BaseEdgeIterator (Tedge *current) : current(current) {}
 
 		/**
 		 * Prefix-increment.
@@ -210,7 +340,7 @@ public:
 		 */
 		Titer &operator++()
 		{
-			this->current = this->base[this->current].next_edge;
+			++this->current;
 			return static_cast<Titer &>(*this);
 		}
 
@@ -221,7 +351,7 @@ public:
 		Titer operator++(int)
 		{
 			Titer ret(static_cast<Titer &>(*this));
-			this->current = this->base[this->current].next_edge;
+			++this->current;
 			return ret;
 		}
 
@@ -230,12 +360,12 @@ public:
 		 * child class.
 		 * @tparam Tother Class of other iterator.
 		 * @param other Instance of other iterator.
-		 * @return If the iterators have the same edge array and current node.
+		 * @return If the iterators point to the same edge.
 		 */
 		template<class Tother>
 		bool operator==(const Tother &other)
 		{
-			return this->base == other.base && this->current == other.current;
+			return this->current == other.current;
 		}
 
 		/**
@@ -243,12 +373,12 @@ public:
 		 * may be of a child class.
 		 * @tparam Tother Class of other iterator.
 		 * @param other Instance of other iterator.
-		 * @return If either the edge arrays or the current nodes differ.
+		 * @return If the iterators point to different edges.
 		 */
 		template<class Tother>
 		bool operator!=(const Tother &other)
 		{
-			return this->base != other.base || this->current != other.current;
+			return this->current != other.current;
 		}
 
 		/**
@@ -257,7 +387,7 @@ public:
 		 */
 		SmallPair<NodeID, Tedge_wrapper> operator*() const
 		{
-			return SmallPair<NodeID, Tedge_wrapper>(this->current, Tedge_wrapper(this->base[this->current]));
+			return SmallPair<NodeID, Tedge_wrapper>(this->current->dest, Tedge_wrapper(*this->current));
 		}
 
 		/**
@@ -295,11 +425,10 @@ public:
 	public:
 		/**
 		 * Constructor.
-		 * @param edges Array of edges to be iterated over.
-		 * @param current ID of current edge's end node.
+		 * @param current Edge to start iterating at.
 		 */
-		ConstEdgeIterator(const BaseEdge *edges, NodeID current) :
-			BaseEdgeIterator<const BaseEdge, ConstEdge, ConstEdgeIterator>(edges, current) {}
+		ConstEdgeIterator(const BaseEdge *current) :
+			BaseEdgeIterator<const BaseEdge, ConstEdge, ConstEdgeIterator>(current) {}
 	};
 
 	/**
@@ -310,18 +439,37 @@ public:
 	public:
 		/**
 		 * Constructor.
-		 * @param edges Array of edges to be iterated over.
-		 * @param current ID of current edge's end node.
+		 * @param current Edge to start iterating at.
 		 */
-		EdgeIterator(BaseEdge *edges, NodeID current) :
-			BaseEdgeIterator<BaseEdge, Edge, EdgeIterator>(edges, current) {}
+		EdgeIterator(BaseEdge *current) :
+			BaseEdgeIterator<BaseEdge, Edge, EdgeIterator>(current) {}
 	};
 
+	/**
+	 * Get a pointer to the first edge in an edge vector.
+	 * @param edges Edge vector.
+	 * @return Pointer to first edge or NULL if the vector is empty.
+	 */
+	static inline const BaseEdge *EdgesBegin(const EdgeVector &edges)
+	{
+		return edges.empty() ? NULL : &edges.front();
+	}
+
+	/**
+	 * Get a pointer beyond the last edge in an edge vector.
+	 * @param edges Edge vector.
+	 * @return Pointer beyond last edge or NULL if the vector is empty.
+	 */
+	static inline const BaseEdge *EdgesEnd(const EdgeVector &edges)
+	{
+		return edges.empty() ? NULL : &edges.front() + edges.size();
+	}
+
 	/**
 	 * Constant node class. Only retrieval operations are allowed on both the
 	 * node itself and its edges.
 	 */
-	class ConstNode : public NodeWrapper<const BaseNode, const BaseEdge> {
+	class ConstNode : public NodeWrapper<const BaseNode, const EdgeVector> {
 	public:
 		/**
 		 * Constructor.
@@ -329,34 +477,42 @@ public:
 		 * @param node ID of the node.
 		 */
 		ConstNode(const LinkGraph *lg, NodeID node) :
-			NodeWrapper<const BaseNode, const BaseEdge>(lg->nodes[node], lg->edges[node], node)
+			NodeWrapper<const BaseNode, const EdgeVector>(lg->nodes[node], lg->edges[node], node)
 		{}
 
 		/**
 		 * Get a ConstEdge. This is not a reference as the wrapper objects are
-		 * not actually persistent.
+		 * not actually persistent. If there is no such edge an empty one is
+		 * returned.
 		 * @param to ID of end node of edge.
 		 * @return Constant edge wrapper.
 		 */
-		ConstEdge operator[](NodeID to) const { return ConstEdge(this->edges[to]); }
+		ConstEdge operator[](NodeID to) const
+		{
+			const BaseEdge *edge = LinkGraph::FindEdge(this->edges, to);
+			return ConstEdge(edge == NULL ? LinkGraph::EMPTY_EDGE : *edge);
+		}
 
 		/**
 		 * Get an iterator pointing to the start of the edges array.
 		 * @return Constant edge iterator.
 		 */
-		ConstEdgeIterator Begin() const { return ConstEdgeIterator(this->edges, this->index); }
+		ConstEdgeIterator Begin() const { return ConstEdgeIterator(LinkGraph::EdgesBegin(this->edges)); }
 
 		/**
 		 * Get an iterator pointing beyond the end of the edges array.
 		 * @return Constant edge iterator.
 		 */
-		ConstEdgeIterator End() const { return ConstEdgeIterator(this->edges, INVALID_NODE); }
+		ConstEdgeIterator End() const { return ConstEdgeIterator(LinkGraph::EdgesEnd(this->edges)); }
 	};
 
 	/**
 	 * Updatable node class. The node itself as well as its edges can be modified.
 	 */
-	class Node : public NodeWrapper<BaseNode, BaseEdge> {
+	class Node : public NodeWrapper<BaseNode, SharedEdges> {
+	protected:
+		LinkGraph &graph; ///< Link graph of the node, for looking up remote locations and tracking changes.
+
 	public:
 		/**
 		 * Constructor.
@@ -364,28 +520,36 @@ public:
 		 * @param node ID of the node.
 		 */
 		Node(LinkGraph *lg, NodeID node) :
-			NodeWrapper<BaseNode, BaseEdge>(lg->nodes[node], lg->edges[node], node)
+			NodeWrapper<BaseNode, SharedEdges>(lg->nodes[node], lg->edges[node], node),
+			graph(*lg)
 		{}
 
 		/**
-		 * Get an Edge. This is not a reference as the wrapper objects are not
-		 * actually persistent.
+		 * Get a ConstEdge. This is not a reference as the wrapper objects are
+		 * not actually persistent. The edge has to exist. Edges can only be
+		 * modified through the node, so that reading them doesn't copy them
+		 * if they're shared.
 		 * @param to ID of end node of edge.
-		 * @return Edge wrapper.
+		 * @return Constant edge wrapper.
 		 */
-		Edge operator[](NodeID to) { return Edge(this->edges[to]); }
+		ConstEdge operator[](NodeID to) const
+		{
+			const BaseEdge *edge = LinkGraph::FindEdge(this->edges, to);
+			assert(edge != NULL);
+			return ConstEdge(*edge);
+		}
 
 		/**
 		 * Get an iterator pointing to the start of the edges array.
-		 * @return Edge iterator.
+		 * @return Constant edge iterator.
 		 */
-		EdgeIterator Begin() { return EdgeIterator(this->edges, this->index); }
+		ConstEdgeIterator Begin() const { return ConstEdgeIterator(LinkGraph::EdgesBegin(this->edges)); }
 
 		/**
 		 * Get an iterator pointing beyond the end of the edges array.
 		 * @return Constant edge iterator.
 		 */
-		EdgeIterator End() { return EdgeIterator(this->edges, INVALID_NODE); }
+		ConstEdgeIterator End() const { return ConstEdgeIterator(LinkGraph::EdgesEnd(this->edges)); }
 
 		/**
 		 * Update the node's supply and set last_update to the current date.
@@ -395,6 +559,7 @@ public:
 		{
 			this->node.supply += supply;
 			this->node.last_update = _date;
+			this->graph.modified = true;
 		}
 
 		/**
@@ -403,7 +568,19 @@ public:
 		 */
 		void SetDemand(uint demand)
 		{
+			if (this->node.demand == demand) return;
 			this->node.demand = demand;
+			this->graph.modified = true;
+			this->graph.restructured = true;
+		}
+
+		/**
+		 * Set the node's location. Distances of existing edges aren't updated.
+		 * @param xy New location of the node.
+		 */
+		void UpdateLocation(TileIndex xy)
+		{
+			this->node.xy = xy;
 		}
 
 		void AddEdge(NodeID to, uint capacity, uint usage = 0);
@@ -411,8 +588,8 @@ public:
 		void RemoveEdge(NodeID to);
 	};
 
-	typedef SmallVector<BaseNode, 16> NodeVector;
-	typedef SmallMatrix<BaseEdge> EdgeMatrix;
+	/** Empty edge returned when looking up edges that don't exist. */
+	static const BaseEdge EMPTY_EDGE;
 
 	/** Minimum effective distance for timeout calculation. */
 	static const uint MIN_TIMEOUT_DISTANCE = 48;
@@ -420,6 +597,9 @@ public:
 	/** Tick at which the link graphs are compressed if necessary. */
 	static const uint COMPRESSION_TICK = 58;
 
+	/** Magnitude of a change which affects the whole graph, in permille. */
+	static const uint MAX_CHANGE = 1000;
+
 	/**
 	 * Scale a value from a link graph of age orig_age for usage in one of age
 	 * target_age. Make sure that the value stays > 0 if it was > 0 before.
@@ -433,17 +613,27 @@ public:
 		return val > 0 ? max(1U, val * target_age / orig_age) : 0;
 	}
 
-	/** Bare constructor, only for save/load. */
-	LinkGraph() : cargo(INVALID_CARGO), last_compression(0) {}
+	/**
+	 * Bare constructor, only for save/load. Graphs from savegames which don't
+	 * track changes are considered as completely changed.
+	 */
+	LinkGraph() : cargo(INVALID_CARGO), last_compression(0), last_calculation(0),
+			calculated_capacity(0), calculated_usage(0), calculated_supply(0),
+			modified(true), restructured(true) {}
 	/**
 	 * Real constructor.
 	 * @param cargo Cargo the link graph is about.
 	 */
-	LinkGraph(CargoID cargo) : cargo(cargo), last_compression(_date) {}
+	LinkGraph(CargoID cargo) : cargo(cargo), last_compression(_date), last_calculation(_date),
+			calculated_capacity(0), calculated_usage(0), calculated_supply(0),
+			modified(true), restructured(true) {}
 
 	void Init(uint size);
 	void Compress();
 	void Merge(LinkGraph *other);
+	size_t MemoryUsage() const;
+	uint ChangeMagnitude() const;
+	void RecordCalculation();
 
 	/* Splitting link graphs is intentionally not implemented.
 	 * The overhead in determining connectedness would probably outweigh the
@@ -473,12 +663,38 @@ public:
 	 */
 	inline uint Size() const { return this->nodes.Length(); }
 
+	/**
+	 * Get the number of edges in the component.
+	 * @return Number of edges.
+	 */
+	inline uint NumEdges() const
+	{
+		uint num_edges = 0;
+		for (EdgeVectorList::const_iterator i = this->edges.begin(); i != this->edges.end(); ++i) {
+			num_edges += (uint)i->size();
+		}
+		return num_edges;
+	}
+
 	/**
 	 * Get date of last compression.
 	 * @return Date of last compression.
 	 */
 	inline Date LastCompression() const { return this->last_compression; }
 
+	/**
+	 * Get the date when a job was last spawned for the graph.
+	 * @return Date of last calculation.
+	 */
+	inline Date LastCalculation() const { return this->last_calculation; }
+
+	/**
+	 * Check if the graph has been modified since the last calculation, so
+	 * that it should be calculated again.
+	 * @return If the graph has been modified.
+	 */
+	inline bool IsModified() const { return this->modified; }
+
 	/**
 	 * Get the cargo ID this component's link graph refers to.
 	 * @return Cargo ID.
@@ -496,6 +712,7 @@ public:
 	}
 
 	NodeID AddNode(const Station *st);
+	NodeID AddNode(TileIndex xy, StationID st, uint demand);
 	void RemoveNode(NodeID id);
 
 protected:
@@ -505,10 +722,18 @@ protected:
 	friend const SaveLoad *GetLinkGraphJobDesc();
 	friend void SaveLoad_LinkGraph(LinkGraph &lg);
 
-	CargoID cargo;         ///< Cargo of this component's link graph.
-	Date last_compression; ///< Last time the capacities and supplies were compressed.
-	NodeVector nodes;      ///< Nodes in the component.
-	EdgeMatrix edges;      ///< Edges in the component.
+	void GetMonthlyTotals(uint32 &capacity, uint32 &usage, uint32 &supply) const;
+
+	CargoID cargo;              ///< Cargo of this component's link graph.
+	Date last_compression;      ///< Last time the capacities and supplies were compressed.
+	Date last_calculation;      ///< Last time a job was spawned for the graph.
+	uint32 calculated_capacity; ///< Monthly capacity of all edges at the last calculation.
+	uint32 calculated_usage;    ///< Monthly usage of all edges at the last calculation.
+	uint32 calculated_supply;   ///< Monthly supply of all nodes at the last calculation.
+	bool modified;              ///< If anything has been changed since the last calculation.
+	bool restructured;          ///< If nodes, edges or acceptance have been changed since the last calculation.
+	NodeVector nodes;           ///< Nodes in the component.
+	EdgeVectorList edges;       ///< Outgoing edges of each node in the component.
 };
 
 #define FOR_ALL_LINK_GRAPHS(var) FOR_ALL_ITEMS_FROM(LinkGraph, link_graph_index, var, 0)
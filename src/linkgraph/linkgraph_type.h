@@ -39,4 +39,32 @@ enum DistributionType {
 template <> struct EnumPropsT<DistributionType> : MakeEnumPropsT<DistributionType, byte, DT_BEGIN, DT_END, DT_NUM> {};
 typedef TinyEnumT<DistributionType> DistributionTypeByte; // typedefing-enumification of DistributionType
 
+/** Algorithm used to assign the supply of the nodes to other nodes as demand. */
+enum DemandMode {
+	DM_BEGIN = 0,
+	DM_MIN = 0,
+	DM_ITERATIVE = 0,    ///< Hand out supply in small portions, visiting all pairs of nodes until it's used up.
+	DM_PROPORTIONAL = 1, ///< Split supply proportionally to the demand function in a bounded number of passes.
+	DM_MAX = 1,
+	DM_NUM = 2,
+	DM_END = 2
+};
+
+template <> struct EnumPropsT<DemandMode> : MakeEnumPropsT<DemandMode, byte, DM_BEGIN, DM_END, DM_NUM> {};
+typedef TinyEnumT<DemandMode> DemandModeByte; // typedefing-enumification of DemandMode
+
+/** Algorithm used for the first pass of the multi-commodity flow calculation. */
+enum LinkGraphSolver {
+	LGS_BEGIN = 0,
+	LGS_MIN = 0,
+	LGS_SATURATION = 0, ///< Saturate the shortest paths of all sources step by step and eliminate cycles afterwards.
+	LGS_MIN_COST = 1,   ///< Let the sources take turns finding min-cost flows with successive shortest paths.
+	LGS_MAX = 1,
+	LGS_NUM = 2,
+	LGS_END = 2
+};
+
+template <> struct EnumPropsT<LinkGraphSolver> : MakeEnumPropsT<LinkGraphSolver, byte, LGS_BEGIN, LGS_END, LGS_NUM> {};
+typedef TinyEnumT<LinkGraphSolver> LinkGraphSolverByte; // typedefing-enumification of LinkGraphSolver
+
 #endif /* LINKGRAPH_TYPE_H */
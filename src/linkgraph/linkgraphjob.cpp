@@ -13,6 +13,7 @@
 #include "../core/pool_func.hpp"
 #include "../window_func.h"
 #include "linkgraphjob.h"
+#include <algorithm>
 
 /* Initialize the link-graph-job-pool */
 LinkGraphJobPool _link_graph_job_pool("LinkGraphJob");
@@ -21,7 +22,9 @@ INSTANTIATE_POOL_METHODS(LinkGraphJob)
 /**
  * Create a link graph job from a link graph. The link graph will be copied so
  * that the calculations don't interfer with the normal operations on the
- * original. The job is immediately started.
+ * original. If the calculation is incremental the current flows of the
+ * stations are shared with the job, too. They are only copied once either
+ * side modifies them. The job is immediately started.
  * @param orig Original LinkGraph to be copied.
  */
 LinkGraphJob::LinkGraphJob(const LinkGraph &orig) :
@@ -29,42 +32,92 @@ LinkGraphJob::LinkGraphJob(const LinkGraph &orig) :
 		 * This is on purpose. */
 		link_graph(orig),
 		settings(_settings_game.linkgraph),
-		thread(NULL),
-		join_date(_date + _settings_game.linkgraph.recalc_time)
+		running(false),
+		helpers(NULL),
+		join_date(_date + _settings_game.linkgraph.recalc_time),
+		join_delay(0),
+		path_block_used(PATH_BLOCK_SIZE)
 {
+	if (!this->settings.incremental) return;
+	uint size = this->Size();
+	this->previous_flows.resize(size);
+	for (NodeID node_id = 0; node_id < size; ++node_id) {
+		const Station *st = Station::GetIfValid(this->link_graph[node_id].Station());
+		if (st != NULL) this->previous_flows[node_id] = st->goods[this->Cargo()].flows;
+	}
 }
 
 /**
- * Join the link graph job and destroy it.
+ * Destroy the link graph job. Its results are discarded unless FinaliseJob
+ * has been called before.
  */
 LinkGraphJob::~LinkGraphJob()
 {
-	assert(this->thread == NULL);
+	assert(!this->running);
+	/* The node annotations have been constructed in place by Init. */
+	for (NodeAnnotation *node = this->nodes.Begin(); node != this->nodes.End(); ++node) {
+		node->flows.~FlowStatMap();
+		node->paths.~PathVector();
+	}
+	/* Paths don't need to be destructed and are all released at once. */
+	for (Path **block = this->path_blocks.Begin(); block != this->path_blocks.End(); ++block) {
+		free(*block);
+	}
+}
+
+/**
+ * Apply the results of the finished job to the stations: Replace their flows
+ * with the calculated ones.
+ */
+void LinkGraphJob::FinaliseJob()
+{
+	assert(!this->running);
 	uint size = this->Size();
+
+	/* Find the nodes whose stations got removed during the link graph run. The
+	 * IDs of recorded stations may have been reused by new stations already. */
+	std::sort(this->removed_stations.Begin(), this->removed_stations.End());
+	std::vector<bool> removed(size, false);
+	bool any_removed = false;
 	for (NodeID node_id = 0; node_id < size; ++node_id) {
 		StationID station = (*this)[node_id].Station();
-		if (!Station::IsValidID(station)) {
-			/* Station got removed during the link graph run. We have to remove all
-			 * flows pointing to it now. This is costly but it should be rare. */
-			for (NodeID from_id = 0; from_id < size; ++from_id) {
-				if ((*this)[from_id][node_id].Capacity() > 0) {
-					FlowStatMap &flows = this->nodes[from_id].flows;
-					for (FlowStatMap::iterator it(flows.begin()); it != flows.end();) {
-						it->second.ChangeShare(station, INT_MIN);
-						if (it->second.GetShares()->empty()) {
-							flows.erase(it++);
-						} else {
-							++it;
-						}
-					}
+		if (!Station::IsValidID(station) || std::binary_search(this->removed_stations.Begin(),
+				this->removed_stations.End(), station)) {
+			removed[node_id] = true;
+			any_removed = true;
+		}
+	}
+
+	if (any_removed) {
+		/* We have to remove all flows via removed stations now. Flows only
+		 * lead to direct neighbours, so only the removed stations a node has
+		 * edges to have to be purged from its flows, all in one go. */
+		SmallVector<StationID, 16> purged;
+		for (NodeID from_id = 0; from_id < size; ++from_id) {
+			if (removed[from_id]) continue;
+			purged.Clear();
+			for (EdgeIterator it = (*this)[from_id].Begin(); it != (*this)[from_id].End(); ++it) {
+				if (removed[it->first]) *purged.Append() = (*this)[it->first].Station();
+			}
+			if (purged.Length() == 0) continue;
+
+			FlowStatMap &flows = this->nodes[from_id].flows;
+			for (FlowStatMap::iterator it(flows.begin()); it != flows.end();) {
+				for (const StationID *station = purged.Begin(); station != purged.End(); ++station) {
+					it->second.ChangeShare(*station, INT_MIN);
+				}
+				if (it->second.GetShares()->empty()) {
+					it = flows.erase(it);
+				} else {
+					++it;
 				}
 			}
-			station = INVALID_STATION;
 		}
 	}
+
 	for (NodeID node_id = 0; node_id < size; ++node_id) {
 		StationID station = (*this)[node_id].Station();
-		if (Station::IsValidID(station)) {
+		if (!removed[node_id]) {
 			InvalidateWindowData(WC_STATION_VIEW, station, this->Cargo());
 			Station::Get(station)->goods[this->Cargo()].flows.
 					swap(this->nodes[node_id].flows);
@@ -72,6 +125,68 @@ LinkGraphJob::~LinkGraphJob()
 	}
 }
 
+/**
+ * Allocate a path for the calculation. Paths are taken from the ones freed
+ * before if possible, otherwise from blocks of memory owned by the job. This
+ * way the calculation doesn't have to allocate memory for each path. Not
+ * thread safe.
+ * @return A path which still has to be constructed.
+ */
+Path *LinkGraphJob::AllocatePath()
+{
+	if (!this->free_paths.empty()) {
+		Path *path = this->free_paths.back();
+		this->free_paths.pop_back();
+		return path;
+	}
+	if (this->path_block_used == PATH_BLOCK_SIZE) {
+		*this->path_blocks.Append() = MallocT<Path>(PATH_BLOCK_SIZE);
+		this->path_block_used = 0;
+	}
+	this->stats.paths++;
+	return *(this->path_blocks.End() - 1) + this->path_block_used++;
+}
+
+/**
+ * Get the memory used by the calculation: annotations, paths and flows. The
+ * copy of the link graph isn't included as it's mostly shared with the
+ * original; use LinkGraph::MemoryUsage() for that. Only call this from the
+ * thread running the calculation or when it isn't running.
+ * @return Memory used, in bytes.
+ */
+size_t LinkGraphJob::MemoryUsage() const
+{
+	size_t usage = sizeof(*this) - sizeof(LinkGraph);
+	usage += this->nodes.Capacity() * sizeof(NodeAnnotation);
+	usage += this->edges.Width() * this->edges.Height() * sizeof(EdgeAnnotation);
+	for (const NodeAnnotation *node = this->nodes.Begin(); node != this->nodes.End(); ++node) {
+		usage += node->paths.capacity() * sizeof(Path *) + node->flows.MemoryUsage();
+	}
+	usage += this->previous_flows.capacity() * sizeof(FlowStatMap);
+	for (FlowStatMapVector::const_iterator i = this->previous_flows.begin(); i != this->previous_flows.end(); ++i) {
+		usage += i->MemoryUsage();
+	}
+	usage += this->path_blocks.Capacity() * sizeof(Path *) + this->path_blocks.Length() * PATH_BLOCK_SIZE * sizeof(Path);
+	usage += this->free_paths.capacity() * sizeof(Path *);
+	usage += this->station_to_node.capacity() * sizeof(NodeID) + this->flow_hops.capacity() * sizeof(NodeID);
+	usage += this->flow_origins.capacity() * sizeof(FlowOrigin) + this->first_flow_origin.capacity() * sizeof(uint);
+	return usage;
+}
+
+/**
+ * Estimate the memory a job for a link graph will need before it's spawned.
+ * The paths and flows aren't known before the calculation, so a fixed amount
+ * per pair of nodes is assumed for them. The estimate doesn't depend on the
+ * platform, so that all clients take the same scheduling decisions based on it.
+ * @param lg Link graph to be calculated.
+ * @return Estimated memory usage, in bytes.
+ */
+/* static */ uint64 LinkGraphJob::EstimateMemory(const LinkGraph &lg)
+{
+	uint64 size = lg.Size();
+	return size * size * (sizeof(EdgeAnnotation) + PAIR_MEMORY_ESTIMATE) + size * sizeof(LinkGraph::BaseNode);
+}
+
 /**
  * Initialize the link graph job: Resize nodes and edges and populate them.
  * This is done after the constructor so that we can do it in the calculation
@@ -82,15 +197,243 @@ void LinkGraphJob::Init()
 	uint size = this->Size();
 	this->nodes.Resize(size);
 	this->edges.Resize(size, size);
+	StationID max_station = 0;
 	for (uint i = 0; i < size; ++i) {
 		this->nodes[i].Init(this->link_graph[i].Supply());
 		EdgeAnnotation *node_edges = this->edges[i];
 		for (uint j = 0; j < size; ++j) {
 			node_edges[j].Init();
 		}
+		max_station = max(max_station, this->link_graph[i].Station());
+	}
+	this->station_to_node.assign(size > 0 ? max_station + 1 : 0, INVALID_NODE);
+	for (NodeID node = 0; node < size; ++node) {
+		this->station_to_node[this->link_graph[node].Station()] = node;
 	}
 }
 
+/**
+ * Seed an incremental calculation with the flows of the previous one. The
+ * flows of an origin are kept if they still run over existing edges, don't
+ * overload any of them and don't pass any node with an unused outgoing edge
+ * created since the last calculation, which might be a new route. The other
+ * origins are calculated from scratch.
+ * Demand served by kept flows is marked as satisfied, so that the MCF passes
+ * only assign the remaining demand, e.g. to new nodes. This has to be run
+ * after the demands have been calculated.
+ */
+void LinkGraphJob::SeedFlows()
+{
+	if (this->previous_flows.empty()) return;
+
+	uint size = this->Size();
+	/* Flows are stored as monthly values. Scale them to the time the graph
+	 * has been running without being compressed, like the demands. */
+	uint runtime = max(1, this->join_date - this->settings.recalc_time - this->LastCompression());
+
+	/* Origins without any flows of their own are new or didn't have any
+	 * demand before, so they have to be calculated in any case. */
+	std::vector<bool> affected(size);
+	for (NodeID node_id = 0; node_id < size; ++node_id) {
+		const FlowStatMap &flows = this->previous_flows[node_id];
+		affected[node_id] = flows.find((*this)[node_id].Station()) == flows.end();
+	}
+
+	/* Sum up the previous flows on each edge and find the origins whose flows
+	 * use vanished stations or edges. */
+	for (NodeID from = 0; from < size; ++from) {
+		Node node = (*this)[from];
+		const FlowStatMap &flows = this->previous_flows[from];
+		for (FlowStatMap::const_iterator it = flows.begin(); it != flows.end(); ++it) {
+			NodeID origin = this->StationToNode(it->first);
+			if (origin == INVALID_NODE) continue;
+			uint prev = 0;
+			const FlowStat::SharesMap *shares = it->second.GetShares();
+			for (FlowStat::SharesMap::const_iterator share = shares->begin(); share != shares->end(); ++share) {
+				uint flow = (share->first - prev) * runtime / 30;
+				prev = share->first;
+				if (share->second == node.Station()) continue;
+				NodeID via = this->StationToNode(share->second);
+				if (via == INVALID_NODE || !node.HasEdgeTo(via)) {
+					affected[origin] = true;
+				} else {
+					node[via].AddFlow(flow);
+				}
+			}
+		}
+	}
+
+	/* Find the origins whose flows pass overloaded edges or nodes with new
+	 * edges they might use instead. Edges which already existed during the
+	 * last calculation and still don't get any flow have been left alone on
+	 * purpose, so they don't affect anyone. */
+	Date last_calculation = this->LastCalculation();
+	std::vector<NodeID> new_edges;
+	for (NodeID from = 0; from < size; ++from) {
+		Node node = (*this)[from];
+		new_edges.clear();
+		for (EdgeIterator it = node.Begin(); it != node.End(); ++it) {
+			if (it->second.Flow() == 0 && it->second.Created() >= last_calculation) new_edges.push_back(it->first);
+		}
+		const FlowStatMap &flows = this->previous_flows[from];
+		for (FlowStatMap::const_iterator it = flows.begin(); it != flows.end(); ++it) {
+			NodeID origin = this->StationToNode(it->first);
+			if (origin == INVALID_NODE || affected[origin]) continue;
+			/* Cargo never travels back to its origin, so edges leading there don't matter. */
+			for (std::vector<NodeID>::const_iterator to = new_edges.begin(); to != new_edges.end(); ++to) {
+				if (*to != origin) {
+					affected[origin] = true;
+					break;
+				}
+			}
+			if (affected[origin]) continue;
+			const FlowStat::SharesMap *shares = it->second.GetShares();
+			for (FlowStat::SharesMap::const_iterator share = shares->begin(); share != shares->end(); ++share) {
+				if (share->second == node.Station()) continue;
+				Edge edge = node[this->StationToNode(share->second)];
+				if (edge.Flow() > edge.Capacity()) affected[origin] = true;
+			}
+		}
+	}
+
+	/* Keep the flows of unaffected origins and mark the demand they serve as
+	 * satisfied. Remove the flows of affected origins from the edges again. */
+	for (NodeID from = 0; from < size; ++from) {
+		Node node = (*this)[from];
+		const FlowStatMap &flows = this->previous_flows[from];
+		for (FlowStatMap::const_iterator it = flows.begin(); it != flows.end(); ++it) {
+			NodeID origin = this->StationToNode(it->first);
+			if (origin == INVALID_NODE) continue;
+			bool keep = !affected[origin];
+			if (keep) node.Flows().insert(*it);
+			uint prev = 0;
+			const FlowStat::SharesMap *shares = it->second.GetShares();
+			for (FlowStat::SharesMap::const_iterator share = shares->begin(); share != shares->end(); ++share) {
+				uint flow = (share->first - prev) * runtime / 30;
+				prev = share->first;
+				if (share->second == node.Station()) {
+					if (!keep) continue;
+					Edge demand = (*this)[origin][from];
+					demand.SatisfyDemand(min(flow, demand.UnsatisfiedDemand()));
+				} else if (!keep) {
+					NodeID via = this->StationToNode(share->second);
+					if (via != INVALID_NODE && node.HasEdgeTo(via)) {
+						node[via].RemoveFlow(flow);
+					}
+				}
+			}
+		}
+	}
+}
+
+/**
+ * Compare flow origins by their origin node.
+ * @param a Flow origin.
+ * @param b Node to compare it with.
+ * @return If a originates at a lower node than b.
+ */
+static bool FlowOriginLess(const LinkGraphJob::FlowOrigin &a, NodeID b)
+{
+	return a.origin < b;
+}
+
+/**
+ * Translate the current flows of all nodes into lists of next hop nodes per
+ * origin, so that they can be followed without looking up stations. The
+ * translation is only valid until the flows are changed again.
+ */
+void LinkGraphJob::TranslateFlows()
+{
+	uint size = this->Size();
+	this->flow_origins.clear();
+	this->flow_hops.clear();
+	this->first_flow_origin.resize(size + 1);
+	std::vector<std::pair<NodeID, const FlowStat *> > origins;
+	for (NodeID node = 0; node < size; ++node) {
+		this->first_flow_origin[node] = (uint)this->flow_origins.size();
+		const FlowStatMap &flows = this->nodes[node].flows;
+		origins.clear();
+		for (FlowStatMap::const_iterator it = flows.begin(); it != flows.end(); ++it) {
+			NodeID origin = this->StationToNode(it->first);
+			if (origin != INVALID_NODE) origins.push_back(std::make_pair(origin, &it->second));
+		}
+		std::sort(origins.begin(), origins.end());
+		for (std::vector<std::pair<NodeID, const FlowStat *> >::const_iterator it = origins.begin(); it != origins.end(); ++it) {
+			FlowOrigin origin = {it->first, (uint)this->flow_hops.size()};
+			this->flow_origins.push_back(origin);
+			const FlowStat::SharesMap *shares = it->second->GetShares();
+			for (FlowStat::SharesMap::const_iterator share = shares->begin(); share != shares->end(); ++share) {
+				NodeID via = this->StationToNode(share->second);
+				if (via != INVALID_NODE) this->flow_hops.push_back(via);
+			}
+		}
+	}
+	this->first_flow_origin[size] = (uint)this->flow_origins.size();
+	FlowOrigin sentinel = {INVALID_NODE, (uint)this->flow_hops.size()};
+	this->flow_origins.push_back(sentinel);
+}
+
+/**
+ * Get the next hops of the translated flows from an origin through a node.
+ * @param node Node the flows pass.
+ * @param origin Node the flows originate at.
+ * @param[out] begin First next hop.
+ * @param[out] end End of the next hops.
+ */
+void LinkGraphJob::GetFlowHops(NodeID node, NodeID origin, const NodeID *&begin, const NodeID *&end) const
+{
+	std::vector<FlowOrigin>::const_iterator first = this->flow_origins.begin() + this->first_flow_origin[node];
+	std::vector<FlowOrigin>::const_iterator last = this->flow_origins.begin() + this->first_flow_origin[node + 1];
+	std::vector<FlowOrigin>::const_iterator it = std::lower_bound(first, last, origin, &FlowOriginLess);
+	if (it == last || it->origin != origin || it->first_hop == (it + 1)->first_hop) {
+		begin = end = NULL;
+	} else {
+		begin = &this->flow_hops[it->first_hop];
+		end = begin + ((it + 1)->first_hop - it->first_hop);
+	}
+}
+
+/**
+ * Create empty statistics.
+ */
+LinkGraphJob::Statistics::Statistics() :
+		spawn_time(0), start_time(0), end_time(0), join_time(0), finalise_time(0),
+		handlers_run(0), dijkstras(0), mcf_loops(0), cycle_rounds(0), paths(0), memory(0)
+{
+	MemSetT(this->handler_time, 0, lengthof(this->handler_time));
+}
+
+/**
+ * Add the times and counters of other statistics to these ones. The points in
+ * time and the progress are left alone. Of the memory usages the higher one is
+ * kept.
+ * @param other Statistics to be added.
+ */
+void LinkGraphJob::Statistics::Add(const Statistics &other)
+{
+	this->join_time += other.join_time;
+	this->finalise_time += other.finalise_time;
+	for (uint i = 0; i < lengthof(this->handler_time); ++i) {
+		this->handler_time[i] += other.handler_time[i];
+	}
+	this->dijkstras += other.dijkstras;
+	this->mcf_loops += other.mcf_loops;
+	this->cycle_rounds += other.cycle_rounds;
+	this->paths += other.paths;
+	this->memory = max(this->memory, other.memory);
+}
+
+/**
+ * Create a profiling record of a job which has been joined.
+ * @param job Job to be recorded.
+ */
+LinkGraphJobRecord::LinkGraphJobRecord(const LinkGraphJob &job) :
+		link_graph(job.LinkGraphIndex()), cargo(job.Cargo()), nodes(job.Size()),
+		edges(job.Graph().NumEdges()), join_date(job.JoinDate() + job.JoinDelay()),
+		join_delay(job.JoinDelay()), stats(job.Stats())
+{
+}
+
 /**
  * Initialize a linkgraph job edge.
  */
@@ -110,7 +453,7 @@ void LinkGraphJob::NodeAnnotation::Init(uint supply)
 {
 	this->undelivered_supply = supply;
 	new (&this->flows) FlowStatMap;
-	new (&this->paths) PathSet;
+	new (&this->paths) PathVector;
 }
 
 /**
@@ -156,8 +499,10 @@ uint Path::AddFlow(uint new_flow, LinkGraphJob &job, uint max_saturation)
 			}
 		}
 		new_flow = this->parent->AddFlow(new_flow, job, max_saturation);
-		if (new_flow > 0) {
-			job[this->parent->node].Paths().insert(this);
+		if (new_flow > 0 && this->flow == 0) {
+			/* Flow is only pushed along fresh paths, so a path without flow
+			 * hasn't been registered, yet. */
+			job[this->parent->node].Paths().push_back(this);
 		}
 		edge.AddFlow(new_flow);
 	}
@@ -178,3 +523,16 @@ Path::Path(NodeID n, bool source) :
 	num_children(0), parent(NULL)
 {}
 
+/**
+ * Create a single leg of a path which already carries flow. Such legs aren't
+ * connected to their parents and can't be extended.
+ * @param n Id of the link graph node this leg leads to.
+ * @param origin Id of the node the flow originates from.
+ * @param flow Flow along this leg.
+ */
+Path::Path(NodeID n, NodeID origin, uint flow) :
+	distance(0), capacity(0), free_capacity(0),
+	flow(flow), node(n), origin(origin),
+	num_children(0), parent(NULL)
+{}
+
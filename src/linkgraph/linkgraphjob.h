@@ -12,13 +12,14 @@
 #ifndef LINKGRAPHJOB_H
 #define LINKGRAPHJOB_H
 
-#include "../thread/thread.h"
+#include "../core/smallmatrix_type.hpp"
 #include "linkgraph.h"
-#include <set>
+#include "linkgraphschedule.h"
+#include <vector>
 
 class LinkGraphJob;
 class Path;
-typedef std::set<Path *> PathSet;
+typedef std::vector<Path *> PathVector;
 
 /** Type of the pool for link graph jobs. */
 typedef Pool<LinkGraphJob, LinkGraphJobID, 32, 0xFFFFFF> LinkGraphJobPool;
@@ -45,24 +46,73 @@ private:
 	 */
 	struct NodeAnnotation {
 		uint undelivered_supply; ///< Amount of supply that hasn't been distributed yet.
-		PathSet paths;           ///< Paths through this node.
+		PathVector paths;        ///< Paths through this node, in the order they were registered.
 		FlowStatMap flows;       ///< Planned flows to other nodes.
 		void Init(uint supply);
 	};
 
 	typedef SmallVector<NodeAnnotation, 16> NodeAnnotationVector;
 	typedef SmallMatrix<EdgeAnnotation> EdgeAnnotationMatrix;
+	typedef std::vector<FlowStatMap> FlowStatMapVector;
+	typedef SmallVector<Path *, 16> PathBlockVector;
+
+	/** Number of paths allocated at once. */
+	static const uint PATH_BLOCK_SIZE = 1024;
+
+	/** Estimated memory for the paths and flows of a pair of nodes, in bytes. Measured on typical graphs. */
+	static const uint PAIR_MEMORY_ESTIMATE = 48;
 
 	friend const SaveLoad *GetLinkGraphJobDesc();
 	friend class LinkGraphSchedule;
 
+public:
+	/** Origin of translated flows at a node and the first of their next hops in flow_hops. */
+	struct FlowOrigin {
+		NodeID origin;  ///< Node the flows originate at.
+		uint first_hop; ///< Index of the first next hop of the flows in flow_hops.
+	};
+
+	/**
+	 * Statistics about the calculation of a job, for profiling. They are
+	 * neither saved nor synchronized as they differ between machines.
+	 */
+	struct Statistics {
+		uint64 spawn_time;    ///< Real time when the job was spawned, in microseconds.
+		uint64 start_time;    ///< Real time when the calculation was started, in microseconds.
+		uint64 end_time;      ///< Real time when the calculation was finished, in microseconds.
+		uint64 join_time;     ///< Real time the main thread had to wait for the calculation when joining, in microseconds.
+		uint64 finalise_time; ///< Real time spent applying the results to the stations, in microseconds.
+		uint64 handler_time[LinkGraphSchedule::NUM_HANDLERS]; ///< Real time spent in each handler, in microseconds.
+		uint handlers_run; ///< Number of handlers which have been run so far.
+		uint dijkstras;    ///< Number of path searches in the MCF passes.
+		uint mcf_loops;    ///< Number of loops over all sources in the MCF passes.
+		uint cycle_rounds; ///< Number of cycle elimination rounds in the first MCF pass.
+		uint paths;        ///< Number of paths allocated for the path searches.
+		uint64 memory;     ///< Memory used by the calculation when it was finished, without the link graph, in bytes.
+
+		Statistics();
+		void Add(const Statistics &other);
+	};
+
 protected:
 	const LinkGraph link_graph;       ///< Link graph to by analyzed. Is copied when job is started and mustn't be modified later.
 	const LinkGraphSettings settings; ///< Copy of _settings_game.linkgraph at spawn time.
-	ThreadObject *thread;             ///< Thread the job is running in or NULL if it's running in the main thread.
-	const Date join_date;             ///< Date when the job is to be joined.
+	bool running;                     ///< If the job is queued for or being run by a worker thread.
+	HelperThreads *helpers;           ///< Threads helping the thread running the calculation, if any. Not saved.
+	const Date join_date;             ///< Date when the job is to be joined as planned at spawn time. The calculation is based on this.
+	Date join_delay;                  ///< Number of days the join has been postponed by because the calculation was late.
 	NodeAnnotationVector nodes;       ///< Extra node data necessary for link graph calculation.
 	EdgeAnnotationMatrix edges;       ///< Extra edge data necessary for link graph calculation.
+	FlowStatMapVector previous_flows; ///< Flows of the nodes' stations at spawn time if calculating incrementally. Shared with the stations.
+	Statistics stats;                 ///< Profiling statistics of the calculation.
+	PathBlockVector path_blocks;      ///< Blocks of memory the paths of the calculation are allocated from.
+	uint path_block_used;             ///< Number of paths allocated from the last block.
+	PathVector free_paths;            ///< Paths which aren't used anymore and can be allocated again.
+	SmallVector<StationID, 4> removed_stations; ///< Stations which have been removed while the job was running.
+	std::vector<NodeID> station_to_node;        ///< Node of each station in the job, indexed by StationID. Not saved.
+	std::vector<FlowOrigin> flow_origins;       ///< Origins of the translated flows, per node sorted by origin, with a sentinel at the end. Not saved.
+	std::vector<uint> first_flow_origin;        ///< Index of the first origin of each node in flow_origins, with a sentinel at the end. Not saved.
+	std::vector<NodeID> flow_hops;              ///< Next hops of the translated flows, as nodes. Not saved.
 
 public:
 
@@ -145,12 +195,11 @@ public:
 	public:
 		/**
 		 * Constructor.
-		 * @param base Array of edges to be iterated.
+		 * @param current Edge to start iterating at.
 		 * @param base_anno Array of annotations to be iterated.
-		 * @param current Start offset of iteration.
 		 */
-		EdgeIterator(const LinkGraph::BaseEdge *base, EdgeAnnotation *base_anno, NodeID current) :
-				LinkGraph::BaseEdgeIterator<const LinkGraph::BaseEdge, Edge, EdgeIterator>(base, current),
+		EdgeIterator(const LinkGraph::BaseEdge *current, EdgeAnnotation *base_anno) :
+				LinkGraph::BaseEdgeIterator<const LinkGraph::BaseEdge, Edge, EdgeIterator>(current),
 				base_anno(base_anno) {}
 
 		/**
@@ -160,7 +209,7 @@ public:
 		 */
 		SmallPair<NodeID, Edge> operator*() const
 		{
-			return SmallPair<NodeID, Edge>(this->current, Edge(this->base[this->current], this->base_anno[this->current]));
+			return SmallPair<NodeID, Edge>(this->current->dest, Edge(*this->current, this->base_anno[this->current->dest]));
 		}
 
 		/**
@@ -195,25 +244,30 @@ public:
 
 		/**
 		 * Retrieve an edge starting at this node. Mind that this returns an
-		 * object, not a reference.
+		 * object, not a reference. If there is no link to the given node, the
+		 * link graph part of the edge is empty, but the annotation is valid.
 		 * @param to Remote end of the edge.
 		 * @return Edge between this node and "to".
 		 */
-		Edge operator[](NodeID to) const { return Edge(this->edges[to], this->edge_annos[to]); }
+		Edge operator[](NodeID to) const
+		{
+			const LinkGraph::BaseEdge *edge = LinkGraph::FindEdge(this->edges, to);
+			return Edge(edge == NULL ? LinkGraph::EMPTY_EDGE : *edge, this->edge_annos[to]);
+		}
 
 		/**
 		 * Iterator for the "begin" of the edge array. Only edges with capacity
-		 * are iterated. The others are skipped.
+		 * are stored, so only those are iterated.
 		 * @return Iterator pointing to the first edge.
 		 */
-		EdgeIterator Begin() const { return EdgeIterator(this->edges, this->edge_annos, index); }
+		EdgeIterator Begin() const { return EdgeIterator(LinkGraph::EdgesBegin(this->edges), this->edge_annos); }
 
 		/**
 		 * Iterator for the "end" of the edge array. Only edges with capacity
-		 * are iterated. The others are skipped.
+		 * are stored, so only those are iterated.
 		 * @return Iterator pointing beyond the last edge.
 		 */
-		EdgeIterator End() const { return EdgeIterator(this->edges, this->edge_annos, INVALID_NODE); }
+		EdgeIterator End() const { return EdgeIterator(LinkGraph::EdgesEnd(this->edges), this->edge_annos); }
 
 		/**
 		 * Get amount of supply that hasn't been delivered, yet.
@@ -237,13 +291,13 @@ public:
 		 * Get the paths this node is part of.
 		 * @return Paths.
 		 */
-		PathSet &Paths() { return this->node_anno.paths; }
+		PathVector &Paths() { return this->node_anno.paths; }
 
 		/**
 		 * Get a constant version of the paths this node is part of.
 		 * @return Paths.
 		 */
-		const PathSet &Paths() const { return this->node_anno.paths; }
+		const PathVector &Paths() const { return this->node_anno.paths; }
 
 		/**
 		 * Deliver some supply, adding demand to the respective edge.
@@ -261,26 +315,62 @@ public:
 	 * Bare constructor, only for save/load. link_graph, join_date and actually
 	 * settings have to be brutally const-casted in order to populate them.
 	 */
-	LinkGraphJob() : settings(_settings_game.linkgraph), thread(NULL),
-			join_date(INVALID_DATE) {}
+	LinkGraphJob() : settings(_settings_game.linkgraph), running(false), helpers(NULL),
+			join_date(INVALID_DATE), join_delay(0), path_block_used(PATH_BLOCK_SIZE) {}
 
 	LinkGraphJob(const LinkGraph &orig);
 	~LinkGraphJob();
 
 	void Init();
+	void SeedFlows();
+	void TranslateFlows();
+	void GetFlowHops(NodeID node, NodeID origin, const NodeID *&begin, const NodeID *&end) const;
+	void FinaliseJob();
+
+	Path *AllocatePath();
+	size_t MemoryUsage() const;
+	static uint64 EstimateMemory(const LinkGraph &lg);
+
+	/**
+	 * Give back a path which isn't used anymore, so that it can be allocated
+	 * again. Its memory is only released when the job is destroyed.
+	 * @param path Path to be freed.
+	 */
+	inline void FreePath(Path *path) { this->free_paths.push_back(path); }
+
+	/**
+	 * Remember that a station has been removed while the job was running, so
+	 * that its flows are purged when the job is finalised. Only called from
+	 * the game thread. After loading, removed stations are recognised by
+	 * their IDs being invalid.
+	 * @param station Removed station. It doesn't need to be part of the job.
+	 */
+	inline void RemoveStation(StationID station) { *this->removed_stations.Append() = station; }
 
 	/**
 	 * Check if job is supposed to be finished.
 	 * @return True if job should be finished by now, false if not.
 	 */
-	inline bool IsFinished() const { return this->join_date <= _date; }
+	inline bool IsFinished() const { return this->join_date + this->join_delay <= _date; }
 
 	/**
-	 * Get the date when the job should be finished.
+	 * Get the date when the job should be finished as planned at spawn time.
 	 * @return Join date.
 	 */
 	inline Date JoinDate() const { return join_date; }
 
+	/**
+	 * Get the number of days the join has been postponed by.
+	 * @return Delay of the join.
+	 */
+	inline Date JoinDelay() const { return join_delay; }
+
+	/**
+	 * Postpone the join of the job. The calculation is not affected.
+	 * @param delay Number of days to postpone the join by.
+	 */
+	inline void Postpone(Date delay) { this->join_delay += delay; }
+
 	/**
 	 * Get the link graph settings for this component.
 	 * @return Settings.
@@ -312,27 +402,93 @@ public:
 	 */
 	inline Date LastCompression() const { return this->link_graph.LastCompression(); }
 
+	/**
+	 * Get the date when the calculation before this one was spawned.
+	 * @return Date of the previous calculation.
+	 */
+	inline Date LastCalculation() const { return this->link_graph.LastCalculation(); }
+
 	/**
 	 * Get the ID of the underlying link graph.
 	 * @return Link graph ID.
 	 */
 	inline LinkGraphID LinkGraphIndex() const { return this->link_graph.index; }
 
+	/**
+	 * Get the node of a station in this job.
+	 * @param station Station to look up.
+	 * @return Node of the station or INVALID_NODE if the station isn't part of the job.
+	 */
+	inline NodeID StationToNode(StationID station) const
+	{
+		return station < this->station_to_node.size() ? this->station_to_node[station] : INVALID_NODE;
+	}
+
 	/**
 	 * Get a reference to the underlying link graph. Only use this for save/load.
 	 * @return Link graph.
 	 */
 	inline const LinkGraph &Graph() const { return this->link_graph; }
+
+	/**
+	 * Get the flows the job is seeded with. Only use this for save/load and
+	 * benchmarks.
+	 * @return Flows of the nodes' stations at spawn time.
+	 */
+	inline FlowStatMapVector &PreviousFlows() { return this->previous_flows; }
+
+	/**
+	 * Get the stations which have been removed while the job was running.
+	 * Only use this for save/load.
+	 * @return Removed stations, in the order they were removed.
+	 */
+	inline SmallVector<StationID, 4> &RemovedStations() { return this->removed_stations; }
+
+	/**
+	 * Get the threads helping with the calculation.
+	 * @return Helper threads or NULL if the calculation can't be helped.
+	 */
+	inline HelperThreads *Helpers() { return this->helpers; }
+
+	/**
+	 * Get the profiling statistics of the calculation.
+	 * @return Statistics.
+	 */
+	inline Statistics &Stats() { return this->stats; }
+
+	/**
+	 * Get the profiling statistics of the calculation.
+	 * @return Statistics.
+	 */
+	inline const Statistics &Stats() const { return this->stats; }
 };
 
 #define FOR_ALL_LINK_GRAPH_JOBS(var) FOR_ALL_ITEMS_FROM(LinkGraphJob, link_graph_job_index, var, 0)
 
+/**
+ * Profiling record of a link graph job which has been joined. The schedule
+ * keeps these for the last few jobs, so that slow calculations can be
+ * identified after the fact.
+ */
+struct LinkGraphJobRecord {
+	LinkGraphID link_graph;         ///< ID of the calculated link graph.
+	CargoID cargo;                  ///< Cargo of the calculated link graph.
+	uint nodes;                     ///< Number of nodes of the calculated link graph.
+	uint edges;                     ///< Number of edges of the calculated link graph.
+	Date join_date;                 ///< Date when the job was joined.
+	Date join_delay;                ///< Number of days the join had been postponed by.
+	LinkGraphJob::Statistics stats; ///< Profiling statistics of the calculation.
+
+	LinkGraphJobRecord(const LinkGraphJob &job);
+};
+
 /**
  * A leg of a path in the link graph. Paths can form trees by being "forked".
  */
 class Path {
 public:
 	Path(NodeID n, bool source = false);
+	Path(NodeID n, NodeID origin, uint flow);
 
 	/** Get the node this leg passes. */
 	inline NodeID GetNode() const { return this->node; }
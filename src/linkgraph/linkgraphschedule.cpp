@@ -15,16 +15,49 @@
 #include "demands.h"
 #include "mcf.h"
 #include "flowmapper.h"
+#include "../settings_type.h"
+#include "../command_func.h"
+#include "../debug.h"
+#include "../network/network.h"
+#include "../network/network_admin.h"
+#include <algorithm>
+
+/** Names of the handlers, in the order they are run in. */
+static const char * const _handler_names[] = {
+	"init",
+	"demands",
+	"seed",
+	"mcf 1st pass",
+	"flows 1st pass",
+	"mcf 2nd pass",
+	"flows 2nd pass",
+};
+assert_compile(lengthof(_handler_names) == LinkGraphSchedule::NUM_HANDLERS);
 
 /**
- * Spawn a thread if possible and run the link graph job in the thread. If
- * that's not possible run the job right now in the current thread.
+ * Check if a pending job should be run before another one. Jobs that have to
+ * be joined earlier come first. Among those the larger ones come first as they
+ * probably take longest.
+ * @param a First job.
+ * @param b Second job.
+ * @return If a is more urgent than b.
+ */
+static bool IsMoreUrgent(const LinkGraphJob *a, const LinkGraphJob *b)
+{
+	if (a->JoinDate() != b->JoinDate()) return a->JoinDate() < b->JoinDate();
+	return a->Size() > b->Size();
+}
+
+/**
+ * Queue the job for the worker threads if possible. If that's not possible run
+ * the job right now in the current thread.
  * @param job Job to be executed.
  */
 void LinkGraphSchedule::SpawnThread(LinkGraphJob *job)
 {
-	if (!ThreadObject::New(&(LinkGraphSchedule::Run), job, &job->thread)) {
-		job->thread = NULL;
+	job->stats.spawn_time = ottd_realtime_us();
+	this->StartWorkers();
+	if (this->workers.Length() == 0) {
 		/* Of course this will hang a bit.
 		 * On the other hand, if you want to play games which make this hang noticably
 		 * on a platform without threads then you'll probably get other problems first.
@@ -34,71 +67,366 @@ void LinkGraphSchedule::SpawnThread(LinkGraphJob *job)
 		 * "Step" is called. No problem in principle.
 		 */
 		LinkGraphSchedule::Run(job);
+		return;
 	}
+
+	this->pending_mutex->BeginCritical();
+	JobList::iterator i = this->pending.begin();
+	while (i != this->pending.end() && !IsMoreUrgent(job, *i)) ++i;
+	this->pending.insert(i, job);
+	job->running = true;
+	this->pending_mutex->SendSignal();
+	this->pending_mutex->EndCritical();
 }
 
 /**
- * Join the calling thread with the given job's thread if threading is enabled.
- * @param job Job whose execution thread is to be joined.
+ * Wait until the given job has been calculated. If no worker has picked it up,
+ * yet, run it in the calling thread.
+ * @param job Job whose calculation is to be joined.
  */
 void LinkGraphSchedule::JoinThread(LinkGraphJob *job)
 {
-	if (job->thread != NULL) {
-		job->thread->Join();
-		delete job->thread;
-		job->thread = NULL;
+	if (this->pending_mutex == NULL) return;
+
+	this->pending_mutex->BeginCritical();
+	JobList::iterator i = std::find(this->pending.begin(), this->pending.end(), job);
+	bool queued = i != this->pending.end();
+	if (queued) this->pending.erase(i);
+	this->pending_mutex->EndCritical();
+
+	if (queued) {
+		LinkGraphSchedule::Run(job);
+		job->running = false;
+		return;
+	}
+
+	this->finished_mutex->BeginCritical();
+	while (job->running) this->finished_mutex->WaitForSignal();
+	this->finished_mutex->EndCritical();
+}
+
+/**
+ * Check if the calculation of the given job has finished, so that joining it
+ * wouldn't block.
+ * @param job Job to be checked.
+ * @return If the job isn't queued for or being run by a worker thread.
+ */
+bool LinkGraphSchedule::IsCalculated(const LinkGraphJob *job)
+{
+	if (this->finished_mutex == NULL) return !job->running;
+
+	this->finished_mutex->BeginCritical();
+	bool calculated = !job->running;
+	this->finished_mutex->EndCritical();
+	return calculated;
+}
+
+/**
+ * Get the number of threads to be used for link graph calculations. This is a
+ * local setting and must not influence the results of the calculations.
+ * @return Configured number of threads or the number of CPU cores if not set.
+ */
+/* static */ uint LinkGraphSchedule::NumThreads()
+{
+	uint num_threads = _settings_client.gui.linkgraph_threads;
+	return num_threads == 0 ? max(1U, GetCPUCoreCount()) : num_threads;
+}
+
+/**
+ * Get the number of threads which may help with each job being calculated
+ * right now. The link graph threads are divided evenly between the jobs, so
+ * that concurrent jobs don't use more threads than configured together.
+ * @return Number of helpers for a job, not counting the thread running it.
+ */
+uint LinkGraphSchedule::NumHelpers()
+{
+	uint calculating = 1;
+	if (this->pending_mutex != NULL) {
+		this->pending_mutex->BeginCritical();
+		calculating = max(1U, this->calculating);
+		this->pending_mutex->EndCritical();
 	}
+	return max(1U, LinkGraphSchedule::NumThreads() / calculating) - 1;
 }
 
 /**
- * Start the next job in the schedule.
+ * Get the name of a handler for profiling output.
+ * @param handler Index of the handler.
+ * @return Name of the handler.
+ */
+/* static */ const char *LinkGraphSchedule::HandlerName(uint handler)
+{
+	assert(handler < NUM_HANDLERS);
+	return _handler_names[handler];
+}
+
+/**
+ * Make sure the configured number of worker threads is running. The pool is
+ * never shrunk while the game is running.
+ */
+void LinkGraphSchedule::StartWorkers()
+{
+	uint num_workers = LinkGraphSchedule::NumThreads();
+
+	if (this->pending_mutex == NULL) {
+		this->pending_mutex = ThreadMutex::New();
+		this->finished_mutex = ThreadMutex::New();
+	}
+
+	while (this->workers.Length() < num_workers) {
+		ThreadObject *thread;
+		if (!ThreadObject::New(&LinkGraphSchedule::Work, this, &thread)) break;
+		*this->workers.Append() = thread;
+	}
+}
+
+/**
+ * Terminate all worker threads. There must not be any pending jobs anymore.
+ */
+void LinkGraphSchedule::StopWorkers()
+{
+	if (this->pending_mutex == NULL) return;
+
+	this->pending_mutex->BeginCritical();
+	assert(this->pending.empty());
+	this->stop_workers = true;
+	for (uint i = 0; i < this->workers.Length(); ++i) this->pending_mutex->SendSignal();
+	this->pending_mutex->EndCritical();
+
+	for (ThreadObject **thread = this->workers.Begin(); thread != this->workers.End(); ++thread) {
+		(*thread)->Join();
+		delete *thread;
+	}
+	this->workers.Clear();
+	this->stop_workers = false;
+}
+
+/**
+ * Main loop of a worker thread. Takes the most urgent pending job, runs it and
+ * signals the main thread when it's done. Each worker keeps its own helper
+ * threads for the whole time. This method is tailored to ThreadObject::New.
+ * @param s Pointer to the link graph schedule.
+ */
+/* static */ void LinkGraphSchedule::Work(void *s)
+{
+	LinkGraphSchedule *schedule = (LinkGraphSchedule *)s;
+	HelperThreads helpers;
+	schedule->pending_mutex->BeginCritical();
+	for (;;) {
+		while (schedule->pending.empty() && !schedule->stop_workers) {
+			schedule->pending_mutex->WaitForSignal();
+		}
+		if (schedule->stop_workers) break;
+
+		LinkGraphJob *job = schedule->pending.front();
+		schedule->pending.pop_front();
+		schedule->pending_mutex->EndCritical();
+
+		LinkGraphSchedule::Run(job, &helpers);
+
+		schedule->finished_mutex->BeginCritical();
+		job->running = false;
+		schedule->finished_mutex->SendSignal();
+		schedule->finished_mutex->EndCritical();
+
+		schedule->pending_mutex->BeginCritical();
+	}
+	schedule->pending_mutex->EndCritical();
+}
+
+/**
+ * Get the estimated memory usage of all jobs which have been spawned and not
+ * joined, yet.
+ * @return Sum of the estimates, in bytes.
+ */
+uint64 LinkGraphSchedule::EstimateRunningMemory() const
+{
+	uint64 usage = 0;
+	for (JobList::const_iterator i = this->running.begin(); i != this->running.end(); ++i) {
+		usage += LinkGraphJob::EstimateMemory((*i)->Graph());
+	}
+	return usage;
+}
+
+/**
+ * Get the priority of a link graph for being calculated. Graphs which haven't
+ * been modified since their last calculation don't need to be calculated at
+ * all. Otherwise the magnitude of the changes is weighted by the size of the
+ * graph and the time since its last calculation, so that busy graphs are
+ * refreshed more often, but all of them get their turn eventually. Graphs which
+ * have waited longer than a round through the whole schedule would take come
+ * first, the oldest one first.
+ * @param lg Link graph to be calculated.
+ * @param round Number of days a round through the whole schedule takes.
+ * @return Priority, 0 if the graph doesn't have to be calculated.
+ */
+static uint64 GetPriority(const LinkGraph *lg, Date round)
+{
+	if (!lg->IsModified()) return 0;
+	Date age = max(1, _date - lg->LastCalculation());
+	if (age >= round) return ((uint64)1 << 63) + age;
+	return (uint64)(lg->ChangeMagnitude() + 1) * age * lg->Size();
+}
+
+/**
+ * Check if a link graph should be calculated before another one.
+ * @param a Priority and first link graph.
+ * @param b Priority and second link graph.
+ * @return If the first graph has a higher priority.
+ */
+static bool HasHigherPriority(const std::pair<uint64, LinkGraph *> &a, const std::pair<uint64, LinkGraph *> &b)
+{
+	return a.first > b.first;
+}
+
+/**
+ * Start the next jobs. Up to recalc_jobs link graphs with the highest
+ * priorities are taken from the schedule; see GetPriority(). Among equal ones
+ * those which have been queued first are taken. If the next job would exceed
+ * the memory budget together with the running ones it's deferred until enough
+ * of them have been joined. The graphs behind it have to wait, too, so that it
+ * isn't delayed indefinitely by smaller ones. The decisions are based on saved
+ * state and estimates which are the same on all clients.
  */
 void LinkGraphSchedule::SpawnNext()
 {
-	if (this->schedule.empty()) return;
-	LinkGraph *next = this->schedule.front();
-	assert(next == LinkGraph::Get(next->index));
-	this->schedule.pop_front();
-	if (LinkGraphJob::CanAllocateItem()) {
-		LinkGraphJob *job = new LinkGraphJob(*next);
-		this->SpawnThread(job);
-		this->running.push_back(job);
-	} else {
-		NOT_REACHED();
+	const LinkGraphSettings &settings = _settings_game.linkgraph;
+	Date round = CeilDiv((uint)(this->schedule.size() + this->running.size()), settings.recalc_jobs) * settings.recalc_interval;
+	std::vector<std::pair<uint64, LinkGraph *> > candidates;
+	for (GraphList::iterator it = this->schedule.begin(); it != this->schedule.end(); ++it) {
+		assert(*it == LinkGraph::Get((*it)->index));
+		uint64 priority = GetPriority(*it, round);
+		if (priority > 0) candidates.push_back(std::make_pair(priority, *it));
+	}
+	std::stable_sort(candidates.begin(), candidates.end(), &HasHigherPriority);
+
+	uint64 budget = (uint64)settings.memory_budget << 20;
+	uint64 usage = budget == 0 ? 0 : this->EstimateRunningMemory();
+	for (uint i = 0; i < settings.recalc_jobs && i < candidates.size(); ++i) {
+		LinkGraph *next = candidates[i].second;
+		if (budget != 0 && !this->running.empty()) {
+			uint64 estimate = LinkGraphJob::EstimateMemory(*next);
+			if (usage + estimate > budget) {
+				DEBUG(misc, 2, "Deferring link graph %u (%u nodes) as it would exceed the memory budget", next->index, next->Size());
+				break;
+			}
+			usage += estimate;
+		}
+		this->schedule.remove(next);
+		if (LinkGraphJob::CanAllocateItem()) {
+			LinkGraphJob *job = new LinkGraphJob(*next);
+			next->RecordCalculation();
+			this->SpawnThread(job);
+			this->running.push_back(job);
+		} else {
+			NOT_REACHED();
+		}
 	}
 }
 
 /**
- * Join the next finished job, if available.
+ * Postpone the joins of all jobs due at the given date whose calculations
+ * haven't finished, yet, so that joining them doesn't block the game. Whether
+ * a calculation has finished is different on each client. So only the server
+ * decides and sends a command, which makes all clients postpone the same jobs.
+ * @param join_date Date of the next join.
+ */
+void LinkGraphSchedule::PostponeLate(Date join_date)
+{
+	if (_networking && !_network_server) return;
+
+	for (JobList::iterator i = this->running.begin(); i != this->running.end(); ++i) {
+		LinkGraphJob *job = *i;
+		if (job->JoinDate() + job->JoinDelay() > join_date || this->IsCalculated(job)) continue;
+		DoCommandP(0, job->index, job->JoinDelay(), CMD_POSTPONE_LINKGRAPH_JOB);
+	}
+}
+
+/**
+ * Join all finished jobs in the running list. Jobs spawned together share
+ * their join date, so they are also joined together, in the order they were
+ * spawned in. Postponed jobs are skipped until their delayed join date.
  */
 void LinkGraphSchedule::JoinNext()
 {
-	if (this->running.empty()) return;
-	LinkGraphJob *next = this->running.front();
-	if (!next->IsFinished()) return;
-	this->running.pop_front();
-	LinkGraphID id = next->LinkGraphIndex();
-	this->JoinThread(next);
-	delete next;
-	if (LinkGraph::IsValidID(id)) {
-		LinkGraph *lg = LinkGraph::Get(id);
-		this->Unqueue(lg); // Unqueue to avoid double-queueing recycled IDs.
-		this->Queue(lg);
+	for (JobList::iterator i = this->running.begin(); i != this->running.end();) {
+		LinkGraphJob *next = *i;
+		if (!next->IsFinished()) {
+			++i;
+			continue;
+		}
+		i = this->running.erase(i);
+		LinkGraphID id = next->LinkGraphIndex();
+		uint64 join_start = ottd_realtime_us();
+		this->JoinThread(next);
+		uint64 finalise_start = ottd_realtime_us();
+		next->FinaliseJob();
+		next->stats.join_time = finalise_start - join_start;
+		next->stats.finalise_time = ottd_realtime_us() - finalise_start;
+		this->Record(*next);
+		delete next;
+		if (LinkGraph::IsValidID(id)) {
+			LinkGraph *lg = LinkGraph::Get(id);
+			this->Unqueue(lg); // Unqueue to avoid double-queueing recycled IDs.
+			this->Queue(lg);
+		}
+	}
+}
+
+/**
+ * Keep the profiling record of a joined job and send it to the admins. If the
+ * main thread had to wait for the job a debug message is printed, too.
+ * @param job Job which has just been joined.
+ */
+void LinkGraphSchedule::Record(const LinkGraphJob &job)
+{
+	this->records.push_front(LinkGraphJobRecord(job));
+	if (this->records.size() > MAX_RECORDS) this->records.pop_back();
+
+	const LinkGraphJobRecord &record = this->records.front();
+	if (record.stats.join_time >= 1000) {
+		DEBUG(misc, 1, "Link graph %u (cargo %u, %u nodes, %u edges) wasn't finished in time, waited %u ms for it",
+				record.link_graph, record.cargo, record.nodes, record.edges, (uint)(record.stats.join_time / 1000));
 	}
+#ifdef ENABLE_NETWORK
+	if (_network_server) NetworkAdminLinkGraph(record);
+#endif /* ENABLE_NETWORK */
 }
 
 /**
- * Run all handlers for the given Job. This method is tailored to
- * ThreadObject::New.
- * @param j Pointer to a link graph job.
+ * Run all handlers for the given Job and record the time spent in each of
+ * them. While it runs the job counts as being calculated for dividing the
+ * helper threads.
+ * @param job Job to be calculated.
+ * @param helpers Threads helping the calling thread, or NULL if the calling
+ *                thread is the main thread, which uses the schedule's helpers.
  */
-/* static */ void LinkGraphSchedule::Run(void *j)
+/* static */ void LinkGraphSchedule::Run(LinkGraphJob *job, HelperThreads *helpers)
 {
-	LinkGraphJob *job = (LinkGraphJob *)j;
 	LinkGraphSchedule *schedule = LinkGraphSchedule::Instance();
+	job->helpers = helpers != NULL ? helpers : &schedule->helpers;
+	if (schedule->pending_mutex != NULL) {
+		schedule->pending_mutex->BeginCritical();
+		schedule->calculating++;
+		schedule->pending_mutex->EndCritical();
+	}
+
+	job->stats.start_time = ottd_realtime_us();
 	for (uint i = 0; i < lengthof(schedule->handlers); ++i) {
+		uint64 start = ottd_realtime_us();
 		schedule->handlers[i]->Run(*job);
+		job->stats.handler_time[i] = ottd_realtime_us() - start;
+		job->stats.handlers_run = i + 1;
+	}
+	job->stats.end_time = ottd_realtime_us();
+	job->stats.memory = job->MemoryUsage();
+
+	if (schedule->pending_mutex != NULL) {
+		schedule->pending_mutex->BeginCritical();
+		schedule->calculating--;
+		schedule->pending_mutex->EndCritical();
 	}
+	job->helpers = NULL;
 }
 
 /**
@@ -113,29 +441,41 @@ void LinkGraphSchedule::SpawnAll()
 }
 
 /**
- * Clear all link graphs and jobs from the schedule.
+ * Clear all link graphs and jobs from the schedule. Jobs which haven't been
+ * picked up by a worker are dropped without being calculated.
  */
 /* static */ void LinkGraphSchedule::Clear()
 {
 	LinkGraphSchedule *inst = LinkGraphSchedule::Instance();
+	if (inst->pending_mutex != NULL) {
+		inst->pending_mutex->BeginCritical();
+		for (JobList::iterator i(inst->pending.begin()); i != inst->pending.end(); ++i) {
+			(*i)->running = false;
+		}
+		inst->pending.clear();
+		inst->pending_mutex->EndCritical();
+	}
 	for (JobList::iterator i(inst->running.begin()); i != inst->running.end(); ++i) {
 		inst->JoinThread(*i);
 	}
 	inst->running.clear();
 	inst->schedule.clear();
+	inst->records.clear();
 }
 
 /**
  * Create a link graph schedule and initialize its handlers.
  */
-LinkGraphSchedule::LinkGraphSchedule()
+LinkGraphSchedule::LinkGraphSchedule() : pending_mutex(NULL),
+		finished_mutex(NULL), stop_workers(false), calculating(0)
 {
 	this->handlers[0] = new InitHandler;
 	this->handlers[1] = new DemandHandler;
-	this->handlers[2] = new MCFHandler<MCF1stPass>;
-	this->handlers[3] = new FlowMapper;
-	this->handlers[4] = new MCFHandler<MCF2ndPass>;
-	this->handlers[5] = new FlowMapper;
+	this->handlers[2] = new SeedHandler;
+	this->handlers[3] = new MCF1stPassHandler;
+	this->handlers[4] = new FlowMapper;
+	this->handlers[5] = new MCFHandler<MCF2ndPass>;
+	this->handlers[6] = new FlowMapper;
 }
 
 /**
@@ -144,6 +484,9 @@ LinkGraphSchedule::LinkGraphSchedule()
 LinkGraphSchedule::~LinkGraphSchedule()
 {
 	this->Clear();
+	this->StopWorkers();
+	delete this->pending_mutex;
+	delete this->finished_mutex;
 	for (uint i = 0; i < lengthof(this->handlers); ++i) {
 		delete this->handlers[i];
 	}
@@ -171,6 +514,10 @@ void OnTick_LinkGraph()
 		} else if (offset == _settings_game.linkgraph.recalc_interval / 2) {
 			LinkGraphSchedule::Instance()->JoinNext();
 		}
+		/* Decide a day in advance, so that the command reaches all clients in time. */
+		if ((offset + 1) % _settings_game.linkgraph.recalc_interval == _settings_game.linkgraph.recalc_interval / 2) {
+			LinkGraphSchedule::Instance()->PostponeLate(_date + 1);
+		}
 	} else if (_date_fract == LinkGraph::COMPRESSION_TICK) {
 		LinkGraph *lg;
 		/* Compress graphs after 256 to 512 days; approximately once a year. */
@@ -182,3 +529,22 @@ void OnTick_LinkGraph()
 }
 
 
+
+/**
+ * Postpone the join of a link graph job whose calculation hasn't finished in
+ * time on the server to the next day jobs are joined on.
+ * @param tile unused
+ * @param flags operation to perform
+ * @param p1 ID of the link graph job
+ * @param p2 number of days the join has already been postponed by, to detect outdated commands
+ * @param text unused
+ * @return the cost of this operation or an error
+ */
+CommandCost CmdPostponeLinkGraphJob(TileIndex tile, DoCommandFlag flags, uint32 p1, uint32 p2, const char *text)
+{
+	LinkGraphJob *job = LinkGraphJob::GetIfValid(p1);
+	if (job == NULL || job->JoinDelay() != (Date)p2) return CMD_ERROR;
+
+	if (flags & DC_EXEC) job->Postpone(_settings_game.linkgraph.recalc_interval);
+	return CommandCost();
+}
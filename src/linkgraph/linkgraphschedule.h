@@ -12,9 +12,11 @@
 #ifndef LINKGRAPHSCHEDULE_H
 #define LINKGRAPHSCHEDULE_H
 
+#include "../thread/helper_threads.h"
 #include "linkgraph.h"
 
 class LinkGraphJob;
+struct LinkGraphJobRecord;
 
 /**
  * A handler doing "something" on a link graph component. It must not keep any
@@ -35,31 +37,61 @@ public:
 	virtual void Run(LinkGraphJob &job) const = 0;
 };
 
+/**
+ * Schedule for link graph jobs. Jobs are spawned and joined at fixed dates on
+ * the main thread, so that all clients agree on them. In between they are run
+ * on a pool of worker threads. The size of the pool only influences how fast
+ * the jobs are calculated, not their results.
+ */
 class LinkGraphSchedule {
 private:
 	LinkGraphSchedule();
 	~LinkGraphSchedule();
 	typedef std::list<LinkGraph *> GraphList;
 	typedef std::list<LinkGraphJob *> JobList;
+	typedef SmallVector<ThreadObject *, 8> WorkerList;
+	typedef std::list<LinkGraphJobRecord> RecordList;
 	friend const SaveLoad *GetLinkGraphScheduleDesc();
 
+public:
+	static const uint NUM_HANDLERS = 7; ///< Number of handlers run for each job.
+	static const uint MAX_RECORDS = 32; ///< Number of joined jobs whose profiling records are kept.
+
 protected:
-	ComponentHandler *handlers[6]; ///< Handlers to be run for each job.
-	GraphList schedule;            ///< Queue for new jobs.
+	ComponentHandler *handlers[NUM_HANDLERS]; ///< Handlers to be run for each job.
+	GraphList schedule;            ///< Link graphs waiting to be calculated, in the order they have been queued in.
 	JobList running;               ///< Currently running jobs.
+	JobList pending;               ///< Jobs waiting for a worker, most urgent first. Protected by pending_mutex.
+	WorkerList workers;            ///< Worker threads running the jobs.
+	ThreadMutex *pending_mutex;    ///< Mutex for the pending jobs. Idle workers wait for it to be signalled.
+	ThreadMutex *finished_mutex;   ///< Mutex for finishing jobs. The main thread waits for it to be signalled when joining.
+	bool stop_workers;             ///< If the workers should terminate. Protected by pending_mutex.
+	uint calculating;              ///< Number of jobs being calculated right now. Protected by pending_mutex.
+	HelperThreads helpers;         ///< Threads helping the main thread when it calculates a job itself.
+	RecordList records;            ///< Profiling records of the last joined jobs, newest first.
 
 	void SpawnThread(LinkGraphJob *job);
 	void JoinThread(LinkGraphJob *job);
+	bool IsCalculated(const LinkGraphJob *job);
+	void StartWorkers();
+	void StopWorkers();
+	static void Work(void *s);
+	void Record(const LinkGraphJob &job);
 
 public:
 	/* This is a tick where not much else is happening, so a small lag might go unnoticed. */
 	static const uint SPAWN_JOIN_TICK = 21; ///< Tick when jobs are spawned or joined every day.
 
 	static LinkGraphSchedule *Instance();
-	static void Run(void *j);
+	static uint NumThreads();
+	static const char *HandlerName(uint handler);
+	static void Run(LinkGraphJob *job, HelperThreads *helpers = NULL);
 	static void Clear();
 
+	uint NumHelpers();
+	uint64 EstimateRunningMemory() const;
 	void SpawnNext();
+	void PostponeLate(Date join_date);
 	void JoinNext();
 	void SpawnAll();
 
@@ -78,6 +110,12 @@ public:
 	 * @param lg Link graph to be removed.
 	 */
 	void Unqueue(LinkGraph *lg) { this->schedule.remove(lg); }
+
+	/**
+	 * Get the profiling records of the last joined jobs.
+	 * @return Records, newest first.
+	 */
+	const RecordList &Records() const { return this->records; }
 };
 
 #endif /* LINKGRAPHSCHEDULE_H */
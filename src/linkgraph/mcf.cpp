@@ -2,9 +2,10 @@
 
 #include "../stdafx.h"
 #include "../core/math_func.hpp"
+#include "../thread/helper_threads.h"
 #include "mcf.h"
-
-typedef std::map<NodeID, Path *> PathViaMap;
+#include <algorithm>
+#include <queue>
 
 /**
  * Distance-based annotation for use in the Dijkstra algorithm. This is close
@@ -69,6 +70,137 @@ public:
 	};
 };
 
+/* Annotations are constructed in place of the paths allocated by the job. */
+assert_compile(sizeof(DistanceAnnotation) == sizeof(Path));
+assert_compile(sizeof(CapacityAnnotation) == sizeof(Path));
+
+/**
+ * Indexed 4-ary heap of annotations, ordered by their comparators. In contrast
+ * to a std::set it doesn't allocate memory for each annotation and it can move
+ * an annotation to its new position in place when its value changes.
+ * @tparam Tannotation Annotation to be stored.
+ */
+template<class Tannotation>
+class AnnotationHeap {
+private:
+	static const uint ARITY = 4;             ///< Number of children of each element.
+	static const uint NOT_QUEUED = UINT_MAX; ///< Position of annotations which aren't in the heap.
+
+	typename Tannotation::Comparator first; ///< Tells if an annotation has to be popped before another one.
+	std::vector<Tannotation *> heap;        ///< Annotations in heap order.
+	std::vector<uint> position;             ///< Position of each node's annotation in the heap or NOT_QUEUED.
+
+	/**
+	 * Put an annotation at the given position of the heap.
+	 * @param pos Position in the heap.
+	 * @param anno Annotation to be placed there.
+	 */
+	inline void Place(uint pos, Tannotation *anno)
+	{
+		this->heap[pos] = anno;
+		this->position[anno->GetNode()] = pos;
+	}
+
+	/**
+	 * Move the annotation at the given position towards the top as far as
+	 * necessary.
+	 * @param pos Position of the annotation.
+	 * @return New position of the annotation.
+	 */
+	uint SiftUp(uint pos)
+	{
+		Tannotation *anno = this->heap[pos];
+		while (pos > 0) {
+			uint parent = (pos - 1) / ARITY;
+			if (!this->first(anno, this->heap[parent])) break;
+			this->Place(pos, this->heap[parent]);
+			pos = parent;
+		}
+		this->Place(pos, anno);
+		return pos;
+	}
+
+	/**
+	 * Move the annotation at the given position towards the bottom as far as
+	 * necessary.
+	 * @param pos Position of the annotation.
+	 */
+	void SiftDown(uint pos)
+	{
+		Tannotation *anno = this->heap[pos];
+		uint size = (uint)this->heap.size();
+		for (uint child = pos * ARITY + 1; child < size; child = pos * ARITY + 1) {
+			uint last = min(child + ARITY, size);
+			uint best = child;
+			for (++child; child < last; ++child) {
+				if (this->first(this->heap[child], this->heap[best])) best = child;
+			}
+			if (!this->first(this->heap[best], anno)) break;
+			this->Place(pos, this->heap[best]);
+			pos = best;
+		}
+		this->Place(pos, anno);
+	}
+
+public:
+	/**
+	 * Create an empty heap.
+	 * @param size Number of nodes in the graph.
+	 */
+	AnnotationHeap(uint size) : position(size, NOT_QUEUED)
+	{
+		this->heap.reserve(size);
+	}
+
+	/**
+	 * Check if there are annotations left in the heap.
+	 * @return If the heap is empty.
+	 */
+	inline bool IsEmpty() const { return this->heap.empty(); }
+
+	/**
+	 * Add an annotation to the heap.
+	 * @param anno Annotation to be added. It must not be in the heap, yet.
+	 */
+	void Push(Tannotation *anno)
+	{
+		this->heap.push_back(anno);
+		this->SiftUp((uint)this->heap.size() - 1);
+	}
+
+	/**
+	 * Remove the annotation which comes first from the heap.
+	 * @return Removed annotation.
+	 */
+	Tannotation *Pop()
+	{
+		Tannotation *top = this->heap.front();
+		this->position[top->GetNode()] = NOT_QUEUED;
+		Tannotation *last = this->heap.back();
+		this->heap.pop_back();
+		if (!this->heap.empty()) {
+			this->heap[0] = last;
+			this->SiftDown(0);
+		}
+		return top;
+	}
+
+	/**
+	 * Restore the heap order after an annotation has been changed. If the
+	 * annotation has already been popped it's added again.
+	 * @param anno Changed annotation.
+	 */
+	void Update(Tannotation *anno)
+	{
+		uint pos = this->position[anno->GetNode()];
+		if (pos == NOT_QUEUED) {
+			this->Push(anno);
+		} else {
+			this->SiftDown(this->SiftUp(pos));
+		}
+	}
+};
+
 /**
  * Iterator class for getting the edges in the order of their next_edge
  * members.
@@ -86,7 +218,7 @@ public:
 	 * @param job Job to iterate on.
 	 */
 	GraphEdgeIterator(LinkGraphJob &job) : job(job),
-		i(NULL, NULL, INVALID_NODE), end(NULL, NULL, INVALID_NODE)
+		i(NULL, NULL), end(NULL, NULL)
 	{}
 
 	/**
@@ -111,32 +243,24 @@ public:
 };
 
 /**
- * Iterator class for getting edges from a FlowStatMap.
+ * Iterator class for getting edges from the translated flows of a job.
  */
 class FlowEdgeIterator {
 private:
 	LinkGraphJob &job; ///< Link graph job we're working with.
 
-	/** Lookup table for getting NodeIDs from StationIDs. */
-	std::map<StationID, NodeID> station_to_node;
+	/** Current next hop of the flows. */
+	const NodeID *it;
 
-	/** Current iterator in the shares map. */
-	FlowStat::SharesMap::const_iterator it;
-
-	/** End of the shares map. */
-	FlowStat::SharesMap::const_iterator end;
+	/** End of the next hops of the flows. */
+	const NodeID *end;
 public:
 
 	/**
-	 * Constructor.
+	 * Constructor. The flows of the job have to be translated before.
 	 * @param job Link graph job to work with.
 	 */
-	FlowEdgeIterator(LinkGraphJob &job) : job(job)
-	{
-		for (NodeID i = 0; i < job.Size(); ++i) {
-			this->station_to_node[job[i].Station()] = i;
-		}
-	}
+	FlowEdgeIterator(LinkGraphJob &job) : job(job), it(NULL), end(NULL) {}
 
 	/**
 	 * Setup the node to retrieve edges from.
@@ -145,16 +269,7 @@ public:
 	 */
 	void SetNode(NodeID source, NodeID node)
 	{
-		static const FlowStat::SharesMap empty;
-		const FlowStatMap &flows = this->job[node].Flows();
-		FlowStatMap::const_iterator it = flows.find(this->job[source].Station());
-		if (it != flows.end()) {
-			this->it = it->second.GetShares()->begin();
-			this->end = it->second.GetShares()->end();
-		} else {
-			this->it = empty.begin();
-			this->end = empty.end();
-		}
+		this->job.GetFlowHops(node, source, this->it, this->end);
 	}
 
 	/**
@@ -164,7 +279,7 @@ public:
 	NodeID Next()
 	{
 		if (this->it == this->end) return INVALID_NODE;
-		return this->station_to_node[(this->it++)->second];
+		return *this->it++;
 	}
 };
 
@@ -232,25 +347,21 @@ bool CapacityAnnotation::IsBetter(const CapacityAnnotation *base, uint cap,
  * @tparam Tannotation Annotation to be used.
  * @tparam Tedge_iterator Iterator to be used for getting outgoing edges.
  * @param source_node Node where the algorithm starts.
- * @param paths Container for the paths to be calculated.
+ * @param paths Container for the paths to be calculated, as prepared by
+ *              AllocatePaths.
  */
 template<class Tannotation, class Tedge_iterator>
 void MultiCommodityFlow::Dijkstra(NodeID source_node, PathVector &paths)
 {
-	typedef std::set<Tannotation *, typename Tannotation::Comparator> AnnoSet;
 	Tedge_iterator iter(this->job);
 	uint size = this->job.Size();
-	AnnoSet annos;
-	paths.resize(size, NULL);
+	assert(paths.size() == size);
+	AnnotationHeap<Tannotation> annos(size);
 	for (NodeID node = 0; node < size; ++node) {
-		Tannotation *anno = new Tannotation(node, node == source_node);
-		annos.insert(anno);
-		paths[node] = anno;
-	}
-	while (!annos.empty()) {
-		typename AnnoSet::iterator i = annos.begin();
-		Tannotation *source = *i;
-		annos.erase(i);
+		annos.Push(new (paths[node]) Tannotation(node, node == source_node));
+	}
+	while (!annos.IsEmpty()) {
+		Tannotation *source = annos.Pop();
 		NodeID from = source->GetNode();
 		iter.SetNode(source_node, from);
 		for (NodeID to = iter.Next(); to != INVALID_NODE; to = iter.Next()) {
@@ -267,16 +378,103 @@ void MultiCommodityFlow::Dijkstra(NodeID source_node, PathVector &paths)
 			uint distance = edge.Distance() + 1;
 			Tannotation *dest = static_cast<Tannotation *>(paths[to]);
 			if (dest->IsBetter(source, capacity, capacity - edge.Flow(), distance)) {
-				annos.erase(dest);
 				dest->Fork(source, capacity, capacity - edge.Flow(), distance);
-				annos.insert(dest);
+				annos.Update(dest);
 			}
 		}
 	}
 }
 
 /**
- * Clean up paths that lead nowhere and the root path.
+ * Fill a path container with one annotation for each node. The annotations are
+ * allocated from the job, which reuses the ones left over from previous
+ * searches if possible. They are only initialized by the search itself. Not
+ * thread safe.
+ * @tparam Tannotation Annotation to be used.
+ * @param paths Empty path container to be filled.
+ */
+template<class Tannotation>
+void MultiCommodityFlow::AllocatePaths(PathVector &paths)
+{
+	assert(paths.empty());
+	paths.resize(this->job.Size(), NULL);
+	for (PathVector::iterator i = paths.begin(); i != paths.end(); ++i) {
+		*i = this->job.AllocatePath();
+	}
+}
+
+/**
+ * A batch of path searches, shared between the threads running them. Each
+ * thread takes the next source that hasn't been searched, yet, until all are
+ * done. The searches only read the job's data, so they don't interfere.
+ * @tparam Tannotation Annotation to be used.
+ * @tparam Tedge_iterator Iterator to be used for getting outgoing edges.
+ */
+template<class Tannotation, class Tedge_iterator>
+class DijkstraBatch {
+private:
+	MultiCommodityFlow *mcf; ///< Flow calculation the searches are run for.
+	NodeID first;            ///< First source of the batch.
+	PathVector *paths;       ///< Path containers, one for each source.
+
+public:
+	/**
+	 * Create a batch of path searches.
+	 * @param mcf Flow calculation the searches are run for.
+	 * @param first First source of the batch.
+	 * @param paths Path containers, one for each source.
+	 */
+	DijkstraBatch(MultiCommodityFlow *mcf, NodeID first, PathVector *paths) :
+		mcf(mcf), first(first), paths(paths)
+	{}
+
+	/**
+	 * Search the paths for one source of the batch. This method is tailored
+	 * to HelperThreads::Run.
+	 * @param b Pointer to the batch.
+	 * @param i Offset of the source in the batch.
+	 */
+	static void Search(void *b, uint i)
+	{
+		DijkstraBatch *batch = (DijkstraBatch *)b;
+		batch->mcf->Dijkstra<Tannotation, Tedge_iterator>(batch->first + i, batch->paths[i]);
+	}
+};
+
+/**
+ * Search the paths for a number of consecutive sources. If there is more than
+ * one source the searches are distributed over the threads helping with the
+ * job, as many as its share of the link graph threads allows. The results
+ * only depend on the job's state before the call, not on the number of
+ * threads.
+ * @tparam Tannotation Annotation to be used.
+ * @tparam Tedge_iterator Iterator to be used for getting outgoing edges.
+ * @param first First source to be searched.
+ * @param count Number of sources to be searched.
+ * @param paths Path containers, one for each source.
+ */
+template<class Tannotation, class Tedge_iterator>
+void MultiCommodityFlow::Dijkstras(NodeID first, uint count, PathVector *paths)
+{
+	for (uint i = 0; i < count; ++i) this->AllocatePaths<Tannotation>(paths[i]);
+	this->job.Stats().dijkstras += count;
+
+	if (count == 1) {
+		this->Dijkstra<Tannotation, Tedge_iterator>(first, paths[0]);
+		return;
+	}
+
+	typedef DijkstraBatch<Tannotation, Tedge_iterator> Batch;
+	Batch batch(this, first, paths);
+	HelperThreads *helpers = this->job.Helpers();
+	uint num_helpers = min(LinkGraphSchedule::Instance()->NumHelpers(), count - 1);
+	if (helpers->Count() < num_helpers) helpers->Start(num_helpers);
+	helpers->Run(&Batch::Search, &batch, count, num_helpers);
+}
+
+/**
+ * Clean up paths that lead nowhere and the root path. They are given back to
+ * the job for reuse in later searches.
  * @param source_id ID of the root node.
  * @param paths Paths to be cleaned up.
  */
@@ -293,12 +491,12 @@ void MultiCommodityFlow::CleanupPaths(NodeID source_id, PathVector &paths)
 			path->Detach();
 			if (path->GetNumChildren() == 0) {
 				paths[path->GetNode()] = NULL;
-				delete path;
+				this->job.FreePath(path);
 			}
 			path = parent;
 		}
 	}
-	delete source;
+	this->job.FreePath(source);
 	paths.clear();
 }
 
@@ -321,6 +519,17 @@ uint MultiCommodityFlow::PushFlow(Edge &edge, Path *path, uint accuracy,
 	return flow;
 }
 
+/**
+ * Compare two paths by the node they pass.
+ * @param a First path.
+ * @param b Second path.
+ * @return If the first path passes a node with a lower ID than the second one.
+ */
+static bool PathNodeLess(const Path *a, const Path *b)
+{
+	return a->GetNode() < b->GetNode();
+}
+
 /**
  * Find the flow along a cycle including cycle_begin in path.
  * @param path Set of paths that form the cycle.
@@ -375,28 +584,33 @@ bool MCF1stPass::EliminateCycles(PathVector &path, NodeID origin_id, NodeID next
 
 	if (at_next_pos == NULL) {
 		/* Summarize paths; add up the paths with the same source and next hop
-		 * in one path each. */
-		PathSet &paths = this->job[next_id].Paths();
-		PathViaMap next_hops;
-		for (PathSet::iterator i = paths.begin(); i != paths.end(); ++i) {
+		 * in one path each. The first path to each next hop is remembered in
+		 * next_hops, which is cleared again before searching recursively. */
+		const PathVector &paths = this->job[next_id].Paths();
+		SmallVector<Path *, 8> children;
+		for (PathVector::const_iterator i = paths.begin(); i != paths.end(); ++i) {
 			Path *new_child = *i;
 			if (new_child->GetOrigin() == origin_id) {
-				PathViaMap::iterator via_it = next_hops.find(new_child->GetNode());
-				if (via_it == next_hops.end()) {
-					next_hops[new_child->GetNode()] = new_child;
+				Path *&child = this->next_hops[new_child->GetNode()];
+				if (child == NULL) {
+					child = new_child;
+					*children.Append() = new_child;
 				} else {
-					Path *child = via_it->second;
 					uint new_flow = new_child->GetFlow();
 					child->AddFlow(new_flow);
 					new_child->ReduceFlow(new_flow);
 				}
 			}
 		}
+		for (Path **child = children.Begin(); child != children.End(); ++child) {
+			this->next_hops[(*child)->GetNode()] = NULL;
+		}
+		std::sort(children.Begin(), children.End(), &PathNodeLess);
+
 		bool found = false;
 		/* Search the next hops for nodes we have already visited */
-		for (PathViaMap::iterator via_it = next_hops.begin();
-				via_it != next_hops.end(); ++via_it) {
-			Path *child = via_it->second;
+		for (Path **it = children.Begin(); it != children.End(); ++it) {
+			Path *child = *it;
 			if (child->GetFlow() > 0) {
 				/* Push one child into the path vector and search this child's
 				 * children. */
@@ -434,6 +648,7 @@ bool MCF1stPass::EliminateCycles()
 	bool cycles_found = false;
 	uint size = this->job.Size();
 	PathVector path(size, NULL);
+	this->job.Stats().cycle_rounds++;
 	for (NodeID node = 0; node < size; ++node) {
 		/* Starting at each node in the graph find all cycles involving this
 		 * node. */
@@ -447,39 +662,45 @@ bool MCF1stPass::EliminateCycles()
  * Run the first pass of the MCF calculation.
  * @param job Link graph job to calculate.
  */
-MCF1stPass::MCF1stPass(LinkGraphJob &job) : MultiCommodityFlow(job)
+MCF1stPass::MCF1stPass(LinkGraphJob &job) : MultiCommodityFlow(job),
+		next_hops(job.Size(), NULL)
 {
-	PathVector paths;
+	std::vector<PathVector> batch_paths(this->batch_size);
 	uint size = job.Size();
 	uint accuracy = job.Settings().accuracy;
 	bool more_loops;
 
 	do {
 		more_loops = false;
-		for (NodeID source = 0; source < size; ++source) {
+		job.Stats().mcf_loops++;
+		for (uint first = 0; first < size; first += this->batch_size) {
+			uint count = min(this->batch_size, size - first);
 			/* First saturate the shortest paths. */
-			this->Dijkstra<DistanceAnnotation, GraphEdgeIterator>(source, paths);
+			this->Dijkstras<DistanceAnnotation, GraphEdgeIterator>(first, count, &batch_paths[0]);
 
-			for (NodeID dest = 0; dest < size; ++dest) {
-				Edge edge = job[source][dest];
-				if (edge.UnsatisfiedDemand() > 0) {
-					Path *path = paths[dest];
-					assert(path != NULL);
-					/* Generally only allow paths that don't exceed the
-					 * available capacity. But if no demand has been assigned
-					 * yet, make an exception and allow any valid path *once*. */
-					if (path->GetFreeCapacity() > 0 && this->PushFlow(edge, path,
-							accuracy, this->max_saturation) > 0) {
-						/* If a path has been found there is a chance we can
-						 * find more. */
-						more_loops = more_loops || (edge.UnsatisfiedDemand() > 0);
-					} else if (edge.UnsatisfiedDemand() == edge.Demand() &&
-							path->GetFreeCapacity() > INT_MIN) {
-						this->PushFlow(edge, path, accuracy, UINT_MAX);
+			for (NodeID source = first; source < first + count; ++source) {
+				PathVector &paths = batch_paths[source - first];
+				for (NodeID dest = 0; dest < size; ++dest) {
+					Edge edge = job[source][dest];
+					if (edge.UnsatisfiedDemand() > 0) {
+						Path *path = paths[dest];
+						assert(path != NULL);
+						/* Generally only allow paths that don't exceed the
+						 * available capacity. But if no demand has been assigned
+						 * yet, make an exception and allow any valid path *once*. */
+						if (path->GetFreeCapacity() > 0 && this->PushFlow(edge, path,
+								accuracy, this->max_saturation) > 0) {
+							/* If a path has been found there is a chance we can
+							 * find more. */
+							more_loops = more_loops || (edge.UnsatisfiedDemand() > 0);
+						} else if (edge.UnsatisfiedDemand() == edge.Demand() &&
+								path->GetFreeCapacity() > INT_MIN) {
+							this->PushFlow(edge, path, accuracy, UINT_MAX);
+						}
 					}
 				}
+				this->CleanupPaths(source, paths);
 			}
-			this->CleanupPaths(source, paths);
 		}
 	} while (more_loops || this->EliminateCycles());
 }
@@ -492,23 +713,353 @@ MCF1stPass::MCF1stPass(LinkGraphJob &job) : MultiCommodityFlow(job)
 MCF2ndPass::MCF2ndPass(LinkGraphJob &job) : MultiCommodityFlow(job)
 {
 	this->max_saturation = UINT_MAX; // disable artificial cap on saturation
-	PathVector paths;
+	job.TranslateFlows();
+	std::vector<PathVector> batch_paths(this->batch_size);
 	uint size = job.Size();
 	uint accuracy = job.Settings().accuracy;
 	bool demand_left = true;
 	while (demand_left) {
 		demand_left = false;
+		job.Stats().mcf_loops++;
+		for (uint first = 0; first < size; first += this->batch_size) {
+			uint count = min(this->batch_size, size - first);
+			this->Dijkstras<CapacityAnnotation, FlowEdgeIterator>(first, count, &batch_paths[0]);
+
+			for (NodeID source = first; source < first + count; ++source) {
+				PathVector &paths = batch_paths[source - first];
+				for (NodeID dest = 0; dest < size; ++dest) {
+					Edge edge = this->job[source][dest];
+					Path *path = paths[dest];
+					if (edge.UnsatisfiedDemand() > 0 && path->GetFreeCapacity() > INT_MIN) {
+						this->PushFlow(edge, path, accuracy, UINT_MAX);
+						if (edge.UnsatisfiedDemand() > 0) demand_left = true;
+					}
+				}
+				this->CleanupPaths(source, paths);
+			}
+		}
+	}
+}
+
+/** States of nodes in MCFMinCost::CancelCycles. */
+enum CycleSearchState {
+	CSS_UNVISITED, ///< Node hasn't been visited, yet.
+	CSS_ON_STACK,  ///< Node's outgoing flow is being searched.
+	CSS_DONE,      ///< Node has been searched completely.
+};
+
+/**
+ * Search the shortest paths from a source in the residual graph: Edges with
+ * capacity left can be followed forward and edges with flow of the source can
+ * be followed backward, which moves that flow elsewhere. The costs are reduced
+ * by the node potentials, so that they stay non-negative and Dijkstra's
+ * algorithm can be used. Afterwards the potentials are updated with the
+ * distances found.
+ * @param source Node to start at.
+ * @param ignore_capacity If true, follow all edges forward with their plain
+ *                        costs and don't update the potentials.
+ */
+void MCFMinCost::Search(NodeID source, bool ignore_capacity)
+{
+	typedef std::pair<int64, NodeID> QueueItem;
+	std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<QueueItem> > queue;
+
+	for (std::vector<Label>::iterator it = this->labels.begin(); it != this->labels.end(); ++it) {
+		it->distance = INT64_MAX;
+		it->pred = INVALID_ARC;
+	}
+	this->labels[source].distance = 0;
+	queue.push(QueueItem(0, source));
+	this->job.Stats().dijkstras++;
+
+	int64 max_distance = 0;
+	while (!queue.empty()) {
+		QueueItem item = queue.top();
+		queue.pop();
+		NodeID node = item.second;
+		const Label &label = this->labels[node];
+		if (item.first > label.distance) continue;
+		max_distance = item.first;
+
+		for (uint i = this->first_out[node]; i < this->first_out[node + 1]; ++i) {
+			const Arc &arc = this->arcs[i];
+			if (!ignore_capacity && arc.residual == 0) continue;
+			Label &next = this->labels[arc.to];
+			int64 cost = ignore_capacity ? arc.cost : max<int64>(0, arc.cost + label.potential - next.potential);
+			if (label.distance + cost < next.distance) {
+				next.distance = label.distance + cost;
+				next.pred = i;
+				next.reverse = false;
+				queue.push(QueueItem(next.distance, arc.to));
+			}
+		}
+		if (ignore_capacity) continue;
+
+		for (uint i = this->first_in[node]; i < this->first_in[node + 1]; ++i) {
+			const Arc &arc = this->arcs[this->in_arcs[i]];
+			if (arc.flow == 0) continue;
+			Label &next = this->labels[arc.from];
+			int64 cost = max<int64>(0, label.potential - next.potential - arc.cost);
+			if (label.distance + cost < next.distance) {
+				next.distance = label.distance + cost;
+				next.pred = this->in_arcs[i];
+				next.reverse = true;
+				queue.push(QueueItem(next.distance, arc.from));
+			}
+		}
+	}
+
+	if (ignore_capacity) return;
+	for (std::vector<Label>::iterator it = this->labels.begin(); it != this->labels.end(); ++it) {
+		it->potential += it->distance == INT64_MAX ? max_distance : it->distance;
+	}
+}
+
+/**
+ * Push flow of the current source along the path to the given node found by
+ * the last search.
+ * @param dest End of the path. It doesn't need to be reachable.
+ * @param amount Maximum amount of flow to be pushed.
+ * @param ignore_capacity If the path may be overloaded.
+ * @return Amount of flow actually pushed.
+ */
+uint MCFMinCost::Augment(NodeID dest, uint amount, bool ignore_capacity)
+{
+	if (this->labels[dest].distance == INT64_MAX) return 0;
+
+	for (NodeID node = dest; this->labels[node].pred != INVALID_ARC;) {
+		const Label &label = this->labels[node];
+		const Arc &arc = this->arcs[label.pred];
+		if (label.reverse) {
+			amount = min(amount, arc.flow);
+			node = arc.to;
+		} else {
+			if (!ignore_capacity) amount = min(amount, arc.residual);
+			node = arc.from;
+		}
+	}
+	if (amount == 0) return 0;
+
+	for (NodeID node = dest; this->labels[node].pred != INVALID_ARC;) {
+		const Label &label = this->labels[node];
+		Arc &arc = this->arcs[label.pred];
+		if (label.reverse) {
+			arc.flow -= amount;
+			arc.residual += amount;
+			node = arc.to;
+		} else {
+			if (arc.flow == 0) this->used_arcs.push_back(label.pred);
+			arc.flow += amount;
+			arc.residual -= min(arc.residual, amount);
+			node = arc.from;
+		}
+	}
+	return amount;
+}
+
+/**
+ * Remove cycles from the flow of the current source. Search the flow depth
+ * first; an arc leading back to a node on the stack closes a cycle. Cycles can
+ * appear as flow is moved around with potentials which only approximately
+ * reflect the residual graph.
+ * @param node Node to continue the search at.
+ */
+void MCFMinCost::CancelCycles(NodeID node)
+{
+	this->labels[node].state = CSS_ON_STACK;
+	for (uint i = this->first_out[node]; i < this->first_out[node + 1]; ++i) {
+		Arc &arc = this->arcs[i];
+		if (arc.flow == 0) continue;
+		Label &next = this->labels[arc.to];
+		if (next.state == CSS_ON_STACK) {
+			uint flow = arc.flow;
+			for (NodeID prev = node; prev != arc.to; prev = this->arcs[this->labels[prev].pred].from) {
+				flow = min(flow, this->arcs[this->labels[prev].pred].flow);
+			}
+			if (flow == 0) continue;
+			arc.flow -= flow;
+			arc.residual += flow;
+			for (NodeID prev = node; prev != arc.to; prev = this->arcs[this->labels[prev].pred].from) {
+				Arc &cycle_arc = this->arcs[this->labels[prev].pred];
+				cycle_arc.flow -= flow;
+				cycle_arc.residual += flow;
+			}
+		} else if (next.state == CSS_UNVISITED) {
+			next.pred = i;
+			this->CancelCycles(arc.to);
+		}
+	}
+	this->labels[node].state = CSS_DONE;
+}
+
+/**
+ * Restore the flow of a source from an earlier round onto the arcs.
+ * @param flows Flow of the source per arc.
+ */
+void MCFMinCost::LoadFlows(const ArcFlowVector &flows)
+{
+	for (ArcFlowVector::const_iterator it = flows.begin(); it != flows.end(); ++it) {
+		this->arcs[it->first].flow = it->second;
+		this->used_arcs.push_back(it->first);
+	}
+}
+
+/**
+ * Save the flow of the current source for the next round and clear it from
+ * the arcs. The capacity it takes stays reserved.
+ * @param flows Flow of the source per arc.
+ */
+void MCFMinCost::StoreFlows(ArcFlowVector &flows)
+{
+	flows.clear();
+	for (std::vector<uint>::iterator it = this->used_arcs.begin(); it != this->used_arcs.end(); ++it) {
+		Arc &arc = this->arcs[*it];
+		if (arc.flow == 0) continue;
+		flows.push_back(std::make_pair(*it, arc.flow));
+		arc.flow = 0;
+	}
+	this->used_arcs.clear();
+}
+
+/**
+ * Turn the flow of the current source into path legs registered at the nodes,
+ * like the ones MCF1stPass creates, and add it to the edges.
+ * @param source Current source.
+ */
+void MCFMinCost::CreatePaths(NodeID source)
+{
+	for (std::vector<uint>::iterator it = this->used_arcs.begin(); it != this->used_arcs.end(); ++it) {
+		Arc &arc = this->arcs[*it];
+		if (arc.flow == 0) continue;
+		Path *path = new (this->job.AllocatePath()) Path(arc.to, source, arc.flow);
+		this->job[arc.from].Paths().push_back(path);
+		this->job[arc.from][arc.to].AddFlow(arc.flow);
+		arc.flow = 0;
+	}
+	this->used_arcs.clear();
+}
+
+/**
+ * Run the min-cost flow variant of the first pass of the MCF calculation.
+ * @param job Link graph job to calculate.
+ */
+MCFMinCost::MCFMinCost(LinkGraphJob &job) : MultiCommodityFlow(job)
+{
+	uint size = job.Size();
+	uint accuracy = job.Settings().accuracy;
+
+	/* Build the arrays of arcs going out of and coming into each node. */
+	this->first_out.resize(size + 1);
+	this->first_in.resize(size + 1);
+	for (NodeID node = 0; node < size; ++node) {
+		this->first_out[node] = (uint)this->arcs.size();
+		for (EdgeIterator it = job[node].Begin(); it != job[node].End(); ++it) {
+			Edge edge = it->second;
+			uint usable = edge.Capacity() * this->max_saturation / 100;
+			Arc arc;
+			arc.from = node;
+			arc.to = it->first;
+			arc.cost = edge.Distance() + 1;
+			arc.residual = usable > edge.Flow() ? usable - edge.Flow() : 0;
+			arc.flow = 0;
+			this->arcs.push_back(arc);
+			this->first_in[arc.to + 1]++;
+		}
+	}
+	this->first_out[size] = (uint)this->arcs.size();
+	for (NodeID node = 0; node < size; ++node) this->first_in[node + 1] += this->first_in[node];
+	this->in_arcs.resize(this->arcs.size());
+	std::vector<uint> next_in(this->first_in.begin(), this->first_in.end() - 1);
+	for (uint i = 0; i < this->arcs.size(); ++i) this->in_arcs[next_in[this->arcs[i].to]++] = i;
+	this->labels.resize(size);
+
+	/* Handle the sources in a few rounds, each of them only being allowed to
+	 * satisfy a growing part of its demand per round. Otherwise the first
+	 * sources would take all the capacity and leave nothing for the others. */
+	std::vector<ArcFlowVector> flows(size);
+	uint rounds = min(accuracy, MIN_COST_ROUNDS);
+	uint searches = max(1U, accuracy / rounds);
+	SmallVector<NodeID, 16> sinks;
+	for (uint round = 1; round <= rounds; ++round) {
+		job.Stats().mcf_loops++;
 		for (NodeID source = 0; source < size; ++source) {
-			this->Dijkstra<CapacityAnnotation, FlowEdgeIterator>(source, paths);
+			sinks.Clear();
 			for (NodeID dest = 0; dest < size; ++dest) {
-				Edge edge = this->job[source][dest];
-				Path *path = paths[dest];
-				if (edge.UnsatisfiedDemand() > 0 && path->GetFreeCapacity() > INT_MIN) {
-					this->PushFlow(edge, path, accuracy, UINT_MAX);
-					if (edge.UnsatisfiedDemand() > 0) demand_left = true;
+				if (job[source][dest].UnsatisfiedDemand() > 0) *sinks.Append() = dest;
+			}
+			if (sinks.Length() == 0) continue;
+
+			this->LoadFlows(flows[source]);
+			for (std::vector<Label>::iterator it = this->labels.begin(); it != this->labels.end(); ++it) {
+				it->potential = 0;
+			}
+			for (uint search = 0; search < searches && sinks.Length() > 0; ++search) {
+				this->Search(source, false);
+				bool pushed = false;
+				for (NodeID *sink = sinks.Begin(); sink != sinks.End();) {
+					Edge edge = job[source][*sink];
+					uint limit = (uint)(((uint64)edge.Demand() * round + rounds - 1) / rounds);
+					uint satisfied = edge.Demand() - edge.UnsatisfiedDemand();
+					uint flow = satisfied < limit ? this->Augment(*sink, limit - satisfied, false) : 0;
+					if (flow > 0) {
+						edge.SatisfyDemand(flow);
+						pushed = true;
+					}
+					if (satisfied + flow >= limit) {
+						sinks.Erase(sink);
+					} else {
+						++sink;
+					}
+				}
+				if (!pushed) break;
+			}
+
+			/* Like MCF1stPass allow any valid path *once* if no demand could be
+			 * assigned at all, so that the second pass has something to work with. */
+			if (round == rounds) {
+				bool searched = false;
+				for (NodeID dest = 0; dest < size; ++dest) {
+					Edge edge = job[source][dest];
+					if (edge.Demand() == 0 || edge.UnsatisfiedDemand() != edge.Demand()) continue;
+					if (!searched) {
+						this->Search(source, true);
+						searched = true;
+					}
+					edge.SatisfyDemand(this->Augment(dest, 1, true));
 				}
 			}
-			this->CleanupPaths(source, paths);
+
+			for (std::vector<Label>::iterator it = this->labels.begin(); it != this->labels.end(); ++it) {
+				it->state = CSS_UNVISITED;
+			}
+			for (std::vector<uint>::iterator it = this->used_arcs.begin(); it != this->used_arcs.end(); ++it) {
+				NodeID from = this->arcs[*it].from;
+				if (this->labels[from].state == CSS_UNVISITED) this->CancelCycles(from);
+			}
+			this->StoreFlows(flows[source]);
+		}
+	}
+
+	for (NodeID source = 0; source < size; ++source) {
+		this->LoadFlows(flows[source]);
+		this->CreatePaths(source);
+	}
+}
+
+/**
+ * Run the first pass of the MCF calculation with the selected solver.
+ * @param job Link graph job to calculate.
+ */
+void MCF1stPassHandler::Run(LinkGraphJob &job) const
+{
+	switch (job.Settings().solver) {
+		case LGS_MIN_COST: {
+			MCFMinCost pass(job);
+			break;
+		}
+		default: {
+			MCF1stPass pass(job);
+			break;
 		}
 	}
 }
@@ -6,8 +6,6 @@
 #include "linkgraphjob_base.h"
 #include <vector>
 
-typedef std::vector<Path *> PathVector;
-
 /**
  * Multi-commodity flow calculating base class.
  */
@@ -18,18 +16,35 @@ protected:
 	 * @param job Link graph job being executed.
 	 */
 	MultiCommodityFlow(LinkGraphJob &job) : job(job),
-			max_saturation(job.Settings().short_path_saturation)
+			max_saturation(job.Settings().short_path_saturation),
+			batch_size(job.Settings().parallel_mcf ? PARALLEL_BATCH_SIZE : 1)
 	{}
 
+	template<class Tannotation>
+	void AllocatePaths(PathVector &paths);
+
 	template<class Tannotation, class Tedge_iterator>
 	void Dijkstra(NodeID from, PathVector &paths);
 
+	template<class Tannotation, class Tedge_iterator>
+	void Dijkstras(NodeID first, uint count, PathVector *paths);
+
 	uint PushFlow(Edge &edge, Path *path, uint accuracy, uint max_saturation);
 
 	void CleanupPaths(NodeID source, PathVector &paths);
 
+	/**
+	 * Number of sources whose paths are searched at once if parallel_mcf is
+	 * set. This must not depend on the number of threads, so that the results
+	 * are the same on all clients.
+	 */
+	static const uint PARALLEL_BATCH_SIZE = 32;
+
 	LinkGraphJob &job;   ///< Job we're working with.
 	uint max_saturation; ///< Maximum saturation for edges.
+	uint batch_size;     ///< Number of sources whose paths are searched before flow is pushed along them.
+
+	template<class Tannotation, class Tedge_iterator> friend class DijkstraBatch;
 };
 
 /**
@@ -49,6 +64,8 @@ protected:
  */
 class MCF1stPass : public MultiCommodityFlow {
 private:
+	PathVector next_hops; ///< Scratch space for summarizing paths by next hop, indexed by node.
+
 	bool EliminateCycles();
 	bool EliminateCycles(PathVector &path, NodeID origin_id, NodeID next_id);
 	void EliminateCycle(PathVector &path, Path *cycle_begin, uint flow);
@@ -69,6 +86,73 @@ public:
 	MCF2ndPass(LinkGraphJob &job);
 };
 
+/**
+ * Alternative first pass of the MCF calculation. The sources take turns in
+ * a number of rounds, each of them searching a min-cost flow for a growing
+ * part of its demand on the capacity left over by the others, with successive
+ * shortest paths and node potentials. As flow of the current source can be
+ * moved to other paths later on no cycle elimination rounds over the whole
+ * graph are needed. Like MCF1stPass the number of path searches is limited by
+ * the accuracy and only capacity up to short_path_saturation is used. The
+ * remaining demand is assigned in the second pass.
+ */
+class MCFMinCost : public MultiCommodityFlow {
+private:
+	/** Edge of the graph with the state of the flow on it. */
+	struct Arc {
+		NodeID from;   ///< Start of the edge.
+		NodeID to;     ///< End of the edge.
+		uint cost;     ///< Cost of a unit of flow, which is the distance plus 1.
+		uint residual; ///< Capacity left on the edge.
+		uint flow;     ///< Flow of the current source on the edge.
+	};
+
+	/** Search state of a node. */
+	struct Label {
+		int64 potential; ///< Potential keeping the reduced costs of the arcs non-negative.
+		int64 distance;  ///< Reduced distance from the source found by the last search.
+		uint pred;       ///< Arc the node has been reached by, or INVALID_ARC.
+		bool reverse;    ///< If that arc has been followed against its direction.
+		byte state;      ///< State of the node in the cycle search.
+	};
+
+	typedef std::vector<std::pair<uint, uint> > ArcFlowVector; ///< Flow of a source per arc.
+
+	static const uint INVALID_ARC = UINT_MAX;
+	static const uint MIN_COST_ROUNDS = 16; ///< Rounds in which the sources take turns.
+
+	std::vector<Arc> arcs;        ///< Edges of the graph, ordered by start node.
+	std::vector<uint> first_out;  ///< First arc starting at each node and an extra entry for the end.
+	std::vector<uint> in_arcs;    ///< Arcs ordered by end node.
+	std::vector<uint> first_in;   ///< First entry of in_arcs ending at each node and an extra entry for the end.
+	std::vector<Label> labels;    ///< Search state of each node.
+	std::vector<uint> used_arcs;  ///< Arcs which have been assigned flow of the current source.
+
+	void Search(NodeID source, bool ignore_capacity);
+	uint Augment(NodeID dest, uint amount, bool ignore_capacity);
+	void CancelCycles(NodeID node);
+	void LoadFlows(const ArcFlowVector &flows);
+	void StoreFlows(ArcFlowVector &flows);
+	void CreatePaths(NodeID source);
+
+public:
+	MCFMinCost(LinkGraphJob &job);
+};
+
+/**
+ * Link graph handler for the first pass of the MCF calculation. Runs the
+ * solver selected in the job's settings.
+ */
+class MCF1stPassHandler : public ComponentHandler {
+public:
+	virtual void Run(LinkGraphJob &job) const;
+
+	/**
+	 * Destructor. Has to be given because of virtual Run().
+	 */
+	virtual ~MCF1stPassHandler() {}
+};
+
 /**
  * Link graph handler for MCF. Creates MultiCommodityFlow instance according to
  * the template parameter.
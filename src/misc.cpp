@@ -28,6 +28,7 @@
 #include "core/pool_type.hpp"
 #include "game/game.hpp"
 #include "linkgraph/linkgraphschedule.h"
+#include "linkgraph/export.h"
 
 
 extern TileIndex _cur_tileloop_tile;
@@ -48,6 +49,7 @@ void InitializeCompanies();
 void InitializeCheats();
 void InitializeNPF();
 void InitializeOldNames();
+void InitializeCargoPackets();
 
 void InitializeGame(uint size_x, uint size_y, bool reset_date, bool reset_settings)
 {
@@ -69,6 +71,7 @@ void InitializeGame(uint size_x, uint size_y, bool reset_date, bool reset_settin
 		InitializeOldNames();
 	}
 
+	StopLinkGraphExport();
 	LinkGraphSchedule::Clear();
 	PoolBase::Clean(PT_NORMAL);
 
@@ -106,6 +109,7 @@ void InitializeGame(uint size_x, uint size_y, bool reset_date, bool reset_settin
 	InitializeAnimatedTiles();
 
 	InitializeEconomy();
+	InitializeCargoPackets();
 
 	ResetObjectToPlace();
 
@@ -60,6 +60,7 @@ enum PacketAdminType {
 	ADMIN_PACKET_SERVER_CMD_NAMES,       ///< The server sends out the names of the DoCommands to the admins.
 	ADMIN_PACKET_SERVER_CMD_LOGGING,     ///< The server gives the admin copies of incoming command packets.
 	ADMIN_PACKET_SERVER_GAMESCRIPT,      ///< The server gives the admin information from the GameScript in JSON.
+	ADMIN_PACKET_SERVER_LINKGRAPH,       ///< The server gives the admin profiling information about a link graph calculation.
 
 	INVALID_ADMIN_PACKET = 0xFF,         ///< An invalid marker for admin packets.
 };
@@ -83,6 +84,7 @@ enum AdminUpdateType {
 	ADMIN_UPDATE_CMD_NAMES,       ///< The admin would like a list of all DoCommand names.
 	ADMIN_UPDATE_CMD_LOGGING,     ///< The admin would like to have DoCommand information.
 	ADMIN_UPDATE_GAMESCRIPT,      ///< The admin would like to have gamescript messages.
+	ADMIN_UPDATE_LINKGRAPH,       ///< The admin would like to have profiling information about link graph calculations.
 	ADMIN_UPDATE_END,             ///< Must ALWAYS be on the end of this list!! (period)
 };
 
@@ -148,6 +150,7 @@ protected:
 	 * uint32  ID relevant to the packet type, e.g.
 	 *          - the client ID for #ADMIN_UPDATE_CLIENT_INFO. Use UINT32_MAX to show all clients.
 	 *          - the company ID for #ADMIN_UPDATE_COMPANY_INFO. Use UINT32_MAX to show all companies.
+	 *          - the link graph ID for #ADMIN_UPDATE_LINKGRAPH. Use UINT32_MAX to show all link graphs.
 	 * @param p The packet that was just received.
 	 * @return The state the network should have.
 	 */
@@ -454,6 +457,35 @@ protected:
 	 */
 	virtual NetworkRecvStatus Receive_SERVER_CMD_LOGGING(Packet *p);
 
+	/**
+	 * Send profiling information about a link graph calculation after it has
+	 * been joined. This is for diagnosing lags only.
+	 *
+	 * NOTICE: Data provided with this packet is not stable and will not be
+	 *         treated as such. The number and order of the handlers may
+	 *         change across different versions / revisions of OpenTTD.
+	 *
+	 * uint16  ID of the link graph.
+	 * uint8   ID of the link graph's cargo.
+	 * uint32  Number of nodes of the link graph.
+	 * uint32  Number of edges of the link graph.
+	 * uint32  Date when the calculation was joined.
+	 * uint32  Number of days the join was postponed by because the calculation wasn't finished in time.
+	 * uint64  Microseconds the calculation waited for a thread.
+	 * uint64  Microseconds the calculation ran.
+	 * uint64  Microseconds the game was blocked waiting for the calculation when joining it.
+	 * uint64  Microseconds the game spent applying the results.
+	 * uint8   Number of handlers the calculation consists of.
+	 * uint64  Microseconds spent in each handler; repeated for each handler.
+	 * uint32  Number of path searches.
+	 * uint32  Number of loops over all sources in the multi-commodity flow passes.
+	 * uint32  Number of cycle elimination rounds.
+	 * uint32  Number of paths allocated for the path searches.
+	 * @param p The packet that was just received.
+	 * @return The state the network should have.
+	 */
+	virtual NetworkRecvStatus Receive_SERVER_LINKGRAPH(Packet *p);
+
 	NetworkRecvStatus HandlePacket(Packet *p);
 public:
 	NetworkRecvStatus CloseConnection(bool error = true);
@@ -24,6 +24,7 @@
 #include "../map_func.h"
 #include "../rev.h"
 #include "../game/game.hpp"
+#include "../linkgraph/linkgraphjob.h"
 
 
 /* This file handles all the admin network commands. */
@@ -54,6 +55,7 @@ static const AdminUpdateFrequency _admin_update_type_frequencies[] = {
 	ADMIN_FREQUENCY_POLL,                                                                                                                                  ///< ADMIN_UPDATE_CMD_NAMES
 	                       ADMIN_FREQUENCY_AUTOMATIC,                                                                                                      ///< ADMIN_UPDATE_CMD_LOGGING
 	                       ADMIN_FREQUENCY_AUTOMATIC,                                                                                                      ///< ADMIN_UPDATE_GAMESCRIPT
+	ADMIN_FREQUENCY_POLL | ADMIN_FREQUENCY_AUTOMATIC,                                                                                                      ///< ADMIN_UPDATE_LINKGRAPH
 };
 /** Sanity check. */
 assert_compile(lengthof(_admin_update_type_frequencies) == ADMIN_UPDATE_END);
@@ -620,6 +622,39 @@ NetworkRecvStatus ServerNetworkAdminSocketHandler::SendCmdLogging(ClientID clien
 	return NETWORK_RECV_STATUS_OKAY;
 }
 
+/**
+ * Send profiling information about a joined link graph calculation.
+ * @param record The profiling record of the calculation.
+ */
+NetworkRecvStatus ServerNetworkAdminSocketHandler::SendLinkGraph(const LinkGraphJobRecord &record)
+{
+	Packet *p = new Packet(ADMIN_PACKET_SERVER_LINKGRAPH);
+
+	const LinkGraphJob::Statistics &stats = record.stats;
+	p->Send_uint16(record.link_graph);
+	p->Send_uint8 (record.cargo);
+	p->Send_uint32(record.nodes);
+	p->Send_uint32(record.edges);
+	p->Send_uint32(record.join_date);
+	p->Send_uint32(record.join_delay);
+	p->Send_uint64(stats.start_time - stats.spawn_time);
+	p->Send_uint64(stats.end_time - stats.start_time);
+	p->Send_uint64(stats.join_time);
+	p->Send_uint64(stats.finalise_time);
+	p->Send_uint8 (LinkGraphSchedule::NUM_HANDLERS);
+	for (uint i = 0; i < LinkGraphSchedule::NUM_HANDLERS; i++) {
+		p->Send_uint64(stats.handler_time[i]);
+	}
+	p->Send_uint32(stats.dijkstras);
+	p->Send_uint32(stats.mcf_loops);
+	p->Send_uint32(stats.cycle_rounds);
+	p->Send_uint32(stats.paths);
+
+	this->SendPacket(p);
+
+	return NETWORK_RECV_STATUS_OKAY;
+}
+
 /***********
  * Receiving functions
  ************/
@@ -735,6 +770,15 @@ NetworkRecvStatus ServerNetworkAdminSocketHandler::Receive_ADMIN_POLL(Packet *p)
 			this->SendCmdNames();
 			break;
 
+		case ADMIN_UPDATE_LINKGRAPH: {
+			/* The admin is requesting the profiling records of the last link graph calculations, oldest first. */
+			const LinkGraphSchedule::RecordList &records = LinkGraphSchedule::Instance()->Records();
+			for (LinkGraphSchedule::RecordList::const_reverse_iterator i = records.rbegin(); i != records.rend(); ++i) {
+				if (d1 == UINT32_MAX || d1 == i->link_graph) this->SendLinkGraph(*i);
+			}
+			break;
+		}
+
 		default:
 			/* An unsupported "poll" update type. */
 			DEBUG(net, 3, "[admin] Not supported poll %d (%d) from '%s' (%s).", type, d1, this->admin_name, this->admin_version);
@@ -961,6 +1005,20 @@ void NetworkAdminCmdLogging(const NetworkClientSocket *owner, const CommandPacke
 	}
 }
 
+/**
+ * Send profiling information about a link graph calculation to the admin network (if they did opt in for the respective update).
+ * @param record The profiling record of the calculation that was just joined.
+ */
+void NetworkAdminLinkGraph(const LinkGraphJobRecord &record)
+{
+	ServerNetworkAdminSocketHandler *as;
+	FOR_ALL_ACTIVE_ADMIN_SOCKETS(as) {
+		if (as->update_frequency[ADMIN_UPDATE_LINKGRAPH] & ADMIN_FREQUENCY_AUTOMATIC) {
+			as->SendLinkGraph(record);
+		}
+	}
+}
+
 /**
  * Send a Welcome packet to all connected admins
  */
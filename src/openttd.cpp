@@ -64,6 +64,7 @@
 
 
 #include "linkgraph/linkgraphschedule.h"
+#include "linkgraph/export.h"
 
 #include <stdarg.h>
 
@@ -299,6 +300,7 @@ static void ShutdownGame()
 	free(_config_file);
 #endif
 
+	StopLinkGraphExport();
 	LinkGraphSchedule::Clear();
 	PoolBase::Clean(PT_ALL);
 
@@ -1395,6 +1397,7 @@ void GameLoop()
 	}
 
 	ProcessAsyncSaveFinish();
+	ProcessLinkGraphExportFinish();
 
 	/* autosave game? */
 	if (_do_autosave) {
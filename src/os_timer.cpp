@@ -11,6 +11,27 @@
 
 #include "stdafx.h"
 
+#if defined(WIN32)
+#include <windows.h>
+
+uint64 ottd_realtime_us()
+{
+	LARGE_INTEGER count, frequency;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&frequency);
+	return count.QuadPart / frequency.QuadPart * 1000000 + count.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart;
+}
+#else
+#include <sys/time.h>
+
+uint64 ottd_realtime_us()
+{
+	struct timeval tim;
+	gettimeofday(&tim, NULL);
+	return (uint64)tim.tv_sec * 1000000 + tim.tv_usec;
+}
+#endif
+
 #undef RDTSC_AVAILABLE
 
 /* rdtsc for MSC_VER, uses simple inline assembly, or _rdtsc
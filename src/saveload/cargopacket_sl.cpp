@@ -71,11 +71,13 @@
 		 * correct and do not need rebuilding. */
 		Vehicle *v;
 		FOR_ALL_VEHICLES(v) v->cargo.InvalidateCache();
+	}
 
-		Station *st;
-		FOR_ALL_STATIONS(st) {
-			for (CargoID c = 0; c < NUM_CARGO; c++) st->goods[c].cargo.InvalidateCache();
-		}
+	/* The merge indices of the stations' cargo lists aren't saved and the
+	 * sources of their packets may have been changed above. */
+	Station *st;
+	FOR_ALL_STATIONS(st) {
+		for (CargoID c = 0; c < NUM_CARGO; c++) st->goods[c].cargo.RebuildIndex();
 	}
 
 	if (IsSavegameVersionBefore(181)) {
@@ -114,6 +116,10 @@ const SaveLoad *GetCargoPacketDesc()
  */
 static void Save_CAPA()
 {
+	/* The ages of the packets in vehicles aren't saved separately. */
+	Vehicle *v;
+	FOR_ALL_VEHICLES(v) v->cargo.ApplyAge();
+
 	CargoPacket *cp;
 
 	FOR_ALL_CARGOPACKETS(cp) {
@@ -15,13 +15,29 @@
 #include "../linkgraph/linkgraphschedule.h"
 #include "../settings_internal.h"
 #include "saveload.h"
+#include <algorithm>
 
 typedef LinkGraph::BaseNode Node;
 typedef LinkGraph::BaseEdge Edge;
 
 const SettingDesc *GetSettingDescription(uint index);
 
+/**
+ * Compare two edges by destination for sorting.
+ * @param a First edge.
+ * @param b Second edge.
+ * @return If the first edge's destination is lower than the second one's.
+ */
+static bool EdgeDestinationLess(const Edge &a, const Edge &b)
+{
+	return a.dest < b.dest;
+}
+
 static uint _num_nodes;
+static uint _num_edges;
+static uint32 _num_flows;
+static uint32 _num_removed;
+static StationID _removed_station;
 
 /**
  * Get a SaveLoad array for a link graph.
@@ -30,9 +46,15 @@ static uint _num_nodes;
 const SaveLoad *GetLinkGraphDesc()
 {
 	static const SaveLoad link_graph_desc[] = {
-	    SLE_CONDVAR(LinkGraph, last_compression, SLE_UINT32, SL_LINKGRAPH_JOB, SL_MAX_VERSION),
-	   SLEG_CONDVAR(_num_nodes,                  SLE_UINT16, SL_LINKGRAPH_JOB, SL_MAX_VERSION),
-	    SLE_CONDVAR(LinkGraph, cargo,            SLE_UINT8,  SL_LINKGRAPH_JOB, SL_MAX_VERSION),
+	    SLE_CONDVAR(LinkGraph, last_compression,    SLE_UINT32, SL_LINKGRAPH_JOB,      SL_MAX_VERSION),
+	   SLEG_CONDVAR(_num_nodes,                     SLE_UINT16, SL_LINKGRAPH_JOB,      SL_MAX_VERSION),
+	    SLE_CONDVAR(LinkGraph, cargo,               SLE_UINT8,  SL_LINKGRAPH_JOB,      SL_MAX_VERSION),
+	    SLE_CONDVAR(LinkGraph, last_calculation,    SLE_INT32,  SL_LINKGRAPH_PRIORITY, SL_MAX_VERSION),
+	    SLE_CONDVAR(LinkGraph, calculated_capacity, SLE_UINT32, SL_LINKGRAPH_PRIORITY, SL_MAX_VERSION),
+	    SLE_CONDVAR(LinkGraph, calculated_usage,    SLE_UINT32, SL_LINKGRAPH_PRIORITY, SL_MAX_VERSION),
+	    SLE_CONDVAR(LinkGraph, calculated_supply,   SLE_UINT32, SL_LINKGRAPH_PRIORITY, SL_MAX_VERSION),
+	    SLE_CONDVAR(LinkGraph, modified,            SLE_BOOL,   SL_LINKGRAPH_PRIORITY, SL_MAX_VERSION),
+	    SLE_CONDVAR(LinkGraph, restructured,        SLE_BOOL,   SL_LINKGRAPH_PRIORITY, SL_MAX_VERSION),
 	    SLE_END()
 	};
 	return link_graph_desc;
@@ -74,6 +96,7 @@ const SaveLoad *GetLinkGraphJobDesc()
 
 		const SaveLoad job_desc[] = {
 			SLE_CONDVAR(LinkGraphJob, join_date,        SLE_UINT32, SL_LINKGRAPH_JOB, SL_MAX_VERSION),
+			SLE_CONDVAR(LinkGraphJob, join_delay,       SLE_INT32,  SL_LINKGRAPH_POSTPONE, SL_MAX_VERSION),
 			SLE_CONDVAR(LinkGraphJob, link_graph.index, SLE_UINT16, SL_LINKGRAPH_JOB, SL_MAX_VERSION),
 			SLE_END()
 		};
@@ -101,31 +124,62 @@ const SaveLoad *GetLinkGraphScheduleDesc()
 	return schedule_desc;
 }
 
-/* Edges and nodes are saved in the correct order, so we don't need to save their ids. */
+/* Nodes are saved in the correct order, so we don't need to save their ids.
+ * Since SL_LINKGRAPH_SPARSE only the real edges of each node are saved, with
+ * their destinations. Before that the full matrix of edges was saved and the
+ * real edges were chained via next_edge. */
 
 /**
  * SaveLoad desc for a link graph node.
  */
 static const SaveLoad _node_desc[] = {
-	 SLE_CONDVAR(Node, supply,      SLE_UINT32, SL_LINKGRAPH_JOB, SL_MAX_VERSION),
-	 SLE_CONDVAR(Node, demand,      SLE_UINT32, SL_LINKGRAPH_JOB, SL_MAX_VERSION),
-	 SLE_CONDVAR(Node, station,     SLE_UINT16, SL_LINKGRAPH_JOB, SL_MAX_VERSION),
-	 SLE_CONDVAR(Node, last_update, SLE_UINT32, SL_LINKGRAPH_JOB, SL_MAX_VERSION),
+	 SLE_CONDVAR(Node, supply,      SLE_UINT32, SL_LINKGRAPH_JOB,    SL_MAX_VERSION),
+	 SLE_CONDVAR(Node, demand,      SLE_UINT32, SL_LINKGRAPH_JOB,    SL_MAX_VERSION),
+	 SLE_CONDVAR(Node, station,     SLE_UINT16, SL_LINKGRAPH_JOB,    SL_MAX_VERSION),
+	 SLE_CONDVAR(Node, xy,          SLE_UINT32, SL_LINKGRAPH_SPARSE, SL_MAX_VERSION),
+	 SLE_CONDVAR(Node, last_update, SLE_UINT32, SL_LINKGRAPH_JOB,    SL_MAX_VERSION),
+	SLEG_CONDVAR(_num_edges,        SLE_UINT16, SL_LINKGRAPH_SPARSE, SL_MAX_VERSION),
 	 SLE_END()
 };
 
 /**
- * SaveLoad desc for a link graph edge.
+ * SaveLoad desc for a link graph edge. Before SL_LINKGRAPH_SPARSE "dest"
+ * actually holds the next_edge of the edge chain.
  */
 static const SaveLoad _edge_desc[] = {
 	 SLE_CONDVAR(Edge, distance,    SLE_UINT32, SL_LINKGRAPH_JOB, SL_MAX_VERSION),
 	 SLE_CONDVAR(Edge, capacity,    SLE_UINT32, SL_LINKGRAPH_JOB, SL_MAX_VERSION),
 	 SLE_CONDVAR(Edge, usage,       SLE_UINT32, SL_LINKGRAPH_JOB, SL_MAX_VERSION),
 	 SLE_CONDVAR(Edge, last_update, SLE_UINT32, SL_LINKGRAPH_JOB, SL_MAX_VERSION),
-	 SLE_CONDVAR(Edge, next_edge,   SLE_UINT16, SL_LINKGRAPH_JOB, SL_MAX_VERSION),
+	 SLE_CONDVAR(Edge, created,     SLE_INT32,  SL_LINKGRAPH_EDGE_CREATED, SL_MAX_VERSION),
+	 SLE_CONDVAR(Edge, dest,        SLE_UINT16, SL_LINKGRAPH_JOB, SL_MAX_VERSION),
 	 SLE_END()
 };
 
+/**
+ * Load the edges of one node from the old matrix format, following the chain
+ * of next_edge to find the real ones.
+ * @param edges Edge vector to be filled.
+ * @param from ID of the node the edges start at.
+ * @param size Size of the link graph.
+ */
+static void Load_LinkGraphEdgeMatrixRow(LinkGraph::EdgeVector &edges, NodeID from, uint size)
+{
+	static LinkGraph::EdgeVector row;
+	row.resize(size);
+	for (NodeID to = 0; to < size; ++to) {
+		SlObject(&row[to], _edge_desc);
+	}
+	for (NodeID to = row[from].dest; to != INVALID_NODE; to = row[to].dest) {
+		if (to >= size || to == from) SlErrorCorrupt("Invalid link graph edge chain");
+		Edge edge = row[to];
+		edge.dest = to;
+		edges.push_back(edge);
+		if (edges.size() >= size) SlErrorCorrupt("Cyclic link graph edge chain");
+	}
+	std::sort(edges.begin(), edges.end(), &EdgeDestinationLess);
+}
+
 /**
  * Save/load a link graph.
  * @param comp Link graph to be saved or loaded.
@@ -135,13 +189,156 @@ void SaveLoad_LinkGraph(LinkGraph &lg)
 	uint size = lg.Size();
 	for (NodeID from = 0; from < size; ++from) {
 		Node *node = &lg.nodes[from];
+		_num_edges = (uint)lg.edges[from].size();
 		SlObject(node, _node_desc);
-		for (NodeID to = 0; to < size; ++to) {
-			SlObject(&lg.edges[from][to], _edge_desc);
+		if (IsSavegameVersionBefore(SL_LINKGRAPH_SPARSE)) {
+			Load_LinkGraphEdgeMatrixRow(lg.edges[from].Mutable(), from, size);
+		} else {
+			/* Only copy shared edges when loading. When saving a job's link
+			 * graph a thread may be reading its edges. */
+			if (_num_edges != lg.edges[from].size()) lg.edges[from].Mutable().resize(_num_edges);
+			const LinkGraph::EdgeVector &edges = lg.edges[from];
+			for (LinkGraph::EdgeVector::const_iterator it = edges.begin(); it != edges.end(); ++it) {
+				SlObject(const_cast<Edge *>(&*it), _edge_desc);
+			}
 		}
 	}
 }
 
+/** A single share of a flow a link graph job has been seeded with. */
+struct PreviousFlowSaveLoad {
+	StationID source; ///< Origin of the flow.
+	StationID via;    ///< Next hop of the flow.
+	uint32 share;     ///< Amount of flow sent via the next hop.
+};
+
+/**
+ * SaveLoad desc for the number of previous flows of a link graph job node.
+ */
+static const SaveLoad _previous_flows_desc[] = {
+	SLEG_CONDVAR(_num_flows, SLE_UINT32, SL_LINKGRAPH_INCREMENTAL, SL_MAX_VERSION),
+	 SLE_END()
+};
+
+/**
+ * SaveLoad desc for a previous flow of a link graph job node.
+ */
+static const SaveLoad _previous_flow_desc[] = {
+	SLE_CONDVAR(PreviousFlowSaveLoad, source, SLE_UINT16, SL_LINKGRAPH_INCREMENTAL, SL_MAX_VERSION),
+	SLE_CONDVAR(PreviousFlowSaveLoad, via,    SLE_UINT16, SL_LINKGRAPH_INCREMENTAL, SL_MAX_VERSION),
+	SLE_CONDVAR(PreviousFlowSaveLoad, share,  SLE_UINT32, SL_LINKGRAPH_INCREMENTAL, SL_MAX_VERSION),
+	SLE_END()
+};
+
+/**
+ * Save the flows an incremental link graph job has been seeded with. Like the
+ * flows of stations they are saved as single shares.
+ * @param lgj Link graph job to be saved.
+ */
+static void Save_LinkGraphJobFlows(LinkGraphJob *lgj)
+{
+	const std::vector<FlowStatMap> &previous = lgj->PreviousFlows();
+	for (NodeID node = 0; node < lgj->Size(); ++node) {
+		_num_flows = 0;
+		if (!previous.empty()) {
+			for (FlowStatMap::const_iterator it(previous[node].begin()); it != previous[node].end(); ++it) {
+				_num_flows += (uint32)it->second.GetShares()->size();
+			}
+		}
+		SlObject(NULL, _previous_flows_desc);
+		if (_num_flows == 0) continue;
+		for (FlowStatMap::const_iterator outer_it(previous[node].begin()); outer_it != previous[node].end(); ++outer_it) {
+			const FlowStat::SharesMap *shares = outer_it->second.GetShares();
+			uint32 sum_shares = 0;
+			PreviousFlowSaveLoad flow;
+			flow.source = outer_it->first;
+			for (FlowStat::SharesMap::const_iterator inner_it(shares->begin()); inner_it != shares->end(); ++inner_it) {
+				flow.via = inner_it->second;
+				flow.share = inner_it->first - sum_shares;
+				sum_shares = inner_it->first;
+				SlObject(&flow, _previous_flow_desc);
+			}
+		}
+	}
+}
+
+/**
+ * Load the flows an incremental link graph job has been seeded with.
+ * @param lgj Link graph job to be loaded.
+ */
+static void Load_LinkGraphJobFlows(LinkGraphJob *lgj)
+{
+	std::vector<FlowStatMap> &previous = lgj->PreviousFlows();
+	if (lgj->Settings().incremental) previous.resize(lgj->Size());
+	if (IsSavegameVersionBefore(SL_LINKGRAPH_INCREMENTAL)) return;
+
+	for (NodeID node = 0; node < lgj->Size(); ++node) {
+		SlObject(NULL, _previous_flows_desc);
+		if (_num_flows > 0 && previous.empty()) SlErrorCorrupt("Previous flows for non-incremental link graph job");
+		PreviousFlowSaveLoad flow;
+		FlowStat *fs = NULL;
+		StationID prev_source = INVALID_STATION;
+		for (uint32 j = 0; j < _num_flows; ++j) {
+			SlObject(&flow, _previous_flow_desc);
+			if (fs == NULL || prev_source != flow.source) {
+				fs = &(previous[node].insert(std::make_pair(flow.source, FlowStat(flow.via, flow.share))).first->second);
+			} else {
+				fs->AppendShare(flow.via, flow.share);
+			}
+			prev_source = flow.source;
+		}
+	}
+}
+
+/**
+ * SaveLoad desc for the stations removed while a link graph job was running.
+ */
+static const SaveLoad _removed_stations_desc[] = {
+	SLEG_CONDVAR(_num_removed, SLE_UINT32, SL_LINKGRAPH_REMOVED_STATIONS, SL_MAX_VERSION),
+	SLE_END()
+};
+
+/**
+ * SaveLoad desc for a station removed while a link graph job was running.
+ */
+static const SaveLoad _removed_station_desc[] = {
+	SLEG_CONDVAR(_removed_station, SLE_UINT16, SL_LINKGRAPH_REMOVED_STATIONS, SL_MAX_VERSION),
+	SLE_END()
+};
+
+/**
+ * Save the stations removed while a link graph job was running. Their IDs may
+ * have been reused already, so they can't be derived from the stations when
+ * the job is finalised.
+ * @param lgj Link graph job to be saved.
+ */
+static void Save_LinkGraphJobRemovedStations(LinkGraphJob *lgj)
+{
+	SmallVector<StationID, 4> &removed = lgj->RemovedStations();
+	_num_removed = removed.Length();
+	SlObject(NULL, _removed_stations_desc);
+	for (const StationID *station = removed.Begin(); station != removed.End(); ++station) {
+		_removed_station = *station;
+		SlObject(NULL, _removed_station_desc);
+	}
+}
+
+/**
+ * Load the stations removed while a link graph job was running.
+ * @param lgj Link graph job to be loaded.
+ */
+static void Load_LinkGraphJobRemovedStations(LinkGraphJob *lgj)
+{
+	if (IsSavegameVersionBefore(SL_LINKGRAPH_REMOVED_STATIONS)) return;
+
+	SmallVector<StationID, 4> &removed = lgj->RemovedStations();
+	SlObject(NULL, _removed_stations_desc);
+	for (uint32 i = 0; i < _num_removed; ++i) {
+		SlObject(NULL, _removed_station_desc);
+		*removed.Append() = _removed_station;
+	}
+}
+
 /**
  * Save a link graph job.
  * @param lgj LinkGraphJob to be saved.
@@ -152,6 +349,8 @@ static void DoSave_LGRJ(LinkGraphJob *lgj)
 	_num_nodes = lgj->Size();
 	SlObject(const_cast<LinkGraph *>(&lgj->Graph()), GetLinkGraphDesc());
 	SaveLoad_LinkGraph(const_cast<LinkGraph &>(lgj->Graph()));
+	Save_LinkGraphJobFlows(lgj);
+	Save_LinkGraphJobRemovedStations(lgj);
 }
 
 /**
@@ -200,6 +399,8 @@ static void Load_LGRJ()
 		SlObject(&lg, GetLinkGraphDesc());
 		lg.Init(_num_nodes);
 		SaveLoad_LinkGraph(lg);
+		Load_LinkGraphJobFlows(lgj);
+		Load_LinkGraphJobRemovedStations(lgj);
 	}
 }
 
@@ -211,12 +412,33 @@ static void Load_LGRS()
 	SlObject(LinkGraphSchedule::Instance(), GetLinkGraphScheduleDesc());
 }
 
+/**
+ * Set the locations of all nodes in a link graph from their stations. Nodes
+ * of removed stations are put at tile 0 as their location is unknown.
+ * @param lg Link graph to be updated.
+ */
+static void UpdateLinkGraphLocations(LinkGraph &lg)
+{
+	for (NodeID node = 0; node < lg.Size(); ++node) {
+		const Station *st = Station::GetIfValid(lg[node].Station());
+		lg[node].UpdateLocation(st == NULL ? 0 : st->xy);
+	}
+}
+
 /**
  * Spawn the threads for running link graph calculations.
  * Has to be done after loading as the cargo classes might have changed.
  */
 void AfterLoadLinkGraphs()
 {
+	if (IsSavegameVersionBefore(SL_LINKGRAPH_SPARSE)) {
+		LinkGraph *lg;
+		FOR_ALL_LINK_GRAPHS(lg) UpdateLinkGraphLocations(*lg);
+
+		LinkGraphJob *lgj;
+		FOR_ALL_LINK_GRAPH_JOBS(lgj) UpdateLinkGraphLocations(const_cast<LinkGraph &>(lgj->Graph()));
+	}
+
 	LinkGraphSchedule::Instance()->SpawnAll();
 }
 
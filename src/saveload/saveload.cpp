@@ -247,7 +247,7 @@
  *  180   24998   1.3.x
  *  181   25012
  */
-extern const uint16 SAVEGAME_VERSION = SL_EXT_RATING; ///< Current savegame version of OpenTTD.
+extern const uint16 SAVEGAME_VERSION = SL_LINKGRAPH_REMOVED_STATIONS; ///< Current savegame version of OpenTTD.
 
 SavegameType _savegame_type; ///< type of savegame we are loading
 
@@ -557,6 +557,19 @@ enum SaveLoadVersions {
 	SL_FLOWS,
 	SL_CARGOMAP,
 	SL_EXT_RATING,
+	SL_LINKGRAPH_SPARSE,
+	SL_LINKGRAPH_RECALC_JOBS,
+	SL_LINKGRAPH_PARALLEL_MCF,
+	SL_LINKGRAPH_INCREMENTAL,
+	SL_LINKGRAPH_POSTPONE,
+	SL_LINKGRAPH_DEMAND_MODE,
+	SL_LINKGRAPH_SOLVER,
+	SL_LINKGRAPH_MEMORY_BUDGET,
+	SL_LINKGRAPH_PRIORITY,
+	SL_CARGO_MERGE_TOLERANCE,
+	SL_PARALLEL_LOADING,
+	SL_LINKGRAPH_EDGE_CREATED,
+	SL_LINKGRAPH_REMOVED_STATIONS,
 
 	/** Highest possible savegame version. */
 	SL_MAX_VERSION = 255
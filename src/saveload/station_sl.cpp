@@ -469,11 +469,12 @@ static void RealSave_STNN(BaseStation *bst)
 		for (CargoID i = 0; i < NUM_CARGO; i++) {
 			_num_dests = (uint32)st->goods[i].cargo.Packets()->MapSize();
 			_num_flows = 0;
-			for (FlowStatMap::const_iterator it(st->goods[i].flows.begin()); it != st->goods[i].flows.end(); ++it) {
+			const FlowStatMap &flows = st->goods[i].flows;
+			for (FlowStatMap::const_iterator it(flows.begin()); it != flows.end(); ++it) {
 				_num_flows += (uint32)it->second.GetShares()->size();
 			}
 			SlObject(&st->goods[i], GetGoodsDesc());
-			for (FlowStatMap::const_iterator outer_it(st->goods[i].flows.begin()); outer_it != st->goods[i].flows.end(); ++outer_it) {
+			for (FlowStatMap::const_iterator outer_it(flows.begin()); outer_it != flows.end(); ++outer_it) {
 				const FlowStat::SharesMap *shares = outer_it->second.GetShares();
 				uint32 sum_shares = 0;
 				FlowSaveLoad flow;
@@ -559,6 +559,32 @@ static uint16 _cargo_count;
 static uint16 _cargo_paid_for;
 static Money  _cargo_feeder_share;
 static uint32 _cargo_loaded_at_xy;
+static std::list<CargoPacket *> _cargo_packets; ///< Cargo packets of the vehicle being saved or loaded, as only std::lists can be saved.
+
+/**
+ * Copy the cargo packets of a vehicle to _cargo_packets for saving them.
+ * @param v Vehicle whose packets are to be copied.
+ */
+static void CopyCargoPacketsToTemp(const Vehicle *v)
+{
+	const CargoPacketList *packets = v->cargo.Packets();
+	_cargo_packets.assign(packets->begin(), packets->end());
+}
+
+/**
+ * Replace the cargo packets of a vehicle with the loaded ones in _cargo_packets.
+ * @param v Vehicle whose packets are to be replaced.
+ */
+static void CopyCargoPacketsFromTemp(Vehicle *v)
+{
+	CargoPacketList &packets = const_cast<CargoPacketList &>(*v->cargo.Packets());
+	packets.clear();
+	packets.reserve((uint)_cargo_packets.size());
+	for (std::list<CargoPacket *>::const_iterator it = _cargo_packets.begin(); it != _cargo_packets.end(); ++it) {
+		packets.push_back(*it);
+	}
+	_cargo_packets.clear();
+}
 
 /**
  * Make it possible to make the saveload tables "friends" of other classes.
@@ -615,7 +641,7 @@ const SaveLoad *GetVehicleDescription(VehicleType vt)
 		     SLE_VAR(Vehicle, cargo_cap,             SLE_UINT16),
 		 SLE_CONDVAR(Vehicle, refit_cap,             SLE_UINT16,       SL_CAPACITIES, SL_MAX_VERSION),
 		SLEG_CONDVAR(         _cargo_count,          SLE_UINT16,                   0,  67),
-		 SLE_CONDLST(Vehicle, cargo.packets,         REF_CARGO_PACKET,            68, SL_MAX_VERSION),
+		SLEG_CONDLST(         _cargo_packets,        REF_CARGO_PACKET,            68, SL_MAX_VERSION),
 		 SLE_CONDARR(Vehicle, cargo.action_counts,   SLE_UINT, VehicleCargoList::NUM_MOVE_TO_ACTION, 181, SL_MAX_VERSION),
 		 SLE_CONDVAR(Vehicle, cargo_age_counter,     SLE_UINT16,                 162, SL_MAX_VERSION),
 
@@ -866,8 +892,10 @@ static void Save_VEHS()
 	/* Write the vehicles */
 	FOR_ALL_VEHICLES(v) {
 		SlSetArrayIndex(v->index);
+		CopyCargoPacketsToTemp(v);
 		SlObject(v, GetVehicleDescription(v->type));
 	}
+	_cargo_packets.clear();
 }
 
 /** Will be called when vehicles need to be loaded. */
@@ -892,7 +920,9 @@ void Load_VEHS()
 			default: SlErrorCorrupt("Invalid vehicle type");
 		}
 
+		_cargo_packets.clear();
 		SlObject(v, GetVehicleDescription(vtype));
+		CopyCargoPacketsFromTemp(v);
 
 		if (_cargo_count != 0 && IsCompanyBuildableVehicleType(v) && CargoPacket::CanAllocateItem()) {
 			/* Don't construct the packet with station here, because that'll fail with old savegames */
@@ -923,7 +953,9 @@ static void Ptrs_VEHS()
 {
 	Vehicle *v;
 	FOR_ALL_VEHICLES(v) {
+		CopyCargoPacketsToTemp(v);
 		SlObject(v, GetVehicleDescription(v->type));
+		CopyCargoPacketsFromTemp(v);
 	}
 }
 
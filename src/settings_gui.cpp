@@ -1538,6 +1538,7 @@ static SettingsPage _settings_construction_page = {_settings_construction, lengt
 static SettingEntry _settings_stations_cargo[] = {
 	SettingEntry("order.improved_load"),
 	SettingEntry("order.gradual_loading"),
+	SettingEntry("order.parallel_loading"),
 	SettingEntry("order.selectgoods"),
 };
 /** Cargo handling sub-page */
@@ -1594,6 +1595,7 @@ static SettingEntry _settings_economy[] = {
 	SettingEntry("difficulty.economy"),
 	SettingEntry("economy.smooth_economy"),
 	SettingEntry("economy.feeder_payment_share"),
+	SettingEntry("economy.cargo_merge_tolerance"),
 	SettingEntry("economy.infrastructure_maintenance"),
 	SettingEntry("difficulty.vehicle_costs"),
 	SettingEntry("difficulty.construction_cost"),
@@ -1605,14 +1607,23 @@ static SettingsPage _settings_economy_page = {_settings_economy, lengthof(_setti
 static SettingEntry _settings_linkgraph[] = {
 	SettingEntry("linkgraph.recalc_time"),
 	SettingEntry("linkgraph.recalc_interval"),
+	SettingEntry("linkgraph.recalc_jobs"),
 	SettingEntry("linkgraph.distribution_pax"),
 	SettingEntry("linkgraph.distribution_mail"),
 	SettingEntry("linkgraph.distribution_armoured"),
 	SettingEntry("linkgraph.distribution_default"),
+	SettingEntry("linkgraph.demand_mode_pax"),
+	SettingEntry("linkgraph.demand_mode_mail"),
+	SettingEntry("linkgraph.demand_mode_armoured"),
+	SettingEntry("linkgraph.demand_mode_default"),
 	SettingEntry("linkgraph.accuracy"),
 	SettingEntry("linkgraph.demand_distance"),
 	SettingEntry("linkgraph.demand_size"),
 	SettingEntry("linkgraph.short_path_saturation"),
+	SettingEntry("linkgraph.parallel_mcf"),
+	SettingEntry("linkgraph.incremental"),
+	SettingEntry("linkgraph.solver"),
+	SettingEntry("linkgraph.memory_budget"),
 };
 /** Linkgraph sub-page */
 static SettingsPage _settings_linkgraph_page = {_settings_linkgraph, lengthof(_settings_linkgraph)};
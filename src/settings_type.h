@@ -103,6 +103,8 @@ struct GUISettings {
 	bool   disable_unsuitable_building;      ///< disable infrastructure building when no suitable vehicles are available
 	byte   autosave;                         ///< how often should we do autosaves?
 	bool   threaded_saves;                   ///< should we do threaded saves?
+	uint8  linkgraph_threads;                ///< number of worker threads for link graph jobs, 0 for one per CPU core
+	uint8  loading_threads;                  ///< number of threads for loading and unloading in parallel, 0 for one per CPU core
 	bool   keep_all_autosave;                ///< name the autosave in a different way
 	bool   autosave_on_exit;                 ///< save an autosave when you quit the game, but do not ask "Do you really want to quit?"
 	uint8  date_format_in_default_names;     ///< should the default savegame/screenshot name use long dates (31th Dec 2008), short dates (31-12-2008) or ISO dates (2008-12-31)
@@ -429,6 +431,7 @@ struct PathfinderSettings {
 struct OrderSettings {
 	bool   improved_load;                    ///< improved loading algorithm
 	bool   gradual_loading;                  ///< load vehicles gradually
+	bool   parallel_loading;                 ///< load and unload at several stations at once
 	bool   selectgoods;                      ///< only send the goods to station if a train has been there
 	bool   no_servicing_if_no_breakdowns;    ///< don't send vehicles to depot when breakdowns are disabled
 	bool   serviceathelipad;                 ///< service helicopters at helipads automatically (no need to send to depot)
@@ -464,6 +467,7 @@ struct EconomySettings {
 	bool   smooth_economy;                   ///< smooth economy
 	bool   allow_shares;                     ///< allow the buying/selling of shares
 	uint8  feeder_payment_share;             ///< percentage of leg payment to virtually pay in feeder systems
+	uint8  cargo_merge_tolerance;            ///< difference in days in transit up to which cargo packets are merged when compacting
 	byte   dist_local_authority;             ///< distance for town local authority, default 20
 	bool   exclusive_rights;                 ///< allow buying exclusive rights
 	bool   fund_buildings;                   ///< allow funding new buildings
@@ -486,14 +490,23 @@ struct EconomySettings {
 struct LinkGraphSettings {
 	uint16 recalc_time;                         ///< time (in days) for recalculating each link graph component.
 	uint16 recalc_interval;                     ///< time (in days) between subsequent checks for link graphs to be calculated.
+	uint8 recalc_jobs;                          ///< number of link graph components to be recalculated at once.
 	DistributionTypeByte distribution_pax;      ///< distribution type for passengers
 	DistributionTypeByte distribution_mail;     ///< distribution type for mail
 	DistributionTypeByte distribution_armoured; ///< distribution type for armoured cargo class
 	DistributionTypeByte distribution_default;  ///< distribution type for all other goods
+	DemandModeByte demand_mode_pax;             ///< demand calculation mode for passengers
+	DemandModeByte demand_mode_mail;            ///< demand calculation mode for mail
+	DemandModeByte demand_mode_armoured;        ///< demand calculation mode for armoured cargo class
+	DemandModeByte demand_mode_default;         ///< demand calculation mode for all other goods
 	uint8 accuracy;                             ///< accuracy when calculating things on the link graph. low accuracy => low running time
 	uint8 demand_size;                          ///< influence of supply ("station size") on the demand function
 	uint8 demand_distance;                      ///< influence of distance between stations on the demand function
 	uint8 short_path_saturation;                ///< percentage up to which short paths are saturated before saturating most capacious paths
+	bool parallel_mcf;                          ///< calculate the paths for multiple sources at once in the MCF passes
+	bool incremental;                           ///< reuse the flows of unaffected origins from the previous calculation
+	LinkGraphSolverByte solver;                 ///< algorithm for the first pass of the flow calculation
+	uint16 memory_budget;                       ///< estimated memory running jobs may use before new ones are deferred, in MiB; 0 for unlimited
 
 	inline DistributionType GetDistributionType(CargoID cargo) const {
 		if (IsCargoInClass(cargo, CC_PASSENGERS)) return this->distribution_pax;
@@ -501,6 +514,13 @@ struct LinkGraphSettings {
 		if (IsCargoInClass(cargo, CC_ARMOURED)) return this->distribution_armoured;
 		return this->distribution_default;
 	}
+
+	inline DemandMode GetDemandMode(CargoID cargo) const {
+		if (IsCargoInClass(cargo, CC_PASSENGERS)) return this->demand_mode_pax;
+		if (IsCargoInClass(cargo, CC_MAIL)) return this->demand_mode_mail;
+		if (IsCargoInClass(cargo, CC_ARMOURED)) return this->demand_mode_armoured;
+		return this->demand_mode_default;
+	}
 };
 
 /** Settings related to stations. */
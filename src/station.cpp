@@ -24,7 +24,7 @@
 #include "roadstop_base.h"
 #include "industry.h"
 #include "core/random_func.hpp"
-#include "linkgraph/linkgraphschedule.h"
+#include "linkgraph/linkgraphjob.h"
 
 #include "table/strings.h"
 
@@ -89,6 +89,13 @@ Station::~Station()
 		if (a->targetairport == this->index) a->targetairport = INVALID_STATION;
 	}
 
+	/* Running link graph jobs still know this station and have to purge it
+	 * from their results later. */
+	LinkGraphJob *lgj;
+	FOR_ALL_LINK_GRAPH_JOBS(lgj) {
+		if (this->goods[lgj->Cargo()].link_graph != INVALID_LINK_GRAPH) lgj->RemoveStation(this->index);
+	}
+
 	for (CargoID c = 0; c < NUM_CARGO; ++c) {
 		LinkGraph *lg = LinkGraph::GetIfValid(this->goods[c].link_graph);
 		if (lg != NULL) {
@@ -19,7 +19,8 @@
 #include "industry_type.h"
 #include "linkgraph/linkgraph_type.h"
 #include "newgrf_storage.h"
-#include <map>
+#include <vector>
+#include <algorithm>
 
 typedef Pool<BaseStation, StationID, 32, 64000> StationPool;
 extern StationPool _station_pool;
@@ -28,21 +29,26 @@ static const byte INITIAL_STATION_RATING = 175;
 
 /**
  * Flow statistics telling how much flow should be sent along a link. This is
- * done by creating "flow shares" and using std::map's upper_bound() method to
+ * done by creating "flow shares" and using upper_bound() to
  * look them up with a random number. A flow share is the difference between a
  * key in a map and the previous key. So one key in the map doesn't actually
  * mean anything by itself.
  */
 class FlowStat {
 public:
-	typedef std::map<uint32, StationID> SharesMap;
+	/**
+	 * Cumulative shares and the stations they lead to, sorted by share. This
+	 * is a flat vector instead of a map as it's searched far more often than
+	 * it's changed and binary search in contiguous memory is faster.
+	 */
+	typedef std::vector<std::pair<uint32, StationID> > SharesMap;
 
 	inline FlowStat() {NOT_REACHED();}
 
 	inline FlowStat(StationID st, uint flow)
 	{
 		assert(flow > 0);
-		this->shares[flow] = st;
+		this->shares.push_back(std::make_pair(flow, st));
 	}
 
 	/**
@@ -55,7 +61,7 @@ public:
 	inline void AppendShare(StationID st, uint flow)
 	{
 		assert(flow > 0);
-		this->shares[(--this->shares.end())->first + flow] = st;
+		this->shares.push_back(std::make_pair(this->shares.back().first + flow, st));
 	}
 
 	uint GetShare(StationID st) const;
@@ -67,29 +73,229 @@ public:
 	/**
 	 * Get a station a package can be routed to. This done by drawing a
 	 * random number between 0 and sum_shares and then looking that up in
-	 * the map with lower_bound. So each share gets selected with a
+	 * the map with upper_bound. So each share gets selected with a
 	 * probability dependent on its flow.
 	 * @return A station ID from the shares map.
 	 */
 	inline StationID GetVia() const
 	{
 		assert(!this->shares.empty());
-		return this->shares.upper_bound(RandomRange((--this->shares.end())->first - 1))->second;
+		return this->UpperBound(RandomRange(this->shares.back().first - 1))->second;
 	}
 
 	StationID GetVia(StationID excluded, StationID excluded2 = INVALID_STATION) const;
 
 private:
 	SharesMap shares;  ///< Shares of flow to be sent via specified station (or consumed locally).
+
+	/**
+	 * Compare a value with the cumulative share of an entry in the shares map.
+	 * @param share Value to be compared.
+	 * @param entry Entry to be compared with.
+	 * @return If the value is smaller than the entry's cumulative share.
+	 */
+	static inline bool ShareLess(uint32 share, const SharesMap::value_type &entry)
+	{
+		return share < entry.first;
+	}
+
+	/**
+	 * Find the first share whose cumulative value is greater than the given one.
+	 * @param share Value to look for.
+	 * @return Iterator pointing to the share or to the end of the map.
+	 */
+	inline SharesMap::const_iterator UpperBound(uint32 share) const
+	{
+		return std::upper_bound(this->shares.begin(), this->shares.end(), share, &FlowStat::ShareLess);
+	}
 };
 
-/** Flow descriptions by origin stations. */
-class FlowStatMap : public std::map<StationID, FlowStat> {
+/**
+ * Flow descriptions by origin stations. The flows are looked up for every
+ * cargo packet being loaded or rerouted. So they're kept in a flat vector,
+ * indexed by an open addressing hash table with linear probing. The vector
+ * is iterated in the order the flows were inserted in, except that erasing
+ * a flow moves the last one into its place. So the order only depends on
+ * the operations done on the map, not on the state of the hash table, and
+ * is preserved by saving and loading.
+ *
+ * Copying a map only copies a reference to the flows. They are copied when
+ * they're about to be modified while being shared ("copy on write"), which
+ * includes getting non-const iterators. Maps with shared flows are only
+ * copied and deleted in the main thread, so the reference counts don't have
+ * to be synchronized. Other threads may read their copies while the main
+ * thread modifies its own.
+ */
+class FlowStatMap {
 public:
+	typedef std::pair<StationID, FlowStat> value_type;
+	typedef std::vector<value_type>::iterator iterator;
+	typedef std::vector<value_type>::const_iterator const_iterator;
+
+	/** Create a map without flows. */
+	FlowStatMap() : data(NULL) {}
+
+	/**
+	 * Share the flows of another map.
+	 * @param other Map whose flows are to be shared.
+	 */
+	FlowStatMap(const FlowStatMap &other) : data(other.data)
+	{
+		if (this->data != NULL) ++this->data->refs;
+	}
+
+	/** Release the flows and delete them if they aren't shared anymore. */
+	~FlowStatMap() { this->Release(); }
+
+	/**
+	 * Release the current flows and share the ones of another map.
+	 * @param other Map whose flows are to be shared.
+	 * @return This map.
+	 */
+	FlowStatMap &operator=(const FlowStatMap &other)
+	{
+		if (other.data != NULL) ++other.data->refs;
+		this->Release();
+		this->data = other.data;
+		return *this;
+	}
+
+	/** Get an iterator to the first flow. */
+	inline iterator begin() { return this->data == NULL ? FlowStatMap::no_entries.begin() : this->Mutable().entries.begin(); }
+	/** Get an iterator to the first flow. */
+	inline const_iterator begin() const { return this->Entries().begin(); }
+	/** Get an iterator beyond the last flow. */
+	inline iterator end() { return this->data == NULL ? FlowStatMap::no_entries.end() : this->Mutable().entries.end(); }
+	/** Get an iterator beyond the last flow. */
+	inline const_iterator end() const { return this->Entries().end(); }
+	/** Get the number of origins with flows. */
+	inline size_t size() const { return this->Entries().size(); }
+	/** Check if there are no flows. */
+	inline bool empty() const { return this->Entries().empty(); }
+
+	/**
+	 * Find the flow of an origin.
+	 * @param origin Origin station.
+	 * @return Iterator to the flow or end() if there is none.
+	 */
+	inline iterator find(StationID origin)
+	{
+		if (this->data == NULL || this->data->index.empty()) return this->end();
+		uint16 entry = this->data->index[this->FindSlot(origin)];
+		return entry == 0 ? this->end() : this->begin() + (entry - 1);
+	}
+
+	/**
+	 * Find the flow of an origin.
+	 * @param origin Origin station.
+	 * @return Iterator to the flow or end() if there is none.
+	 */
+	inline const_iterator find(StationID origin) const
+	{
+		if (this->data == NULL || this->data->index.empty()) return this->end();
+		uint16 entry = this->data->index[this->FindSlot(origin)];
+		return entry == 0 ? this->end() : this->begin() + (entry - 1);
+	}
+
+	/** Remove all flows. */
+	inline void clear()
+	{
+		this->Release();
+		this->data = NULL;
+	}
+
+	/**
+	 * Exchange the flows with another map.
+	 * @param other Map to exchange the flows with.
+	 */
+	inline void swap(FlowStatMap &other) { Swap(this->data, other.data); }
+
+	std::pair<iterator, bool> insert(const value_type &value);
+	iterator erase(iterator it);
+
 	void AddFlow(StationID origin, StationID via, uint amount);
 	void PassOnFlow(StationID origin, StationID via, uint amount);
 	void DeleteFlows(StationID via);
 	void FinalizeLocalConsumption(StationID self);
+	size_t MemoryUsage() const;
+
+private:
+	static const uint MIN_INDEX_SIZE = 8; ///< Size of the hash table when the first flow is inserted.
+
+	/** Flows of a map, possibly shared with copies of it. */
+	struct Data {
+		uint refs;                       ///< Number of maps referring to these flows.
+		std::vector<value_type> entries; ///< Flows and their origins.
+		std::vector<uint16> index;       ///< Hash table of positions in entries plus 1, or 0 for empty slots. Its size is a power of 2.
+
+		Data() : refs(1) {}
+	};
+
+	static std::vector<value_type> no_entries; ///< Entries of maps without flows. Always empty.
+
+	Data *data; ///< Flows of the map or NULL if it never had any.
+
+	/**
+	 * Get the flows for reading.
+	 * @return Flows and their origins.
+	 */
+	inline const std::vector<value_type> &Entries() const
+	{
+		return this->data == NULL ? FlowStatMap::no_entries : this->data->entries;
+	}
+
+	/**
+	 * Get the flows for modification, creating them if there are none and
+	 * copying them if they're shared.
+	 * @return Flows which aren't shared with any other map.
+	 */
+	inline Data &Mutable()
+	{
+		if (this->data == NULL) {
+			this->data = new Data;
+		} else if (this->data->refs > 1) {
+			Data *copy = new Data(*this->data);
+			copy->refs = 1;
+			--this->data->refs;
+			this->data = copy;
+		}
+		return *this->data;
+	}
+
+	/** Release the flows and delete them if they aren't shared anymore. */
+	inline void Release()
+	{
+		if (this->data != NULL && --this->data->refs == 0) delete this->data;
+	}
+
+	/**
+	 * Get the slot of the hash table where probing for an origin starts.
+	 * @param origin Origin station.
+	 * @return Slot.
+	 */
+	inline uint HomeSlot(StationID origin) const
+	{
+		return ((origin * 2654435761U) >> 15) & (uint)(this->data->index.size() - 1);
+	}
+
+	/**
+	 * Find the slot of the hash table holding an origin or the empty slot
+	 * where it would be inserted. The table must not be empty.
+	 * @param origin Origin station.
+	 * @return Slot.
+	 */
+	inline uint FindSlot(StationID origin) const
+	{
+		const std::vector<uint16> &index = this->data->index;
+		uint mask = (uint)index.size() - 1;
+		uint slot = this->HomeSlot(origin);
+		while (index[slot] != 0 && this->data->entries[index[slot] - 1].first != origin) {
+			slot = (slot + 1) & mask;
+		}
+		return slot;
+	}
+
+	void Rehash(uint size);
 };
 
 /**
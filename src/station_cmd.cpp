@@ -3387,11 +3387,11 @@ void DeleteStaleLinks(Station *from)
 			if (to->goods[c].link_graph != ge.link_graph) {
 				ge.cargo.Reroute(UINT_MAX, &ge.cargo, from->index, to->index, &ge);
 			} else {
-				Edge edge = (*lg)[ge.node][to->goods[c].node];
-				if (edge.LastUpdate() == INVALID_DATE ||
-						(uint)(_date - edge.LastUpdate()) > LinkGraph::MIN_TIMEOUT_DISTANCE +
+				Node node = (*lg)[ge.node];
+				if (!node.HasEdgeTo(to->goods[c].node) ||
+						(uint)(_date - node[to->goods[c].node].LastUpdate()) > LinkGraph::MIN_TIMEOUT_DISTANCE +
 						(DistanceManhattan(from->xy, to->xy) >> 2)) {
-					(*lg)[ge.node].RemoveEdge(to->goods[c].node);
+					node.RemoveEdge(to->goods[c].node);
 					ge.cargo.Reroute(UINT_MAX, &ge.cargo, from->index, to->index, &ge);
 				}
 			}
@@ -4030,8 +4030,8 @@ uint FlowStat::GetShare(StationID st) const
 StationID FlowStat::GetVia(StationID excluded, StationID excluded2) const
 {
 	assert(!this->shares.empty());
-	uint max = (--this->shares.end())->first - 1;
-	SharesMap::const_iterator it = this->shares.upper_bound(RandomRange(max));
+	uint max = this->shares.back().first - 1;
+	SharesMap::const_iterator it = this->UpperBound(RandomRange(max));
 	assert(it != this->shares.end());
 	if (it->second != excluded && it->second != excluded2) return it->second;
 
@@ -4044,8 +4044,8 @@ StationID FlowStat::GetVia(StationID excluded, StationID excluded2) const
 	if (interval > max) return INVALID_STATION; // Only one station in the map.
 	uint new_max = max - interval;
 	uint rand = RandomRange(new_max);
-	SharesMap::const_iterator it2 = (rand < begin) ? this->shares.upper_bound(rand) :
-			this->shares.upper_bound(rand + interval);
+	SharesMap::const_iterator it2 = (rand < begin) ? this->UpperBound(rand) :
+			this->UpperBound(rand + interval);
 	if (it2->second != excluded && it2->second != excluded2) return it2->second;
 
 	/* We've hit the second excluded station.
@@ -4063,11 +4063,11 @@ StationID FlowStat::GetVia(StationID excluded, StationID excluded2) const
 	}
 	rand = RandomRange(new_max);
 	if (rand < begin) {
-		return this->shares.upper_bound(rand)->second;
+		return this->UpperBound(rand)->second;
 	} else if (rand < begin2 - interval) {
-		return this->shares.upper_bound(rand + interval)->second;
+		return this->UpperBound(rand + interval)->second;
 	} else {
-		return this->shares.upper_bound(rand + interval + interval2)->second;
+		return this->UpperBound(rand + interval + interval2)->second;
 	}
 
 }
@@ -4084,28 +4084,102 @@ void FlowStat::ChangeShare(StationID st, int flow)
 	 * be empty. In that case the whole flow stat must be deleted then. */
 	assert(!this->shares.empty());
 
-	int32 added_shares = 0;
 	uint32 last_share = 0;
-	SharesMap new_shares;
 	for (SharesMap::iterator it(this->shares.begin()); it != this->shares.end(); ++it) {
-		if (it->second == st) {
-			uint share = it->first - last_share;
-			int change = flow - added_shares;
-			uint new_share = (change < 0 && (uint)(-change) > share) ? 0 : share + change;
-			added_shares -= share;
-			added_shares += new_share;
-			if (new_share > 0) {
-				new_shares[it->first + added_shares] = it->second;
-			}
+		if (it->second != st) {
+			last_share = it->first;
+			continue;
+		}
+
+		/* Each station appears only once. Change its share and shift the
+		 * cumulative shares of all following stations accordingly. */
+		uint share = it->first - last_share;
+		uint new_share = (flow < 0 && (uint)(-flow) > share) ? 0 : share + flow;
+		int32 added_shares = new_share - share;
+		if (new_share > 0) {
+			it->first += added_shares;
+			++it;
 		} else {
-			new_shares[it->first + added_shares] = it->second;
+			it = this->shares.erase(it);
+		}
+		for (; it != this->shares.end(); ++it) it->first += added_shares;
+		return;
+	}
+	if (flow > 0) {
+		this->shares.push_back(std::make_pair(last_share + flow, st));
+	}
+}
+
+/* static */ std::vector<FlowStatMap::value_type> FlowStatMap::no_entries;
+
+/**
+ * Rebuild the hash table with the given size.
+ * @param size New size of the hash table. Has to be a power of 2.
+ */
+void FlowStatMap::Rehash(uint size)
+{
+	Data &data = this->Mutable();
+	assert(size > data.entries.size() && (size & (size - 1)) == 0);
+	data.index.assign(size, 0);
+	for (uint i = 0; i < data.entries.size(); ++i) {
+		data.index[this->FindSlot(data.entries[i].first)] = i + 1;
+	}
+}
+
+/**
+ * Insert a flow for an origin which doesn't have one, yet. The hash table is
+ * kept at most half full.
+ * @param value Origin and flow.
+ * @return Iterator to the flow of the origin and if it has been inserted. If
+ *         the origin already had a flow it isn't changed.
+ */
+std::pair<FlowStatMap::iterator, bool> FlowStatMap::insert(const value_type &value)
+{
+	Data &data = this->Mutable();
+	if ((data.entries.size() + 1) * 2 > data.index.size()) {
+		this->Rehash(max<uint>(MIN_INDEX_SIZE, (uint)data.index.size() * 2));
+	}
+	uint slot = this->FindSlot(value.first);
+	if (data.index[slot] != 0) return std::make_pair(data.entries.begin() + (data.index[slot] - 1), false);
+
+	assert(data.entries.size() < UINT16_MAX);
+	data.entries.push_back(value);
+	data.index[slot] = (uint16)data.entries.size();
+	return std::make_pair(data.entries.end() - 1, true);
+}
+
+/**
+ * Erase a flow. The last flow is moved into its place, so when iterating the
+ * returned iterator points to a flow which hasn't been visited, yet. Entries
+ * following the erased one in its probing sequence are moved back, so that
+ * there is no need for markers of deleted slots.
+ * @param it Flow to be erased. It has to be obtained after the last copy of
+ *           the map has been made.
+ * @return Iterator to the flow now at the erased one's position.
+ */
+FlowStatMap::iterator FlowStatMap::erase(iterator it)
+{
+	Data &data = this->Mutable();
+	uint pos = (uint)(it - data.entries.begin());
+	uint mask = (uint)data.index.size() - 1;
+	uint hole = this->FindSlot(it->first);
+	for (uint slot = (hole + 1) & mask; data.index[slot] != 0; slot = (slot + 1) & mask) {
+		/* Move the entry into the hole unless its home slot is between the hole and its slot. */
+		uint home = this->HomeSlot(data.entries[data.index[slot] - 1].first);
+		if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+			data.index[hole] = data.index[slot];
+			hole = slot;
 		}
-		last_share = it->first;
 	}
-	if (flow > added_shares) {
-		new_shares[last_share + flow - added_shares] = st;
+	data.index[hole] = 0;
+
+	uint last = (uint)data.entries.size() - 1;
+	if (pos != last) {
+		data.index[this->FindSlot(data.entries[last].first)] = pos + 1;
+		data.entries[pos] = data.entries[last];
 	}
-	this->shares.swap(new_shares);
+	data.entries.pop_back();
+	return data.entries.begin() + pos;
 }
 
 /**
@@ -4175,13 +4249,27 @@ void FlowStatMap::DeleteFlows(StationID via)
 		FlowStat &s_flows = f_it->second;
 		s_flows.ChangeShare(via, INT_MIN);
 		if (s_flows.GetShares()->empty()) {
-			this->erase(f_it++);
+			f_it = this->erase(f_it);
 		} else {
 			++f_it;
 		}
 	}
 }
 
+/**
+ * Get the memory allocated for the flows.
+ * @return Memory used by the flows, in bytes.
+ */
+size_t FlowStatMap::MemoryUsage() const
+{
+	if (this->data == NULL) return 0;
+	size_t usage = sizeof(Data) + this->data->entries.capacity() * sizeof(value_type) + this->data->index.capacity() * sizeof(uint16);
+	for (FlowStatMap::const_iterator i = this->begin(); i != this->end(); ++i) {
+		usage += i->second.GetShares()->capacity() * sizeof(FlowStat::SharesMap::value_type);
+	}
+	return usage;
+}
+
 /**
  * Get the sum of flows via a specific station from this GoodsEntry.
  * @param via Remote station to look for.
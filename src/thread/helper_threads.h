@@ -0,0 +1,199 @@
+/* $Id$ */
+
+/*
+ * This file is part of OpenTTD.
+ * OpenTTD is free software; you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 2.
+ * OpenTTD is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details. You should have received a copy of the GNU General Public License along with OpenTTD. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file helper_threads.h Threads helping their owner with batches of work. */
+
+#ifndef HELPER_THREADS_H
+#define HELPER_THREADS_H
+
+#include "thread.h"
+#include "../core/smallvec_type.hpp"
+
+/**
+ * Function processing one item of a batch.
+ * @param param Parameter of the batch.
+ * @param item Index of the item to be processed.
+ */
+typedef void (*HelperItemProc)(void *param, uint item);
+
+/**
+ * Threads repeatedly helping the thread owning them with batches of work.
+ * They are started once and wait for the next batch in between, so that
+ * frequent short batches don't pay for starting threads each time. A batch
+ * consists of a number of items which are handed out one by one to the owner
+ * and the helpers taking part. Only the owner may start batches and change
+ * the number of helpers.
+ */
+class HelperThreads {
+private:
+	typedef SmallVector<ThreadObject *, 8> ThreadList;
+
+	ThreadList threads;      ///< Helper threads.
+	ThreadMutex *work_mutex; ///< Mutex for the current batch. Idle helpers wait for it to be signalled.
+	ThreadMutex *done_mutex; ///< Mutex for busy. The owner waits for it to be signalled.
+	HelperItemProc proc;     ///< Function of the current batch. Protected by work_mutex.
+	void *param;             ///< Parameter of the current batch. Protected by work_mutex.
+	uint items;              ///< Number of items of the current batch. Protected by work_mutex.
+	uint next;               ///< Next item to be handed out. Protected by work_mutex.
+	uint slots;              ///< Number of helpers which may still join the current batch. Protected by work_mutex.
+	bool stop;               ///< If the helpers should terminate. Protected by work_mutex.
+	uint busy;               ///< Number of helpers working on the current batch. Protected by done_mutex.
+
+	/**
+	 * Process items of the current batch until none are left.
+	 * @pre work_mutex is not held.
+	 */
+	void ProcessItems()
+	{
+		for (;;) {
+			this->work_mutex->BeginCritical();
+			uint item = this->next++;
+			this->work_mutex->EndCritical();
+			if (item >= this->items) return;
+			this->proc(this->param, item);
+		}
+	}
+
+	/**
+	 * Main loop of a helper thread. Joins batches as long as they have free
+	 * slots and tells the owner when it's done with one. This method is
+	 * tailored to ThreadObject::New.
+	 * @param h Pointer to the helper threads.
+	 */
+	static void Work(void *h)
+	{
+		HelperThreads *helpers = (HelperThreads *)h;
+		helpers->work_mutex->BeginCritical();
+		for (;;) {
+			while (helpers->slots == 0 && !helpers->stop) helpers->work_mutex->WaitForSignal();
+			if (helpers->stop) break;
+
+			/* Count the helper as busy before the owner can close the batch. */
+			helpers->slots--;
+			helpers->done_mutex->BeginCritical();
+			helpers->busy++;
+			helpers->done_mutex->EndCritical();
+			helpers->work_mutex->EndCritical();
+
+			helpers->ProcessItems();
+
+			helpers->done_mutex->BeginCritical();
+			if (--helpers->busy == 0) helpers->done_mutex->SendSignal();
+			helpers->done_mutex->EndCritical();
+
+			helpers->work_mutex->BeginCritical();
+		}
+		helpers->work_mutex->EndCritical();
+	}
+
+public:
+	/**
+	 * Create an empty set of helpers.
+	 */
+	HelperThreads() : work_mutex(NULL), done_mutex(NULL), proc(NULL), param(NULL), items(0), next(0), slots(0), stop(false), busy(0) {}
+
+	/**
+	 * Terminate the helpers.
+	 */
+	~HelperThreads() { this->Stop(); }
+
+	/**
+	 * Get the number of running helpers.
+	 * @return Number of helpers, not counting the owner.
+	 */
+	inline uint Count() const { return this->threads.Length(); }
+
+	/**
+	 * Make sure the given number of helpers is running, if threads can be
+	 * created at all. Additional helpers are started right away, while
+	 * reducing their number terminates all of them first.
+	 * @param count Number of helpers, not counting the owner.
+	 */
+	void Start(uint count)
+	{
+		if (count < this->threads.Length()) this->Stop();
+		if (count == this->threads.Length()) return;
+
+		if (this->work_mutex == NULL) {
+			this->work_mutex = ThreadMutex::New();
+			this->done_mutex = ThreadMutex::New();
+		}
+		while (this->threads.Length() < count) {
+			ThreadObject *thread;
+			if (!ThreadObject::New(&HelperThreads::Work, this, &thread)) break;
+			*this->threads.Append() = thread;
+		}
+	}
+
+	/**
+	 * Terminate all helpers.
+	 */
+	void Stop()
+	{
+		if (this->work_mutex == NULL) return;
+
+		this->work_mutex->BeginCritical();
+		this->stop = true;
+		for (uint i = 0; i < this->threads.Length(); ++i) this->work_mutex->SendSignal();
+		this->work_mutex->EndCritical();
+
+		for (ThreadObject **thread = this->threads.Begin(); thread != this->threads.End(); ++thread) {
+			(*thread)->Join();
+			delete *thread;
+		}
+		this->threads.Clear();
+		this->stop = false;
+
+		delete this->work_mutex;
+		delete this->done_mutex;
+		this->work_mutex = NULL;
+		this->done_mutex = NULL;
+	}
+
+	/**
+	 * Process a batch of items on the calling thread and up to the given
+	 * number of helpers. Returns when all items have been processed. Which
+	 * thread processes an item is left to chance, so the items must not
+	 * depend on each other.
+	 * @param proc Function processing an item.
+	 * @param param Parameter for the function.
+	 * @param items Number of items.
+	 * @param max_helpers Maximum number of helpers taking part.
+	 */
+	void Run(HelperItemProc proc, void *param, uint items, uint max_helpers = UINT_MAX)
+	{
+		uint num_helpers = min(min(max_helpers, this->threads.Length()), items > 0 ? items - 1 : 0);
+		if (num_helpers == 0) {
+			for (uint item = 0; item < items; ++item) proc(param, item);
+			return;
+		}
+
+		this->work_mutex->BeginCritical();
+		this->proc = proc;
+		this->param = param;
+		this->items = items;
+		this->next = 0;
+		this->slots = num_helpers;
+		for (uint i = 0; i < num_helpers; ++i) this->work_mutex->SendSignal();
+		this->work_mutex->EndCritical();
+
+		this->ProcessItems();
+
+		/* Close the batch, so that no helper joins it after it's done. */
+		this->work_mutex->BeginCritical();
+		this->slots = 0;
+		this->work_mutex->EndCritical();
+
+		this->done_mutex->BeginCritical();
+		while (this->busy > 0) this->done_mutex->WaitForSignal();
+		this->done_mutex->EndCritical();
+	}
+};
+
+#endif /* HELPER_THREADS_H */
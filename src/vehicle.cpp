@@ -859,8 +859,7 @@ void CallVehicleTicks()
 
 	RunVehicleDayProc();
 
-	Station *st;
-	FOR_ALL_STATIONS(st) LoadUnloadStation(st);
+	LoadUnloadStations();
 
 	Vehicle *v;
 	FOR_ALL_VEHICLES(v) {